@@ -0,0 +1,44 @@
+#!/bin/sh
+#
+#	Replay one recorded trace at a range of block cache sizes and
+#	print CSV: block_entries,requests_per_sec,block_hit_ratio.
+#
+#	Usage: bench/cachesweep.sh trace_file disk_file [block_entries ...]
+#
+#	Record the trace with a yfs built with RECORD=1 running a
+#	representative workload whose blocks don't all fit the cache, or
+#	on Unix with yfsbench-host built with RECORD=1 (the records go to
+#	standard error), and build yfsreplay first (make yfsreplay).
+#	bench/README.md has a sweep and how its trace was made.
+#	Extra yfsreplay cache options can be passed in SWEEP_OPTS, for
+#	example SWEEP_OPTS="-i 256".
+#
+
+REPLAY=${REPLAY:-./yfsreplay}
+
+if [ $# -lt 2 ]; then
+	echo "usage: $0 trace_file disk_file [block_entries ...]" >&2
+	exit 1
+fi
+
+trace=$1
+disk=$2
+shift 2
+sizes=${*:-"32 64 128 256 512 1024 2048 4096"}
+out=${TMPDIR:-/tmp}/cachesweep.$$
+
+echo "block_entries,requests_per_sec,block_hit_ratio"
+for size in $sizes; do
+	$REPLAY -o "$out" -b "$size" $SWEEP_OPTS "$trace" "$disk" |
+	awk -v size="$size" '
+		/ requests\/s/ { rate = $3 }
+		/^block cache:/ {
+			gsub(",", "")
+			hits = $5; misses = $7
+		}
+		END {
+			total = hits + misses
+			printf "%s,%s,%.4f\n", size, rate, total ? hits / total : 0
+		}'
+done
+rm -f "$out"
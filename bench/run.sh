@@ -0,0 +1,33 @@
+#!/bin/sh
+#
+#	Run every yfsbench workload on a fresh file system and print one
+#	CSV table.
+#
+#	Usage: bench/run.sh [yfsbench options]
+#
+#	Runs the Unix build (make bench) on a new mkyfs image for each
+#	workload, so runs don't see each other's files.  Options are passed
+#	through, for example bench/run.sh -c 8 -n 10000 -b 256.  Set
+#	WORKLOADS to run a subset and INODES for the mkyfs inode count.
+#
+
+BENCH=${BENCH:-./yfsbench-host}
+MKYFS=${MKYFS:-./mkyfs}
+WORKLOADS=${WORKLOADS:-"meta smallfile stream random deep truncate replace create batch seekread pread seekwrite writev coldscan"}
+dir=${TMPDIR:-/tmp}/yfsbench.$$
+
+mkdir -p "$dir" || exit 1
+mkyfs=$(cd "$(dirname "$MKYFS")" && pwd)/$(basename "$MKYFS")
+(cd "$dir" && "$mkyfs" $INODES > /dev/null) || exit 1
+
+header=
+for workload in $WORKLOADS; do
+	cp "$dir/DISK" "$dir/DISK.run"
+	$BENCH -D "$dir/DISK.run" "$@" "$workload" > "$dir/out" || exit 1
+	if [ -z "$header" ]; then
+		header=1
+		grep '^#' "$dir/out"
+	fi
+	grep -v '^#' "$dir/out"
+done
+rm -rf "$dir"
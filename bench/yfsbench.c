@@ -0,0 +1,725 @@
+/*
+ *  YFS workload generator.
+ *
+ *  Usage (Yalnix):  yalnix yfs yfsbench [options] workload
+ *  Usage (Unix):    yfsbench-host -D disk_file [cache options] [options] workload
+ *
+ *  Workloads:
+ *	meta		create/close, stat and unlink storms over -f files
+ *	smallfile	whole-file reads and rewrites of -f files of -s bytes
+ *	stream		sequential -s byte writes, then reads, of a -l byte file
+ *	random		-s byte PRead (70%) / PWrite (30%) at aligned offsets
+ *			of a -l byte file
+ *	deep		Stat of a file -d directories deep
+ *	truncate	FTruncate of a -l byte file, -s bytes shorter each
+ *			time; once it is empty it is written back to -l
+ *			bytes in -s byte PWrites, in one operation
+ *	replace		write a new -s byte version of one of -f files beside
+ *			it, then Rename it over the old one
+ *	create		Create, write -s bytes to and Close each of -f files,
+ *			one call at a time, in one operation
+ *	batch		the same as create, but as a CREATE and a chained
+ *			WRITE per file packed into as few BATCH messages as
+ *			hold them
+ *	seekread	Seek and Read of -s bytes at aligned offsets of a -l
+ *			byte file
+ *	pread		the same reads as one PRead each
+ *	seekwrite	Seek, then 16 Writes of -s/16 bytes, at aligned
+ *			offsets of a -l byte file
+ *	writev		the same writes as a Seek and one 16 segment WriteV
+ *	coldscan	client 0 reads a -l byte file front to back in -s
+ *			byte PReads while the other clients PRead one -s
+ *			byte file each; with -l past the cache, client 0
+ *			misses while the others hit (compare their lines)
+ *
+ *  Options:
+ *	-c clients	concurrent clients (default 1)
+ *	-n ops		operations per client (default 3000)
+ *	-f files	files per client (default 8)
+ *	-s size		request size in bytes (default 512)
+ *	-l length	file length for the workloads on one file (default
+ *			32768)
+ *	-d depth	directory depth for deep (default 8)
+ *	-S n		Sync after every n operations of a client, so results
+ *			are durable on a server without a journal (default 0,
+ *			never)
+ *
+ *  Each client works in its own directory /bench<client>.  Under Yalnix
+ *  every client is a separate process; the Unix build runs the server
+ *  in-process (see hostshim.c) and interleaves the clients one
+ *  operation at a time.  The Unix build also takes -D, the DISK image
+ *  to run on (modified in place), the yfs cache options -b, -i, -m
+ *  (-s is the request size here, not the inode cache share), the yfs
+ *  journal options -J and -G, and -k n, which stops after n operations
+ *  in all without syncing, as if the server had crashed.  After the
+ *  results it prints a '#' line with the mount time, which includes
+ *  journal replay, and the sector reads, writes and seeks and the
+ *  server's block map hits and misses (see GetStats) of the run.
+ *
+ *  Results are CSV lines, after a header line starting with '#':
+ *
+ *	workload,clients,ops,errors,bytes,seconds,ops_per_sec,mb_per_sec,
+ *	p50,p99,max,unit
+ *
+ *  Latency percentiles are per operation.  Yalnix has no clock, so
+ *  there the unit is time stamp counter cycles and seconds is left
+ *  empty; on Unix the cycle counter is calibrated and the unit is us.
+ *  Under Yalnix each client prints its own line (workload name suffixed
+ *  with /client) and the parent adds a line with the total ops per
+ *  billion cycles in ops_per_sec.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <comp421/yalnix.h>
+#include <comp421/filesystem.h>
+#include "../include/iolib.h"
+#include "../include/histogram.h"
+#include "../include/yfstime.h"
+#ifdef YFS_HOST
+#include <time.h>
+#include <unistd.h>
+#include "../include/hostshim.h"
+#endif
+
+#define MAX_CLIENTS 64
+#define MAX_DEPTH 60
+
+/* Largest file with direct blocks and three levels of indirect blocks */
+#define PTRS_PER_BLOCK (BLOCKSIZE / (int)sizeof(int))
+#define MAX_FILE_LENGTH ((NUM_DIRECT + PTRS_PER_BLOCK + PTRS_PER_BLOCK * PTRS_PER_BLOCK + \
+    PTRS_PER_BLOCK * PTRS_PER_BLOCK * PTRS_PER_BLOCK) * BLOCKSIZE)
+
+typedef struct Client {
+    int id;
+    char dir[DIRNAMELEN];
+    /* File kept open by stream and random */
+    int fd;
+    unsigned int seed;
+    long long bytes;
+    int errors;
+} Client;
+
+typedef struct Workload {
+    char* name;
+    int (*setup)(Client* client);
+    /* Run operation i, return bytes moved or ERROR */
+    int (*step)(Client* client, int i);
+} Workload;
+
+static int num_clients = 1;
+static int num_ops = 3000;
+static int num_files = 8;
+static int req_size = 512;
+static int file_length = 32768;
+static int depth = 8;
+static int sync_every = 0;
+
+static char* buf;
+
+/* As large a buffer as one BATCH message may carry (MAX_BATCH_SIZE) */
+#define BATCH_BUF_SIZE (64 * 1024)
+static char batch_buf[BATCH_BUF_SIZE];
+
+/* Pieces of each write in seekwrite and writev */
+#define NUM_SEGMENTS 16
+
+static Histogram latency;
+
+static unsigned int Random(Client* client) {
+    client->seed = client->seed * 1103515245 + 12345;
+    return (client->seed >> 16) & 0x7fff;
+}
+
+static void FilePath(Client* client, int k, char* path) {
+    sprintf(path, "/%s/f%d", client->dir, k);
+}
+
+/* Create path holding length bytes of buf */
+static int FillFile(char* path, int length) {
+    int fd = Create(path);
+    if (fd == ERROR) {
+        return ERROR;
+    }
+
+    int done = 0;
+    while (done < length) {
+        int chunk = (length - done < req_size) ? length - done : req_size;
+        if (Write(fd, buf, chunk) != chunk) {
+            Close(fd);
+            return ERROR;
+        }
+        done += chunk;
+    }
+
+    return fd;
+}
+
+static int MetaSetup(Client* client) {
+    return 0;
+}
+
+/* Rounds of: create every file, stat every file, unlink every file */
+static int MetaStep(Client* client, int i) {
+    char path[MAXPATHNAMELEN];
+    int round = i % (3 * num_files);
+    FilePath(client, round % num_files, path);
+
+    struct Stat stat;
+    switch (round / num_files) {
+        case 0: {
+            int fd = Create(path);
+            return (fd == ERROR) ? ERROR : Close(fd);
+        }
+        case 1:
+            return Stat(path, &stat);
+        default:
+            return Unlink(path);
+    }
+}
+
+static int SmallFileSetup(Client* client) {
+    char path[MAXPATHNAMELEN];
+    int k;
+    for (k = 0; k < num_files; ++k) {
+        FilePath(client, k, path);
+        int fd = FillFile(path, req_size);
+        if (fd == ERROR) {
+            return ERROR;
+        }
+        Close(fd);
+    }
+
+    return 0;
+}
+
+static int SmallFileStep(Client* client, int i) {
+    char path[MAXPATHNAMELEN];
+    FilePath(client, Random(client) % num_files, path);
+
+    int fd = Open(path);
+    if (fd == ERROR) {
+        return ERROR;
+    }
+
+    int len = (Random(client) % 2) ? Read(fd, buf, req_size) : Write(fd, buf, req_size);
+    Close(fd);
+    return len;
+}
+
+static int StreamSetup(Client* client) {
+    char path[MAXPATHNAMELEN];
+    FilePath(client, 0, path);
+    client->fd = Create(path);
+    return client->fd;
+}
+
+/* Write the file front to back, over and over, then read it the same way */
+static int StreamStep(Client* client, int i) {
+    if (i == num_ops / 2 || (i * req_size) % file_length == 0) {
+        if (Seek(client->fd, 0, SEEK_SET) == ERROR) {
+            return ERROR;
+        }
+    }
+
+    if (i < num_ops / 2) {
+        return Write(client->fd, buf, req_size);
+    }
+
+    return Read(client->fd, buf, req_size);
+}
+
+static int RandomSetup(Client* client) {
+    char path[MAXPATHNAMELEN];
+    FilePath(client, 0, path);
+    client->fd = FillFile(path, file_length);
+    return client->fd;
+}
+
+static int RandomStep(Client* client, int i) {
+    int offset = (Random(client) % (file_length / req_size)) * req_size;
+    if (Random(client) % 10 < 7) {
+        return PRead(client->fd, buf, req_size, offset);
+    }
+
+    return PWrite(client->fd, buf, req_size, offset);
+}
+
+/* Random reads as a Seek and a Read, the two requests PRead replaces */
+static int SeekReadStep(Client* client, int i) {
+    int offset = (Random(client) % (file_length / req_size)) * req_size;
+    if (Seek(client->fd, offset, SEEK_SET) == ERROR) {
+        return ERROR;
+    }
+
+    return Read(client->fd, buf, req_size);
+}
+
+static int PReadStep(Client* client, int i) {
+    int offset = (Random(client) % (file_length / req_size)) * req_size;
+    return PRead(client->fd, buf, req_size, offset);
+}
+
+/* A random -s byte write made of NUM_SEGMENTS pieces, one Write each */
+static int SeekWriteStep(Client* client, int i) {
+    int offset = (Random(client) % (file_length / req_size)) * req_size;
+    if (Seek(client->fd, offset, SEEK_SET) == ERROR) {
+        return ERROR;
+    }
+
+    int piece = req_size / NUM_SEGMENTS;
+    int k;
+    for (k = 0; k < NUM_SEGMENTS; ++k) {
+        if (Write(client->fd, buf + k * piece, piece) != piece) {
+            return ERROR;
+        }
+    }
+
+    return NUM_SEGMENTS * piece;
+}
+
+/* The same write gathered into one WriteV */
+static int WriteVStep(Client* client, int i) {
+    int offset = (Random(client) % (file_length / req_size)) * req_size;
+    if (Seek(client->fd, offset, SEEK_SET) == ERROR) {
+        return ERROR;
+    }
+
+    struct IoVec iov[NUM_SEGMENTS];
+    int piece = req_size / NUM_SEGMENTS;
+    int k;
+    for (k = 0; k < NUM_SEGMENTS; ++k) {
+        iov[k].base = buf + k * piece;
+        iov[k].len = piece;
+    }
+
+    return WriteV(client->fd, iov, NUM_SEGMENTS);
+}
+
+/* Client 0 scans a -l byte file, the others keep rereading one -s byte file */
+static int ColdScanSetup(Client* client) {
+    char path[MAXPATHNAMELEN];
+    FilePath(client, 0, path);
+    client->fd = FillFile(path, (client->id == 0) ? file_length : req_size);
+    return client->fd;
+}
+
+static int ColdScanStep(Client* client, int i) {
+    int offset = (client->id == 0) ? (i % (file_length / req_size)) * req_size : 0;
+    return PRead(client->fd, buf, req_size, offset);
+}
+
+static int TruncateStep(Client* client, int i) {
+    int cuts = file_length / req_size;
+    int k = i % (cuts + 1);
+    if (k < cuts) {
+        return FTruncate(client->fd, file_length - (k + 1) * req_size);
+    }
+
+    int offset;
+    for (offset = 0; offset < file_length; offset += req_size) {
+        if (PWrite(client->fd, buf, req_size, offset) != req_size) {
+            return ERROR;
+        }
+    }
+
+    return file_length;
+}
+
+/* Atomic replace: write the new version under a temporary name, then rename it */
+static int ReplaceStep(Client* client, int i) {
+    char path[MAXPATHNAMELEN];
+    char temp[MAXPATHNAMELEN];
+    FilePath(client, Random(client) % num_files, path);
+    if (snprintf(temp, sizeof(temp), "%s.tmp", path) >= (int)sizeof(temp)) {
+        return ERROR;
+    }
+
+    int fd = Create(temp);
+    if (fd == ERROR) {
+        return ERROR;
+    }
+
+    int len = Write(fd, buf, req_size);
+    Close(fd);
+    if (len != req_size || Rename(temp, path) == ERROR) {
+        return ERROR;
+    }
+
+    return len;
+}
+
+/* Create and write every file, one call at a time */
+static int CreateStep(Client* client, int i) {
+    char path[MAXPATHNAMELEN];
+    int k;
+    for (k = 0; k < num_files; ++k) {
+        FilePath(client, k, path);
+        int fd = Create(path);
+        if (fd == ERROR) {
+            return ERROR;
+        }
+
+        int len = Write(fd, buf, req_size);
+        Close(fd);
+        if (len != req_size) {
+            return ERROR;
+        }
+    }
+
+    return num_files * req_size;
+}
+
+/* Send the ops added so far and fail if any of them did */
+static int FlushBatch(struct Batch* batch) {
+    if (SubmitBatch(batch) == ERROR) {
+        return ERROR;
+    }
+
+    int k;
+    for (k = 0; k < batch->count; ++k) {
+        if (BatchOpResult(batch, k)->result == ERROR) {
+            return ERROR;
+        }
+    }
+
+    BatchInit(batch, batch->buf, batch->size);
+    return 0;
+}
+
+/* The same files as create, each a CREATE and a chained WRITE in as few BATCH messages as fit */
+static int BatchStep(Client* client, int i) {
+    char path[MAXPATHNAMELEN];
+    struct Batch batch;
+    BatchInit(&batch, batch_buf, BATCH_BUF_SIZE);
+
+    int k;
+    for (k = 0; k < num_files; ++k) {
+        FilePath(client, k, path);
+        int count = batch.count;
+        int payload = batch.payload;
+        if (BatchAdd(&batch, BATCH_CREATE, 0, path, NULL) == ERROR ||
+            BatchAddIO(&batch, BATCH_WRITE, BATCH_CHAIN, ERROR, buf, req_size, 0) == ERROR) {
+            /* Full: take back a lone CREATE and start a new message */
+            batch.count = count;
+            batch.payload = payload;
+            if (count == 0 || FlushBatch(&batch) == ERROR) {
+                return ERROR;
+            }
+            --k;
+        }
+    }
+
+    if (FlushBatch(&batch) == ERROR) {
+        return ERROR;
+    }
+
+    return num_files * req_size;
+}
+
+static void DeepPath(Client* client, char* path) {
+    int len = sprintf(path, "/%s", client->dir);
+    int d;
+    for (d = 0; d < depth; ++d) {
+        len += sprintf(path + len, "/d%d", d);
+    }
+}
+
+static int DeepSetup(Client* client) {
+    char path[MAXPATHNAMELEN];
+    int len = sprintf(path, "/%s", client->dir);
+    int d;
+    for (d = 0; d < depth; ++d) {
+        len += sprintf(path + len, "/d%d", d);
+        if (MkDir(path) == ERROR) {
+            return ERROR;
+        }
+    }
+
+    strcat(path, "/f");
+    int fd = Create(path);
+    return (fd == ERROR) ? ERROR : Close(fd);
+}
+
+static int DeepStep(Client* client, int i) {
+    char path[MAXPATHNAMELEN];
+    struct Stat stat;
+    DeepPath(client, path);
+    strcat(path, "/f");
+    return Stat(path, &stat);
+}
+
+static Workload workloads[] = {
+    {"meta", MetaSetup, MetaStep},
+    {"smallfile", SmallFileSetup, SmallFileStep},
+    {"stream", StreamSetup, StreamStep},
+    {"random", RandomSetup, RandomStep},
+    {"deep", DeepSetup, DeepStep},
+    {"truncate", RandomSetup, TruncateStep},
+    {"replace", SmallFileSetup, ReplaceStep},
+    {"create", MetaSetup, CreateStep},
+    {"batch", MetaSetup, BatchStep},
+    {"seekread", RandomSetup, SeekReadStep},
+    {"pread", RandomSetup, PReadStep},
+    {"seekwrite", RandomSetup, SeekWriteStep},
+    {"writev", RandomSetup, WriteVStep},
+    {"coldscan", ColdScanSetup, ColdScanStep},
+};
+
+#define NUM_WORKLOADS (int)(sizeof(workloads) / sizeof(Workload))
+
+static int InitClient(Workload* workload, Client* client, int id) {
+    memset(client, 0, sizeof(Client));
+    client->id = id;
+    client->fd = ERROR;
+    client->seed = 1 + id;
+    sprintf(client->dir, "bench%d", id);
+
+    char path[MAXPATHNAMELEN];
+    sprintf(path, "/%s", client->dir);
+    if (MkDir(path) == ERROR || workload->setup(client) == ERROR) {
+        fprintf(stderr, "%s: setup failed for client %d\n", workload->name, id);
+        return ERROR;
+    }
+
+    return 0;
+}
+
+static void RunStep(Workload* workload, Client* client, int i) {
+    unsigned long long start = ReadTimeStamp();
+    int len = workload->step(client, i);
+    if (sync_every > 0 && (i + 1) % sync_every == 0 && Sync() == ERROR) {
+        len = ERROR;
+    }
+    RecordValue(&latency, ReadTimeStamp() - start);
+
+    if (len == ERROR) {
+        ++client->errors;
+    } else {
+        client->bytes += len;
+    }
+}
+
+static void PrintHeader(void) {
+    printf("# workload,clients,ops,errors,bytes,seconds,ops_per_sec,mb_per_sec,p50,p99,max,unit\n");
+}
+
+/* cycles_per_us is 0 when the cycle counter can't be calibrated */
+static void PrintResult(char* name, int clients, int ops, int errors, long long bytes,
+    unsigned long long cycles, double cycles_per_us) {
+    if (cycles_per_us > 0) {
+        double seconds = cycles / cycles_per_us / 1e6;
+        printf("%s,%d,%d,%d,%lld,%.6f,%.1f,%.3f,%.2f,%.2f,%.2f,us\n", name, clients, ops,
+            errors, bytes, seconds, ops / seconds, bytes / seconds / 1e6,
+            GetPercentile(&latency, 50.0) / cycles_per_us,
+            GetPercentile(&latency, 99.0) / cycles_per_us, latency.max / cycles_per_us);
+    } else {
+        printf("%s,%d,%d,%d,%lld,,%.1f,,%llu,%llu,%llu,cycles\n", name, clients, ops,
+            errors, bytes, cycles ? ops * 1e9 / cycles : 0.0,
+            GetPercentile(&latency, 50.0), GetPercentile(&latency, 99.0), latency.max);
+    }
+}
+
+#ifdef YFS_HOST
+
+static int crash_after = 0;
+
+static double CalibrateCycles(void) {
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned long long tsc = ReadTimeStamp();
+
+    double us;
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        us = (now.tv_sec - start.tv_sec) * 1e6 + (now.tv_nsec - start.tv_nsec) / 1e3;
+    } while (us < 20000);
+
+    return (ReadTimeStamp() - tsc) / us;
+}
+
+/* One process: interleave the clients an operation at a time */
+static void RunWorkload(Workload* workload) {
+    static Client clients[MAX_CLIENTS];
+    int c;
+    for (c = 0; c < num_clients; ++c) {
+        if (InitClient(workload, &clients[c], c) == ERROR) {
+            exit(1);
+        }
+    }
+
+    double cycles_per_us = CalibrateCycles();
+    unsigned long long start = ReadTimeStamp();
+
+    int i;
+    for (i = 0; i < num_ops; ++i) {
+        for (c = 0; c < num_clients; ++c) {
+            if (crash_after > 0 && i * num_clients + c == crash_after) {
+                /* _exit, so the clients' files aren't closed on the way out */
+                printf("# stopped without syncing after %d operations\n", crash_after);
+                fflush(stdout);
+                _exit(0);
+            }
+
+            RunStep(workload, &clients[c], i);
+        }
+    }
+
+    unsigned long long cycles = ReadTimeStamp() - start;
+    int errors = 0;
+    long long bytes = 0;
+    for (c = 0; c < num_clients; ++c) {
+        errors += clients[c].errors;
+        bytes += clients[c].bytes;
+    }
+
+    PrintHeader();
+    PrintResult(workload->name, num_clients, num_ops * num_clients, errors, bytes, cycles,
+        cycles_per_us);
+}
+
+#else
+
+/* One process per client, each reports for itself */
+static void RunWorkload(Workload* workload) {
+    PrintHeader();
+    unsigned long long start = ReadTimeStamp();
+
+    int c;
+    for (c = 0; c < num_clients; ++c) {
+        if (Fork() != 0) {
+            continue;
+        }
+
+        Client client;
+        if (InitClient(workload, &client, c) == ERROR) {
+            Exit(1);
+        }
+
+        unsigned long long client_start = ReadTimeStamp();
+        int i;
+        for (i = 0; i < num_ops; ++i) {
+            RunStep(workload, &client, i);
+        }
+
+        char name[64];
+        sprintf(name, "%s/%d", workload->name, c);
+        PrintResult(name, 1, num_ops, client.errors, client.bytes,
+            ReadTimeStamp() - client_start, 0);
+        Exit(0);
+    }
+
+    int status;
+    for (c = 0; c < num_clients; ++c) {
+        Wait(&status);
+    }
+
+    /* Latency comes from the clients, this line only has throughput */
+    ResetHistogram(&latency);
+    PrintResult(workload->name, num_clients, num_ops * num_clients, 0, 0,
+        ReadTimeStamp() - start, 0);
+}
+
+#endif
+
+static void Usage(void) {
+    fprintf(stderr, "usage: yfsbench "
+#ifdef YFS_HOST
+        "-D disk_file [-b blocks] [-i inodes] [-m kb] [-J blocks] [-G group] [-k ops] "
+#endif
+        "[-c clients] [-n ops] [-f files] [-s size] [-l length] [-d depth] [-S n] workload\n");
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+#ifdef YFS_HOST
+    char* disk = NULL;
+    CacheConfig config;
+    InitCacheConfig(&config);
+    JournalConfig journal_config;
+    InitJournalConfig(&journal_config);
+#endif
+
+    int i = 1;
+    while (i + 1 < argc && argv[i][0] == '-') {
+        char* option = argv[i];
+        char* value = argv[i + 1];
+        int n = atoi(value);
+        i += 2;
+
+        if (strcmp(option, "-c") == 0 && n > 0) {
+            num_clients = n;
+        } else if (strcmp(option, "-n") == 0 && n > 0) {
+            num_ops = n;
+        } else if (strcmp(option, "-f") == 0 && n > 0) {
+            num_files = n;
+        } else if (strcmp(option, "-s") == 0 && n > 0) {
+            req_size = n;
+        } else if (strcmp(option, "-l") == 0 && n > 0) {
+            file_length = n;
+        } else if (strcmp(option, "-d") == 0 && n > 0) {
+            depth = n;
+        } else if (strcmp(option, "-S") == 0 && n >= 0) {
+            sync_every = n;
+#ifdef YFS_HOST
+        } else if (strcmp(option, "-D") == 0) {
+            disk = value;
+        } else if (strcmp(option, "-k") == 0 && n > 0) {
+            crash_after = n;
+        } else if (ParseCacheOption(&config, option, value) ||
+            ParseJournalOption(&journal_config, option, value)) {
+            continue;
+#endif
+        } else {
+            Usage();
+        }
+    }
+
+    if (i != argc - 1 || num_clients > MAX_CLIENTS || depth > MAX_DEPTH ||
+        file_length > MAX_FILE_LENGTH || file_length % req_size != 0) {
+        Usage();
+    }
+
+    Workload* workload = NULL;
+    int w;
+    for (w = 0; w < NUM_WORKLOADS; ++w) {
+        if (strcmp(argv[i], workloads[w].name) == 0) {
+            workload = &workloads[w];
+        }
+    }
+
+    if (workload == NULL) {
+        Usage();
+    }
+
+#ifdef YFS_HOST
+    struct timespec mount_start, mount_end;
+    clock_gettime(CLOCK_MONOTONIC, &mount_start);
+    if (disk == NULL || BootHostServer(disk, &config, &journal_config) == ERROR) {
+        Usage();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &mount_end);
+    double mount_ms = (mount_end.tv_sec - mount_start.tv_sec) * 1e3 +
+        (mount_end.tv_nsec - mount_start.tv_nsec) / 1e6;
+    HostDiskStats disk_stats;
+    GetHostDiskStats(&disk_stats, true);
+    struct YfsStats stats;
+    GetStats(&stats, 1);
+#endif
+
+    buf = (char*)malloc(req_size);
+    memset(buf, 'b', req_size);
+
+    RunWorkload(workload);
+
+#ifdef YFS_HOST
+    Sync();
+    GetHostDiskStats(&disk_stats, false);
+    GetStats(&stats, 0);
+    printf("# mount %.3f ms, %d sectors read, %d written, %d seeks, "
+        "%u block map hits, %u misses\n", mount_ms, disk_stats.reads, disk_stats.writes,
+        disk_stats.seeks, stats.map_hits, stats.map_misses);
+#endif
+    return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ *  Unix stand-ins for the Yalnix calls made by the YFS server, so the
+ *  server code can be linked into host tools such as yfsreplay.  Only
+ *  the calls needed to serve requests in-process do anything: there are
+ *  no other processes, so Fork fails (the server then reads the disk
+ *  synchronously).  A Send to the file server dispatches the message
+ *  on the spot, which lets iolib programs run against the server in one
+ *  Unix process.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <comp421/yalnix.h>
+#include <comp421/hardware.h>
+#include "include/hostshim.h"
+#include "include/yfs.h"
+#include "include/coroutine.h"
+#include "include/openfile.h"
+#include "include/journal.h"
+#include "include/reclaim.h"
+
+static int disk_fd = -1;
+
+static HostDiskStats disk_stats;
+
+/* Sector after the last one read or written, -1 before any access */
+static int next_sector = -1;
+
+int OpenHostDisk(char* path) {
+    memset(&disk_stats, 0, sizeof(HostDiskStats));
+    next_sector = -1;
+    disk_fd = open(path, O_RDWR);
+    if (disk_fd < 0) {
+        perror(path);
+        return ERROR;
+    }
+
+    return 0;
+}
+
+/*
+ * Mount the image at disk_path as the server would at startup.  A disk
+ * without a journal gets one if journal_config asks for it, NULL keeps
+ * the disk as it is.
+ */
+int BootHostServer(char* disk_path, CacheConfig* config, JournalConfig* journal_config) {
+    if (OpenHostDisk(disk_path) == ERROR) {
+        return ERROR;
+    }
+
+    if (InitFileSystem(config, journal_config) == ERROR) {
+        fprintf(stderr, "%s: not a YFS image\n", disk_path);
+        return ERROR;
+    }
+
+    InitCoroutines();
+    InitOpenFiles();
+    return 0;
+}
+
+void CloseHostDisk(void) {
+    if (disk_fd >= 0) {
+        close(disk_fd);
+        disk_fd = -1;
+    }
+}
+
+int ReadSector(int sector, void* buf) {
+    if (disk_fd < 0 || sector < 0 || sector >= NUMSECTORS) {
+        return ERROR;
+    }
+
+    ++disk_stats.reads;
+    if (sector != next_sector) {
+        ++disk_stats.seeks;
+    }
+    next_sector = sector + 1;
+
+    /* Holes past the end of the file read as zeros, like mkyfs expects */
+    ssize_t len = pread(disk_fd, buf, SECTORSIZE, (off_t)sector * SECTORSIZE);
+    if (len < 0) {
+        return ERROR;
+    }
+    memset((char*)buf + len, 0, SECTORSIZE - len);
+
+    return 0;
+}
+
+int WriteSector(int sector, void* buf) {
+    if (disk_fd < 0 || sector < 0 || sector >= NUMSECTORS) {
+        return ERROR;
+    }
+
+    ++disk_stats.writes;
+    if (sector != next_sector) {
+        ++disk_stats.seeks;
+    }
+    next_sector = sector + 1;
+
+    if (pwrite(disk_fd, buf, SECTORSIZE, (off_t)sector * SECTORSIZE) != SECTORSIZE) {
+        return ERROR;
+    }
+
+    return 0;
+}
+
+void GetHostDiskStats(HostDiskStats* stats, bool reset) {
+    *stats = disk_stats;
+    if (reset) {
+        memset(&disk_stats, 0, sizeof(HostDiskStats));
+    }
+}
+
+int CopyFrom(int srcpid, void* dest, void* src, int len) {
+    memcpy(dest, src, len);
+    return 0;
+}
+
+int CopyTo(int destpid, void* dest, void* src, int len) {
+    memcpy(dest, src, len);
+    return 0;
+}
+
+int Reply(void* msg, int pid) {
+    return 0;
+}
+
+int Send(void* msg, int pid) {
+    if (pid != -FILE_SERVER) {
+        return ERROR;
+    }
+
+    DispatchMessage((Message*)msg, GetPid());
+    ReclaimDeferred();
+    ReclaimBetweenRequests();
+    return 0;
+}
+
+int Receive(void* msg) {
+    return ERROR;
+}
+
+int Register(unsigned int service_id) {
+    return 0;
+}
+
+int Fork(void) {
+    return ERROR;
+}
+
+int Exec(char* filename, char** argvec) {
+    return ERROR;
+}
+
+void Exit(int status) {
+    exit(status);
+}
+
+int GetPid(void) {
+    return 0;
+}
+
+int Delay(int clock_ticks) {
+    return 0;
+}
+
+void TracePrintf(int level, char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
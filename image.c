@@ -0,0 +1,311 @@
+/*
+ *  Host-side helpers for DISK images: create one in the mkyfs layout,
+ *  and summarize the layout of one for the image tools.  Blocks are
+ *  read with the server's ReadBlockSector, over ReadSector from
+ *  hostshim.c, so the disk must be opened with OpenHostDisk (and the
+ *  server's caches synced) before a scan.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <comp421/yalnix.h>
+#include <comp421/filesystem.h>
+#include "include/image.h"
+#include "include/journal.h"
+
+/* Block shift for blocks of block_size bytes, ERROR unless that is 2^k sectors */
+int BlockShiftFor(int block_size) {
+    int shift;
+    for (shift = 0; shift <= MAX_BLOCK_SHIFT; ++shift) {
+        if (SECTORSIZE << shift == block_size) {
+            return shift;
+        }
+    }
+
+    return ERROR;
+}
+
+int FormatImage(char* path, int num_inodes, int shift) {
+    int disk = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (disk < 0) {
+        perror(path);
+        return ERROR;
+    }
+
+    block_shift = shift;
+
+    /* Header and inodes from block 1, rounded up to whole blocks */
+    int inodes_size = (num_inodes + 1) * INODESIZE;
+    inodes_size = (inodes_size + BLOCKSIZE - 1) & ~(BLOCKSIZE - 1);
+    char* inodes = (char*)calloc(1, inodes_size);
+
+    struct fs_header* header = (struct fs_header*)inodes;
+    header->num_blocks = NUMSECTORS >> shift;
+    header->num_inodes = num_inodes;
+    BLOCK_SHIFT(header) = shift;
+
+    struct inode* root = (struct inode*)inodes + ROOTINODE;
+    root->type = INODE_DIRECTORY;
+    root->nlink = 2;
+    root->size = 2 * sizeof(struct dir_entry);
+    root->direct[0] = inodes_size / BLOCKSIZE + 1;
+
+    struct dir_entry entries[2];
+    memset(entries, 0, sizeof(entries));
+    entries[0].inum = ROOTINODE;
+    entries[0].name[0] = '.';
+    entries[1].inum = ROOTINODE;
+    memcpy(entries[1].name, "..", 2);
+
+    /* The rest of the disk is a hole, which reads as zeros */
+    char last[BLOCKSIZE];
+    memset(last, 0, BLOCKSIZE);
+
+    /* With larger blocks sector 1 also gets the header, see yfs.h */
+    int status = 0;
+    if (pwrite(disk, inodes, inodes_size, BLOCKSIZE) != inodes_size ||
+        pwrite(disk, inodes, SECTORSIZE, SECTORSIZE) != SECTORSIZE ||
+        pwrite(disk, entries, sizeof(entries), BLOCKSIZE + inodes_size) != sizeof(entries) ||
+        pwrite(disk, last, BLOCKSIZE, (off_t)BLOCKSIZE * (header->num_blocks - 1)) != BLOCKSIZE) {
+        perror(path);
+        status = ERROR;
+    }
+
+    free(inodes);
+    close(disk);
+    return status;
+}
+
+/*
+ * Fill blocks[first..count) from indirect block bnum, levels above the
+ * data, and the blocks below it, marking them used.
+ */
+static void ListIndirect(int bnum, int levels, int first, int* blocks, int count, char* used,
+    ImageStats* stats) {
+    if (bnum <= 0 || bnum >= stats->num_blocks || levels > MAX_INDIRECT_LEVELS) {
+        return;
+    }
+
+    int* entries = (int*)malloc(BLOCKSIZE);
+    if (ReadBlockSector(bnum, entries) == ERROR) {
+        free(entries);
+        return;
+    }
+
+    used[bnum] = 1;
+    ++stats->indirect_blocks;
+
+    int span = IndirectSpan(levels - 1);
+    int i;
+    for (i = 0; i < PTRS_PER_BLOCK && i < (count - first + span - 1) / span; ++i) {
+        if (levels == 1) {
+            blocks[first + i] = entries[i];
+        } else {
+            ListIndirect(entries[i], levels - 1, first + i * span, blocks, count, used, stats);
+        }
+    }
+
+    free(entries);
+}
+
+/* Data blocks of inode in file order, 0 for holes, into *blocks grown to fit, return the count */
+static int ListBlocks(struct inode* inode, int** blocks, int* capacity, char* used,
+    ImageStats* stats) {
+    if (IS_INLINE(inode)) {
+        return 0;
+    }
+
+    int count = (inode->size + BLOCKSIZE - 1) / BLOCKSIZE;
+    if (count > *capacity) {
+        *capacity = count;
+        *blocks = (int*)realloc(*blocks, count * sizeof(int));
+    }
+    memset(*blocks, 0, count * sizeof(int));
+
+    int i;
+    for (i = 0; i < count && i < NUM_DIRECT; ++i) {
+        (*blocks)[i] = inode->direct[i];
+    }
+
+    if (count > NUM_DIRECT && inode->indirect > 0) {
+        ListIndirect(INDIRECT_BLOCK(inode->indirect), INDIRECT_LEVELS(inode->indirect), 0,
+            *blocks + NUM_DIRECT, count - NUM_DIRECT, used, stats);
+    }
+
+    return count;
+}
+
+static int CountDirEntries(int* blocks, int count, int size) {
+    char block[BLOCKSIZE];
+    int entries = 0;
+    int i;
+    for (i = 0; i < count; ++i) {
+        if (blocks[i] <= 0 || ReadBlockSector(blocks[i], block) == ERROR) {
+            continue;
+        }
+
+        struct dir_entry* entry = (struct dir_entry*)block;
+        int j;
+        for (j = 0; j < BLOCKSIZE / (int)sizeof(struct dir_entry); ++j) {
+            if (i * BLOCKSIZE + j * (int)sizeof(struct dir_entry) >= size) {
+                break;
+            }
+
+            if (entry[j].inum != 0) {
+                ++entries;
+            }
+        }
+    }
+
+    return entries;
+}
+
+int ScanImage(ImageStats* stats) {
+    memset(stats, 0, sizeof(ImageStats));
+
+    struct fs_header header;
+    if (ReadFileSystemHeader(&header) == ERROR) {
+        return ERROR;
+    }
+
+    char block[BLOCKSIZE];
+    stats->block_size = BLOCKSIZE;
+    stats->num_blocks = header.num_blocks;
+    stats->num_inodes = header.num_inodes;
+    stats->first_data_block = 1 + (header.num_inodes + IMAGE_INODES_PER_BLOCK) /
+        IMAGE_INODES_PER_BLOCK;
+
+    char* used = (char*)calloc(header.num_blocks, 1);
+
+    /* The journal and its free map are never free */
+    struct journal_header* journal = (struct journal_header*)header.padding;
+    if (journal->magic == JOURNAL_MAGIC && journal->map_start > stats->first_data_block &&
+        journal->map_start < header.num_blocks) {
+        stats->journal_blocks = header.num_blocks - journal->map_start;
+        memset(used + journal->map_start, 1, stats->journal_blocks);
+    }
+    int capacity = NUM_DIRECT + PTRS_PER_BLOCK;
+    int* blocks = (int*)malloc(capacity * sizeof(int));
+
+    int inum;
+    for (inum = 1; inum <= header.num_inodes; ++inum) {
+        if (inum % IMAGE_INODES_PER_BLOCK == 0 || inum == 1) {
+            if (ReadBlockSector(1 + inum / IMAGE_INODES_PER_BLOCK, block) == ERROR) {
+                free(blocks);
+                free(used);
+                return ERROR;
+            }
+        }
+
+        struct inode* inode = (struct inode*)block + inum % IMAGE_INODES_PER_BLOCK;
+        if (inode->type == INODE_FREE) {
+            continue;
+        }
+
+        int count = ListBlocks(inode, &blocks, &capacity, used, stats);
+        if (IS_INLINE(inode)) {
+            ++stats->inline_inodes;
+        }
+        if (inode->type == INODE_DIRECTORY) {
+            ++stats->dirs;
+            int entries = CountDirEntries(blocks, count, inode->size);
+            if (entries > stats->largest_dir) {
+                stats->largest_dir = entries;
+            }
+        } else if (inode->type == INODE_SYMLINK) {
+            ++stats->symlinks;
+        } else {
+            ++stats->files;
+            stats->file_bytes += inode->size;
+        }
+
+        int extents = 0;
+        int prev = 0;
+        int i;
+        for (i = 0; i < count; ++i) {
+            int bnum = blocks[i];
+            bool tail = IS_TAIL(bnum);
+            if (tail) {
+                bnum = TAIL_BLOCK(bnum);
+                ++stats->tails;
+            }
+
+            if (bnum <= 0 || bnum >= header.num_blocks) {
+                prev = 0;
+                continue;
+            }
+
+            /* Blocks shared by tails count once */
+            if (!tail || !used[bnum]) {
+                ++stats->data_blocks;
+                stats->tail_blocks += tail;
+            }
+            used[bnum] = 1;
+            if (prev != 0) {
+                ++stats->pairs;
+                if (bnum == prev + 1) {
+                    ++stats->contiguous_pairs;
+                }
+            }
+            if (prev == 0 || bnum != prev + 1) {
+                ++extents;
+            }
+            prev = bnum;
+        }
+
+        stats->extents += extents;
+        if (extents > 1) {
+            ++stats->fragmented;
+        }
+    }
+
+    int run = 0;
+    int bnum;
+    for (bnum = stats->first_data_block; bnum <= header.num_blocks; ++bnum) {
+        if (bnum < header.num_blocks && !used[bnum]) {
+            ++stats->free_blocks;
+            ++run;
+            continue;
+        }
+
+        if (run > 0) {
+            ++stats->free_extents;
+            if (run > stats->largest_free_extent) {
+                stats->largest_free_extent = run;
+            }
+        }
+        run = 0;
+    }
+
+    free(blocks);
+    free(used);
+    return 0;
+}
+
+void PrintImageStats(FILE* out, ImageStats* stats) {
+    int inodes = stats->files + stats->dirs + stats->symlinks;
+    fprintf(out, "blocks: %d of %d bytes, %d holding the header and inodes\n",
+        stats->num_blocks, stats->block_size, stats->first_data_block - 1);
+    fprintf(out, "inodes: %d of %d used (%d files, %d directories, %d symlinks)\n",
+        inodes, stats->num_inodes, stats->files, stats->dirs, stats->symlinks);
+    fprintf(out, "data: %lld file bytes in %d blocks, %d indirect blocks, largest directory %d entries\n",
+        stats->file_bytes, stats->data_blocks, stats->indirect_blocks, stats->largest_dir);
+    fprintf(out, "fragmentation: %d of %d files and directories fragmented, %.2f extents each, layout score %.3f\n",
+        stats->fragmented, inodes, inodes ? (double)stats->extents / inodes : 0.0,
+        stats->pairs ? (double)stats->contiguous_pairs / stats->pairs : 1.0);
+    if (stats->inline_inodes > 0) {
+        fprintf(out, "inline: %d files and symlinks kept in their inodes\n", stats->inline_inodes);
+    }
+    if (stats->tails > 0) {
+        fprintf(out, "tails: %d packed in %d shared blocks\n", stats->tails, stats->tail_blocks);
+    }
+    if (stats->journal_blocks > 0) {
+        fprintf(out, "journal: %d blocks with its free map\n", stats->journal_blocks);
+    }
+    fprintf(out, "free space: %d blocks in %d extents, largest %d, mean %.1f\n",
+        stats->free_blocks, stats->free_extents, stats->largest_free_extent,
+        stats->free_extents ? (double)stats->free_blocks / stats->free_extents : 0.0);
+}
@@ -0,0 +1,16 @@
+#ifndef __CACHESIM_H__
+#define __CACHESIM_H__
+
+/*
+ * Cache access trace written by yfsreplay -a and read by yfscachesim:
+ * one CacheAccess per inode or block cache lookup, in host byte order.
+ */
+#define ACCESS_INODE 0
+#define ACCESS_BLOCK 1
+
+typedef struct CacheAccess {
+    int cache;
+    int key;
+} CacheAccess;
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef __CONFIG_H__
+#define __CONFIG_H__
+
+#include <stdbool.h>
+
+/* Default share of a memory budget given to the inode cache, in percent */
+#define DEFAULT_INODE_SHARE 10
+
+/*
+ * Cache sizes chosen at startup.  Zero fields are derived from the disk
+ * in SizeCaches: either from memory_kb, split by inode_share, or from
+ * the number of blocks and inodes on the disk.
+ */
+typedef struct CacheConfig {
+    int inode_entries;
+    int block_entries;
+    int memory_kb;
+    int inode_share;
+} CacheConfig;
+
+void InitCacheConfig(CacheConfig* config);
+
+bool ParseCacheOption(CacheConfig* config, char* option, char* value);
+
+void SizeCaches(CacheConfig* config, int num_blocks, int num_inodes);
+
+#endif
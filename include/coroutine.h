@@ -0,0 +1,65 @@
+#ifndef __COROUTINE_H__
+#define __COROUTINE_H__
+
+#include <stdbool.h>
+#include <ucontext.h>
+#include "yfs.h"
+
+#define MAX_COROUTINES 32
+#define COROUTINE_STACKSIZE (32 * 1024)
+
+typedef struct Coroutine {
+    ucontext_t context;
+    char* stack;
+    Message* msg;
+    int pid;
+    /* Request type its sector I/O is charged to */
+    int op;
+    bool finished;
+    /* Block number this coroutine is suspended on, 0 if runnable */
+    int wait_bnum;
+    /* Result of the read this coroutine was woken by */
+    int wait_status;
+    /* Deferral epoch it started in, see DeferFree */
+    unsigned long long epoch;
+    struct Coroutine* next;
+} Coroutine;
+
+/*
+ * Free pointer, or release call, waiting for the coroutines that may
+ * still see it to finish
+ */
+typedef struct DeferredFree {
+    void* ptr;
+    /* Called as release(arg, count) instead of freeing ptr if set */
+    void (*release)(int arg, int count);
+    int arg;
+    int count;
+    /* Epoch of the newest coroutine when it was deferred */
+    unsigned long long epoch;
+    struct DeferredFree* next;
+} DeferredFree;
+
+void InitCoroutines(void);
+
+bool IsSuspendableRequest(int type);
+
+bool SpawnCoroutine(Message* msg, int pid);
+
+bool CanSuspend(void);
+
+int SuspendCoroutine(int bnum);
+
+void WakeCoroutines(int bnum, int status);
+
+void DisableSuspend(void);
+
+void EnableSuspend(void);
+
+void DeferFree(void* ptr);
+
+void DeferRelease(void (*release)(int, int), int arg, int count);
+
+void ReclaimDeferred(void);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef __DISKIO_H__
+#define __DISKIO_H__
+
+#include <stdbool.h>
+#include "yfs.h"
+
+#define NUM_DISK_HELPERS 4
+
+/* A child process that performs ReadSector on behalf of the server */
+typedef struct DiskHelper {
+    int pid;
+    bool idle;
+} DiskHelper;
+
+/* One outstanding sector read, shared by every coroutine that needs it */
+typedef struct PendingRead {
+    int bnum;
+    /* Request type that asked for it, for sector accounting */
+    int op;
+    bool issued;
+    /* Set if the sector changed after the read was issued */
+    bool stale;
+    struct PendingRead* next;
+} PendingRead;
+
+int InitDiskHelpers(void);
+
+bool RequestDiskRead(int bnum);
+
+void CompleteDiskRead(Message* msg, int pid);
+
+void InvalidateDiskRead(int bnum);
+
+#endif
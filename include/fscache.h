@@ -10,6 +10,8 @@ typedef struct CacheNode {
     struct CacheNode* prev;
     struct CacheNode* next;
     bool dirty;
+    /* Pinned nodes are never evicted */
+    int pins;
 } CacheNode;
 
 typedef struct Cache {
@@ -18,6 +20,15 @@ typedef struct Cache {
     int capacity;
     int len;
     HashTable* table;
+    /* Counters reported by the STATS message */
+    unsigned int hits;
+    unsigned int misses;
+    unsigned int evictions;
+    unsigned int dirty_evictions;
+    /* Called on every lookup when set, host tools use it to trace accesses */
+    void (*on_access)(struct Cache* cache, int key);
+    /* Called when SetDirty marks a cached entry, the journal uses it */
+    void (*on_dirty)(struct Cache* cache, int key);
 } Cache;
 
 Cache* InitCache(int capacity);
@@ -26,12 +37,20 @@ CacheNode* InitCacheNode(int key, void* val);
 
 CacheNode* PutItemInCache(Cache* cache, int key, void* value);
 
+CacheNode* TrimCache(Cache* cache);
+
 void* GetItemFromCache(Cache* cache, int key);
 
+void* PeekItemInCache(Cache* cache, int key);
+
 void SetHead(Cache* cache, CacheNode* node);
 
 void RemoveNode(Cache* cache, CacheNode* node);
 
 void SetDirty(Cache* cache, int key);
 
+void PinCacheItem(Cache* cache, int key);
+
+void UnpinCacheItem(Cache* cache, int key);
+
 #endif
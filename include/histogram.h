@@ -0,0 +1,27 @@
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+/*
+ * Log-linear histogram: each power of two is split into HIST_SUB_BUCKETS
+ * linear buckets, so any recorded value is known within 1/8 of itself
+ * and the memory used is fixed no matter how many values are recorded.
+ */
+#define HIST_SUB_BITS 3
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 40
+#define HIST_BUCKETS (HIST_SUB_BUCKETS + (HIST_MAX_BITS - HIST_SUB_BITS) * HIST_SUB_BUCKETS)
+
+typedef struct Histogram {
+    unsigned int counts[HIST_BUCKETS];
+    unsigned int total;
+    unsigned long long max;
+    unsigned long long sum;
+} Histogram;
+
+void RecordValue(Histogram* hist, unsigned long long value);
+
+unsigned long long GetPercentile(Histogram* hist, double percentile);
+
+void ResetHistogram(Histogram* hist);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef __HOSTSHIM_H__
+#define __HOSTSHIM_H__
+
+#include <stdbool.h>
+#include "config.h"
+#include "journal.h"
+
+/* Sector accesses since the disk was opened */
+typedef struct HostDiskStats {
+    int reads;
+    int writes;
+    /* Accesses that didn't continue where the previous one ended */
+    int seeks;
+} HostDiskStats;
+
+/*
+ * Host tools link the server code against hostshim.c, which stands in
+ * for the Yalnix kernel calls.  Clients live in the same address space,
+ * so CopyFrom and CopyTo are plain copies, and the disk is a Unix file.
+ */
+int OpenHostDisk(char* path);
+
+int BootHostServer(char* disk_path, CacheConfig* config, JournalConfig* journal_config);
+
+void CloseHostDisk(void);
+
+void GetHostDiskStats(HostDiskStats* stats, bool reset);
+
+#endif
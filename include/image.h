@@ -0,0 +1,68 @@
+#ifndef __IMAGE_H__
+#define __IMAGE_H__
+
+#include <stdio.h>
+
+/* Inodes per block, the same in the image and in the server */
+#define IMAGE_INODES_PER_BLOCK (BLOCKSIZE / INODESIZE)
+
+/* mkyfs's default inode count */
+#define DEFAULT_IMAGE_INODES (6 * IMAGE_INODES_PER_BLOCK - 1)
+
+/*
+ * Layout summary of a DISK image, read straight from the sectors of the
+ * disk opened with OpenHostDisk.  An extent is a run of consecutive
+ * blocks, counted over a file's data blocks in file order.
+ */
+typedef struct ImageStats {
+    int block_size;
+    int num_blocks;
+    int num_inodes;
+    /* First block after the inode blocks */
+    int first_data_block;
+
+    int files;
+    int dirs;
+    int symlinks;
+    long long file_bytes;
+
+    /* Data blocks of files and directories, and indirect blocks */
+    int data_blocks;
+    int indirect_blocks;
+    /* Files and symlinks with their data in the inode */
+    int inline_inodes;
+    /* Tails in fragments, and the blocks holding them (counted in data_blocks) */
+    int tails;
+    int tail_blocks;
+
+    /* Files and directories with more than one extent */
+    int fragmented;
+    int extents;
+    /* Block pairs adjacent in a file that are also adjacent on disk */
+    int contiguous_pairs;
+    int pairs;
+
+    /* Journal and free map blocks at the end of the disk, 0 without a journal */
+    int journal_blocks;
+
+    int free_blocks;
+    int free_extents;
+    int largest_free_extent;
+
+    /* Live entries in the largest directory */
+    int largest_dir;
+} ImageStats;
+
+/*
+ * Write an empty file system with num_inodes inodes and blocks of
+ * 2^shift sectors to path, laid out exactly as mkyfs does.
+ */
+int FormatImage(char* path, int num_inodes, int shift);
+
+int BlockShiftFor(int block_size);
+
+int ScanImage(ImageStats* stats);
+
+void PrintImageStats(FILE* out, ImageStats* stats);
+
+#endif
@@ -28,6 +28,98 @@ struct Stat {
     int nlink;		/* link count of file */
 };
 
+/*
+ *  The structure returned by GetStats.  Per-operation arrays are
+ *  indexed by the server's message type.  Check version before use;
+ *  it changes whenever the layout does.
+ */
+#define	YFS_STATS_VERSION	2
+#define	YFS_STATS_OPS		32	/* per-operation counter slots */
+
+struct CacheStats {
+    unsigned int hits;		/* lookups found in the cache */
+    unsigned int misses;	/* lookups not found in the cache */
+    unsigned int evictions;	/* entries pushed out to make room */
+    unsigned int dirty_evictions;	/* evicted entries that were dirty */
+};
+
+struct YfsStats {
+    int version;		/* YFS_STATS_VERSION */
+    int size;			/* sizeof(struct YfsStats) on the server */
+    struct CacheStats block_cache;
+    struct CacheStats inode_cache;
+    unsigned int requests[YFS_STATS_OPS];	/* messages handled */
+    unsigned int sectors_read[YFS_STATS_OPS];	/* ReadSector calls */
+    unsigned int sectors_written[YFS_STATS_OPS];	/* WriteSector calls */
+    unsigned int map_hits;	/* block lookups answered by an open file's map */
+    unsigned int map_misses;	/* lookups that had to read indirect blocks */
+};
+
+/*
+ *  One segment of a ReadV/WriteV call:
+ */
+#define	MAX_IOVEC	64	/* max segments per ReadV/WriteV call */
+
+struct IoVec {
+    void *base;		/* start of the segment */
+    int len;		/* length of the segment in bytes */
+};
+
+/*
+ *  The structure used to return each entry on a ReadDirPlus call.
+ *  The name is null-terminated.
+ */
+#define	DIRPLUS_NAMELEN	32
+
+struct DirEntryPlus {
+    int inum;			/* inode number of entry */
+    int type;			/* type of file (e.g., INODE_REGULAR) */
+    int size;			/* size of file in bytes */
+    int nlink;			/* link count of file */
+    char name[DIRPLUS_NAMELEN];	/* entry name */
+};
+
+/*
+ *  A compound request carries many operations in one message.  The
+ *  operations and everything they read or write (pathnames, data) live
+ *  in a single client buffer: the BatchOp array grows from the front
+ *  and the payload grows from the back.  Operation types use the same
+ *  values as the server's message types.
+ */
+#define	BATCH_OPEN	1
+#define	BATCH_CREATE	2
+#define	BATCH_READ	3
+#define	BATCH_WRITE	4
+#define	BATCH_LINK	6
+#define	BATCH_UNLINK	7
+#define	BATCH_SYMLINK	8
+#define	BATCH_MKDIR	10
+#define	BATCH_RMDIR	11
+#define	BATCH_STAT	13
+#define	BATCH_RENAME	31
+
+#define	BATCH_CHAIN	0x1	/* use the inode returned by the previous op */
+
+struct BatchOp {
+    int type;		/* one of the BATCH_* operation types */
+    int flags;		/* BATCH_CHAIN */
+    int inum;		/* file for READ/WRITE unless chained */
+    int size;		/* bytes to read or write */
+    int offset;		/* file position for READ/WRITE */
+    int name;		/* buffer offset of the pathname */
+    int name2;		/* buffer offset of the second pathname */
+    int data;		/* buffer offset of the read/write data */
+    int result;		/* filled in: ERROR, or the call's return value */
+    struct Stat stat;	/* filled in by BATCH_STAT */
+};
+
+struct Batch {
+    char *buf;		/* client buffer holding ops and payload */
+    int size;		/* size of buf in bytes */
+    int count;		/* number of ops added */
+    int payload;	/* offset where the payload currently begins */
+};
+
 /*
  *  Function prototypes for YFS calls:
  */
@@ -47,6 +139,23 @@ extern int ChDir(char *);
 extern int Stat(char *, struct Stat *);
 extern int Sync(void);
 extern int Shutdown(void);
+extern int ReadDirPlus(int, void *, int, int *);
+extern int PRead(int, void *, int, int);
+extern int PWrite(int, void *, int, int);
+extern int ReadV(int, struct IoVec *, int);
+extern int WriteV(int, struct IoVec *, int);
+extern int GetStats(struct YfsStats *, int);
+extern int PrintLatency(int);
+extern int Truncate(char *, int);
+extern int FTruncate(int, int);
+extern int Rename(char *, char *);
+
+extern void BatchInit(struct Batch *, void *, int);
+extern int BatchAdd(struct Batch *, int, int, char *, char *);
+extern int BatchAddIO(struct Batch *, int, int, int, void *, int, int);
+extern int SubmitBatch(struct Batch *);
+extern struct BatchOp *BatchOpResult(struct Batch *, int);
+extern void *BatchOpData(struct Batch *, int);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,109 @@
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <stdbool.h>
+#include "yfs.h"
+
+/*
+ * On-disk journal.  Its location lives in the unused padding of the
+ * fs_header, so images without one (magic 0) still mount the old way.
+ * The journal and a bitmap of used blocks and inodes sit at the end of
+ * the disk:
+ *
+ *	... data blocks ... | free map (map_blocks) | journal (blocks)
+ *
+ * The map has one bit per block, 0 to num_blocks - 1, then one bit per
+ * inode, 0 to num_inodes, then FRAGS_PER_BLOCK bits per block for the
+ * fragments of blocks holding tails (see yfs.h), so mounting reads it
+ * instead of scanning every inode.  Set bits are in use.
+ *
+ * Each committed group of transactions is a run of journal blocks: a
+ * descriptor listing up to JOURNAL_DESC_ENTRIES block numbers followed
+ * by those blocks' new contents, repeated as needed, then a commit
+ * record.  All records of a group carry its sequence number.  Replay
+ * starts at the first journal block with the header's seq and stops
+ * at the first group without a commit record.
+ */
+#define JOURNAL_MAGIC 0x594a4e4c
+#define JOURNAL_DESC_MAGIC 0x594a4453
+#define JOURNAL_COMMIT_MAGIC 0x594a434d
+
+/* Fewest journal blocks accepted by -J */
+#define JOURNAL_MIN_BLOCKS 16
+
+/* Default transactions per group, 1 commits every request on its own */
+#define DEFAULT_GROUP_SIZE 1
+
+/* Clock ticks a partial group waits for more transactions */
+#define JOURNAL_TICKS 1
+
+/* Overlays fs_header.padding */
+struct journal_header {
+    int magic;
+    int start;		/* first journal block */
+    int blocks;		/* journal blocks */
+    int map_start;	/* first free map block */
+    int map_blocks;	/* free map blocks */
+    int seq;		/* sequence number of the group at journal block 0 */
+};
+
+#define JOURNAL_DESC_ENTRIES (BLOCKSIZE / (int)sizeof(int) - 3)
+
+/* A descriptor, or a commit record with count the group's block total, one block long */
+struct journal_record {
+    int magic;
+    int seq;
+    int count;
+    int bnums[];
+};
+
+/* Journal options given at startup */
+typedef struct JournalConfig {
+    /* Journal blocks to reserve if the disk has no journal, 0 for none */
+    int blocks;
+    int group_size;
+} JournalConfig;
+
+void InitJournalConfig(JournalConfig* config);
+
+bool ParseJournalOption(JournalConfig* config, char* option, char* value);
+
+int MountJournal(JournalConfig* config);
+
+int CreateJournal(JournalConfig* config);
+
+void InitJournalHelper(void);
+
+void CompleteJournalTick(Message* msg, int pid);
+
+void BeginTransaction(void);
+
+void EndTransaction(void);
+
+void SplitTransaction(void);
+
+void JournalBlock(int bnum);
+
+void JournalInode(Cache* cache, int inum);
+
+void NoteBlockUsed(int bnum, bool used);
+
+void NoteInodeUsed(int inum, bool used);
+
+void NoteFragmentsUsed(int bnum, int frag, int count, bool used);
+
+bool DeferBlockFree(int bnum);
+
+bool DeferBlockFrees(int* bnums, int count);
+
+bool DeferFragmentFree(int ptr, int count);
+
+void NoteOrphans(bool pending);
+
+bool DeferReply(Message* msg, int pid);
+
+void CommitJournal(void);
+
+void SyncFileSystem(void);
+
+#endif
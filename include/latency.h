@@ -0,0 +1,36 @@
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include "yfs.h"
+#include "histogram.h"
+
+/* Timing of the request being served, in time stamp counter cycles */
+typedef struct RequestTiming {
+    int type;
+    unsigned long long start;
+    /* Cycles spent in sector I/O or suspended waiting for it */
+    unsigned long long disk;
+    /* Start to finish, set by EndRequestTiming */
+    unsigned long long service;
+    /* File the request resolved to and bytes it moved, for the trace */
+    int inum;
+    int size;
+} RequestTiming;
+
+void BeginRequestTiming(RequestTiming* timing, Message* msg);
+
+void EndRequestTiming(RequestTiming* timing);
+
+RequestTiming* SetRequestTiming(RequestTiming* timing);
+
+void AddDiskWait(unsigned long long cycles);
+
+void NoteRequestFile(int inum, int size);
+
+const char* OpName(int type);
+
+void DumpLatency(void);
+
+void ResetLatency(void);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include <stdio.h>
+
+/*
+ * Console logging, chosen at compile time with -DYFS_LOG_LEVEL=n (see
+ * LOG_LEVEL in the Makefile).  A message above the level compiles to
+ * nothing, its arguments are never evaluated.
+ */
+#define LOG_LEVEL_NONE 0
+/* The server itself failed: disk errors, bad helper messages */
+#define LOG_LEVEL_ERROR 1
+/* Requests rejected because of what the client asked for */
+#define LOG_LEVEL_INFO 2
+/* One line per request */
+#define LOG_LEVEL_DEBUG 3
+
+#ifndef YFS_LOG_LEVEL
+#define YFS_LOG_LEVEL LOG_LEVEL_ERROR
+#endif
+
+#if YFS_LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) printf(__VA_ARGS__)
+#else
+#define LOG_ERROR(...) do {} while (0)
+#endif
+
+#if YFS_LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) printf(__VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+
+#if YFS_LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) printf(__VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
+
+#endif
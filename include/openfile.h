@@ -0,0 +1,77 @@
+#ifndef __OPENFILE_H__
+#define __OPENFILE_H__
+
+#include "yfs.h"
+
+/* Server state shared by every handle open on one inode */
+typedef struct OpenFile {
+    int inum;
+    /* Pinned in inode_cache while the file is open */
+    struct inode* inode;
+    int refcount;
+    /* Block number of each block of the file, built on first use */
+    int* bmap;
+    int map_len;
+    int map_cap;
+    /*
+     * A file with more than one indirect level only has its direct
+     * blocks in the map.  Past them, lookups start from copies of the
+     * upper level indirect blocks on the path last walked, by level
+     * from the root, and the bottom level block it led to, with the
+     * first block that lists.  Sequential access then goes back to the
+     * cache only for that block, and never re-reads the levels above.
+     */
+    int path_bnums[MAX_INDIRECT_LEVELS - 1];
+    int* path_blocks[MAX_INDIRECT_LEVELS - 1];
+    int leaf_bnum;
+    int leaf_first;
+} OpenFile;
+
+/*
+ * A handle number given to clients is its slot in the handle table plus
+ * the slot's generation, bumped whenever the slot is freed, so a stale
+ * number is rejected instead of naming whatever file reuses the slot.
+ */
+#define HANDLE_SLOT_BITS 16
+#define MAX_HANDLES (1 << HANDLE_SLOT_BITS)
+#define HANDLE_SLOT(handle) ((handle) & (MAX_HANDLES - 1))
+#define HANDLE_NUMBER(slot, generation) \
+    ((slot) | (((generation) & 0x7fff) << HANDLE_SLOT_BITS))
+
+/* One Open or Create by a client, with its own file position */
+typedef struct FileHandle {
+    OpenFile* file;
+    int pos;
+    /* Handle number the client was given */
+    int number;
+    /*
+     * Processes holding the handle: the one that opened it, and forked
+     * children that used it since.  It is released when all have closed.
+     */
+    int* pids;
+    int num_pids;
+} FileHandle;
+
+void InitOpenFiles(void);
+
+int OpenFileHandle(int inum, int pid);
+
+int CloseFileHandle(int handle, int pid);
+
+FileHandle* GetFileHandle(int handle, int pid);
+
+bool IsFileOpen(int inum);
+
+int GetBnumFromMap(OpenFile* file, int block_index);
+
+void UpdateBlockMap(int inum, int block_index, int bnum);
+
+void InvalidateBlockMap(int inum);
+
+int ReadOpenFile(OpenFile* file, char* buf, int size, int pos);
+
+int WriteOpenFile(OpenFile* file, char* buf, int size, int pos);
+
+int TruncateOpenFile(OpenFile* file, int length);
+
+#endif
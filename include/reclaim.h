@@ -0,0 +1,45 @@
+#ifndef __RECLAIM_H__
+#define __RECLAIM_H__
+
+#include <stdbool.h>
+#include "yfs.h"
+
+/*
+ * Background reclamation.  A file or directory losing its last name
+ * while it has indirect blocks keeps them, with nlink 0, and is queued;
+ * its blocks are freed a slice at a time, one bottom level indirect
+ * block's worth per transaction, and the inode last.  A small one is
+ * freed on the spot as before.  One still open keeps everything, with
+ * nlink 0, until its last handle closes, and is queued then.
+ *
+ * Slices run when the helper's message comes up in the server's queue,
+ * so waiting clients go first and an idle server keeps reclaiming.
+ * Without the helper one slice runs after every request.  Shutdown
+ * finishes the queue.
+ *
+ * Until then the blocks count as used.  An inode with nlink 0 that
+ * isn't free is still queued after a crash: mounting without a journal
+ * finds it in its inode scan; with one, the header's last spare word
+ * says whether the inodes must be scanned for it.
+ */
+#define ORPHANS_PENDING(hdr) ((hdr)->padding[12])
+
+void InitReclaimHelper(void);
+
+void CompleteReclaimTick(Message* msg, int pid);
+
+void ReleaseInode(int inum);
+
+void ReleaseClosedInode(int inum);
+
+void QueueOrphan(int inum);
+
+int FindOrphans(void);
+
+void ReclaimBetweenRequests(void);
+
+void FinishReclaim(void);
+
+int PendingReclaims(void);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef __RECORD_H__
+#define __RECORD_H__
+
+#include "yfs.h"
+#include "latency.h"
+
+/*
+ * Request recorder, built in with -DYFS_RECORD (RECORD=1 in the
+ * Makefile).  Every dispatched message is appended to a memory buffer as
+ * a RecordHeader followed by its pathnames, and the buffer is written to
+ * the simulator's TRACE file with TracePrintf, one hex encoded record per
+ * line starting with RECORD_TAG.  yfsreplay reads those lines back.
+ */
+#define RECORD_TAG "yfsrec"
+
+/* Buffered bytes that trigger a flush to the TRACE file */
+#define RECORD_FLUSH_SIZE (16 * 1024)
+
+#define RECORD_TRACE_LEVEL 0
+
+typedef struct RecordHeader {
+    /* Time stamp counter when the server received the message */
+    unsigned int time_lo;
+    unsigned int time_hi;
+    /* Service time in cycles, saturated at 2^32 - 1 */
+    unsigned int service;
+    short type;
+    /* Bytes of pathname following the header for addr1 and addr2 */
+    short path_len;
+    short path2_len;
+    short reserved;
+    int pid;
+    int data1;
+    int data2;
+    int data3;
+    /* Reply fields, used to map handles and to check the replay */
+    int reply_type;
+    int reply_data1;
+    int reply_data2;
+    /* Inode and bytes moved, from NoteRequestFile */
+    int inum;
+    int size;
+} RecordHeader;
+
+/* Request types whose addr1 (and, for LINK and SYMLINK, addr2) is a pathname */
+int RecordPathCount(int type);
+
+#ifdef YFS_RECORD
+
+void CopyRecordPaths(Message* msg, int pid, char* path, char* path2);
+
+void RecordRequest(Message* request, Message* reply, int pid, RequestTiming* timing,
+    char* path, char* path2);
+
+void FlushRecords(void);
+
+#define FLUSH_RECORDS() FlushRecords()
+
+#else
+
+#define FLUSH_RECORDS() do {} while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdbool.h>
+#include "yfs.h"
+
+int SetStatsOp(int type);
+
+int GetStatsOp(void);
+
+void CountRequest(int type);
+
+void CountSectorRead(void);
+
+void CountSectorWrite(void);
+
+void CountMapLookup(bool hit);
+
+void FillStats(struct YfsStats* stats);
+
+void ResetStats(void);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+/*
+ * Binary ring buffer of the last TRACE_RING_SIZE requests, built in with
+ * -DYFS_TRACE (TRACE=1 in the Makefile).  Recording a request is a few
+ * stores, no formatting; the ring is only printed by DUMP_TRACE.
+ */
+#define TRACE_RING_SIZE 4096
+
+typedef struct TraceRecord {
+    /* Low 32 bits of the time stamp counter when the request finished */
+    unsigned int time;
+    short type;
+    short status;
+    int inum;
+    int size;
+    /* Service time in cycles, saturated at 2^32 - 1 */
+    unsigned int latency;
+} TraceRecord;
+
+#ifdef YFS_TRACE
+
+void TraceRequest(int type, int status, int inum, int size, unsigned long long latency);
+
+void DumpTrace(void);
+
+#define TRACE_REQUEST(type, status, inum, size, latency) \
+    TraceRequest(type, status, inum, size, latency)
+#define DUMP_TRACE() DumpTrace()
+
+#else
+
+#define TRACE_REQUEST(type, status, inum, size, latency) do {} while (0)
+#define DUMP_TRACE() do {} while (0)
+
+#endif
+
+#endif
@@ -3,6 +3,8 @@
 
 #include <comp421/filesystem.h>
 #include "fscache.h"
+#include "iolib.h"
+#include "config.h"
 
 #define OPEN 1
 #define CREATE 2
@@ -20,8 +22,97 @@
 #define SYNC 14
 #define SHUTDOWN 15
 
-#define INODE_PER_BLOCK BLOCKSIZE / INODESIZE;
-#define DIR_ENTRY_PER_BLOCK BLOCKSIZE / sizeof(struct dir_entry)
+/* Internal messages between the server and its disk helpers */
+#define DISK_READ 16
+#define DISK_DONE 17
+
+#define BATCH 18
+#define READDIRPLUS 19
+#define CLOSE 20
+#define PREAD 21
+#define PWRITE 22
+#define READV 23
+#define WRITEV 24
+#define STATS 25
+#define LATENCY 26
+
+/* Internal message between the server and its journal commit helper */
+#define JOURNAL_TICK 27
+
+#define TRUNCATE 28
+#define FTRUNCATE 29
+
+/* Internal message between the server and its reclaim helper */
+#define RECLAIM_TICK 30
+
+#define RENAME 31
+
+/* Most entries a single READDIRPLUS message returns */
+#define MAX_READDIR_ENTRIES 256
+
+/* Largest client buffer a single BATCH message may carry */
+#define MAX_BATCH_SIZE (64 * 1024)
+
+/*
+ * A block is 2^block_shift sectors, chosen when the disk is formatted
+ * and kept in the header's last padding word (0, one sector blocks, on
+ * older images).  Sector 1 always holds the header as formatted, so the
+ * block size can be read first; with larger blocks that sector is part
+ * of the unused boot block and the live header starts block 1 as usual.
+ * From here on BLOCKSIZE is the block size of the disk in use.
+ */
+#define MAX_BLOCK_SHIFT 5
+#define MAX_BLOCKSIZE (SECTORSIZE << MAX_BLOCK_SHIFT)
+#define BLOCK_SHIFT(hdr) ((hdr)->padding[13])
+#define SECTORS_PER_BLOCK (1 << block_shift)
+#undef BLOCKSIZE
+#define BLOCKSIZE (SECTORSIZE << block_shift)
+
+extern int block_shift;
+
+#define INODE_PER_BLOCK (BLOCKSIZE / INODESIZE)
+#define DIR_ENTRY_PER_BLOCK (BLOCKSIZE / sizeof(struct dir_entry))
+
+/*
+ * A regular file or symbolic link of at most INLINE_SIZE bytes may keep
+ * its data in the inode's direct array instead of a block, marked by
+ * indirect == INLINE_DATA.  It moves to blocks once it grows past that.
+ */
+#define INLINE_DATA (-1)
+#define INLINE_SIZE ((int)(NUM_DIRECT * sizeof(int)))
+#define IS_INLINE(inode) ((inode)->indirect == INLINE_DATA)
+
+/*
+ * The last partial block of a file, its tail, may instead sit in a run
+ * of fragments, FRAGSIZE bytes or an eighth of a block each, of a block
+ * shared with other tails.  Its block pointer is then
+ * TAIL_POINTER(bnum, frag), always negative, for the TAIL_FRAGS(size)
+ * fragments of block bnum starting at frag.
+ */
+#define FRAGS_PER_BLOCK 8
+#define FRAGSIZE (BLOCKSIZE / FRAGS_PER_BLOCK)
+#define FULL_FRAG_MASK ((1u << FRAGS_PER_BLOCK) - 1)
+#define TAIL_POINTER(bnum, frag) (-((bnum) * FRAGS_PER_BLOCK + (frag)))
+#define IS_TAIL(ptr) ((ptr) < 0)
+#define TAIL_BLOCK(ptr) (-(ptr) / FRAGS_PER_BLOCK)
+#define TAIL_FRAG(ptr) (-(ptr) % FRAGS_PER_BLOCK)
+#define TAIL_LENGTH(size) ((size) - ((size) - 1) / BLOCKSIZE * BLOCKSIZE)
+#define TAIL_FRAGS(size) ((TAIL_LENGTH(size) + FRAGSIZE - 1) / FRAGSIZE)
+#define FRAG_MASK(frag, count) (((1u << (count)) - 1) << (frag))
+
+/*
+ * Blocks past the direct ones hang off a tree of indirect blocks,
+ * PTRS_PER_BLOCK block numbers each, rooted at indirect.  A file starts
+ * with a single indirect block; when it outgrows the tree a new root
+ * takes the old one as its first entry, up to MAX_INDIRECT_LEVELS
+ * levels.  The level count sits above the block number in indirect,
+ * so images from before, all single indirect, read the same.
+ */
+#define PTRS_PER_BLOCK (BLOCKSIZE / (int)sizeof(int))
+#define MAX_INDIRECT_LEVELS 3
+#define INDIRECT_BLOCK(indirect) ((indirect) & 0xffffff)
+#define INDIRECT_LEVELS(indirect) (((indirect) >> 24) + 1)
+#define INDIRECT_POINTER(bnum, levels) ((bnum) | ((levels) - 1) << 24)
 
 typedef struct message {
 	int type;
@@ -30,22 +121,37 @@ typedef struct message {
     int data3;
 	void* addr1;
 	void* addr2;
+	/* Low 32 bits of the client's time stamp counter when it sent this */
+	unsigned int send_time;
+	int reserved;
 } Message;
 
-struct fs_header header;
+/* Server copy of the client buffer while a BATCH message executes */
+typedef struct BatchContext {
+	char* client_buf;
+	char* buf;
+	int len;
+} BatchContext;
 
-Cache* inode_cache;
+extern struct fs_header header;
 
-Cache* block_cache;
+extern BatchContext* current_batch;
+
+extern Cache* inode_cache;
+
+extern Cache* block_cache;
 
 /* True if unused, otherwise false */
-bool* free_inodes;
+extern bool* free_inodes;
 
-int num_free_inodes;
+extern int num_free_inodes;
 
-bool* free_blocks;
+extern bool* free_blocks;
 
-int num_free_blocks;
+extern int num_free_blocks;
+
+/* Fragments in use in each block holding tails, 0 for other blocks */
+extern unsigned int* frag_maps;
 
 void YfsOpen(Message* msg, int pid);
 void YfsCreate(Message* msg, int pid);
@@ -62,36 +168,81 @@ void YfsChDir(Message* msg, int pid);
 void YfsStat(Message* msg, int pid);
 void YfsSync(Message* msg, int pid);
 void YfsShutDown(Message* msg, int pid);
-
-int InitFileSystem();
+void YfsBatch(Message* msg, int pid);
+void YfsReadDirPlus(Message* msg, int pid);
+void YfsClose(Message* msg, int pid);
+void YfsPRead(Message* msg, int pid);
+void YfsPWrite(Message* msg, int pid);
+void YfsReadV(Message* msg, int pid);
+void YfsWriteV(Message* msg, int pid);
+void YfsStats(Message* msg, int pid);
+void YfsTruncate(Message* msg, int pid);
+void YfsFTruncate(Message* msg, int pid);
+void YfsRename(Message* msg, int pid);
+
+void YfsLatency(Message* msg, int pid);
+void ErrorHandler(Message* msg, int pid);
+
+int YfsCopyFrom(int pid, void* dest, void* src, int len);
+int YfsCopyTo(int pid, void* dest, void* src, int len);
+void YfsReply(Message* msg, int pid);
+
+void DispatchMessage(Message* msg, int pid);
+
+/* See journal.h */
+struct JournalConfig;
+
+int ReadFileSystemHeader(struct fs_header* hdr);
+int InitFileSystem(CacheConfig* config, struct JournalConfig* journal_config);
 int ParsePathName(int inum, char* pathname);
-int ParseComponent(char* pathname, char* component_name, int index);
-int ParseSymbolicLink(struct inode* inode, int traverse_count);
+int ResolvePathName(int inum, char* pathname, int* symlinks);
+int ParseComponent(char* pathname, char** component_name, int index);
+int ParseSymbolicLink(int dir_inum, struct inode* inode, int* symlinks);
 int GetInumByComponentName(struct inode* inode, char* component_name);
 
 struct inode* GetInodeByInum(int inum);
 void* GetBlockByBnum(int bnum);
 void* GetBlockByInum(int inum);
+void CacheBlock(int bnum, void* block);
+void* GetNewBlock(int bnum);
+int ReadBlockSector(int bnum, void* buf);
+int WriteBlockSector(int bnum, void* buf);
+void DiscardCacheNode(CacheNode* node);
+void TrimCaches(void);
 void WriteBackInode(CacheNode* inode);
 void WriteBackBlock(CacheNode* block);
 int GetBlockNumFromInodeNum(int inum);
 int GetBnumFromIndirectBlock(int indirect_bnum, int index);
+int IndirectSpan(int levels);
+int GetBnumFromIndirect(int indirect, int index);
 int GetBnumBySeekPosition(struct inode* inode, int seek_pos);
 int AllocateBlockInInode(struct inode* inode, int inum);
+int SpillInlineData(struct inode* inode, int inum);
+int SetBlockPointer(struct inode* inode, int inum, int index, int ptr);
+char* GetTailData(int ptr);
+char* GetLinkTarget(struct inode* inode);
 
 int CountDirEntry(struct inode* dir_inode, int dir_inum);
 int DeleteDirEntry(struct inode* dir_inode, int dir_inum, int inum);
+int SetDirEntry(struct inode* dir_inode, int dir_inum, char* name, int inum);
 int CreateDirEntry(struct inode* dir_inode, int dir_inum, int inum, char* name);
 int GetFileNameIndex(char* pathname);
 int ParsePathDir(int inum, char* pathname);
 
 int FindFreeBlock(void);
 void RecycleFreeBlock(int bnum);
+void RecycleFreeBlocks(int* bnums, int count);
+void ReleaseBlock(int bnum);
+int AllocateFragments(int count);
+int GrowFragments(int ptr, int count, int new_count);
+void RecycleFragments(int ptr, int count);
+void ReleaseFragments(int ptr, int count);
 int FindFreeInode(void);
 void RecycleFreeInode(int inum);
 void SyncInodeCache();
 void SyncBlockCache();
 
+int TruncateBlocks(struct inode* inode, int inum, int keep);
 int RecycleBlocksInInode(int inum);
 
 #endif
\ No newline at end of file
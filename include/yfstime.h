@@ -0,0 +1,14 @@
+#ifndef __YFSTIME_H__
+#define __YFSTIME_H__
+
+/*
+ * Yalnix has no clock call, so time is measured in CPU cycles with the
+ * x86 time stamp counter, which user mode may read.
+ */
+static inline unsigned long long ReadTimeStamp(void) {
+    unsigned int lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+#endif
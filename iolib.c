@@ -1,20 +1,47 @@
 #include <stdlib.h>
 #include <string.h>
-#include <comp421/iolib.h>
+#include "include/iolib.h"
 #include <comp421/filesystem.h>
 #include <comp421/yalnix.h>
 #include "include/yfs.h"
+#include "include/yfstime.h"
 
 int curr_inum = 1;
 
 typedef struct file_info {
 	bool valid;
-	int curr_seek_pos;
 	int inum;
+	/* Server-side handle, which also holds the file position */
+	int handle;
 } FileInfo;
 
 FileInfo opened_files[MAX_OPEN_FILES];
 
+static bool exit_close_registered = false;
+
+/* Close what is still open at exit, or the server keeps the handles */
+static void CloseAllFiles(void) {
+    int fd;
+    for (fd = 0; fd < MAX_OPEN_FILES; ++fd) {
+        if (opened_files[fd].valid) {
+            Close(fd);
+        }
+    }
+}
+
+static void RegisterExitClose(void) {
+    if (!exit_close_registered) {
+        atexit(CloseAllFiles);
+        exit_close_registered = true;
+    }
+}
+
+/* Stamp the message so the server can tell how long it sat queued */
+static int SendMessage(Message* msg) {
+    msg->send_time = (unsigned int)ReadTimeStamp();
+    return Send((void*)msg, -FILE_SERVER);
+}
+
 int Open(char* pathname){
 	if (strlen(pathname) > MAXPATHNAMELEN) {
 		return ERROR;
@@ -38,14 +65,15 @@ int Open(char* pathname){
     msg->data1 = curr_inum;
 	msg->addr1 = (void*)pathname;
 
-	if (Send((void*)msg, -FILE_SERVER) == ERROR) {
+	if (SendMessage(msg) == ERROR || msg->type == ERROR) {
         free(msg);
 		return ERROR;
     }
 
     opened_files[fd].valid = true;
-    opened_files[fd].curr_seek_pos = 0;
     opened_files[fd].inum = msg->data1;
+    opened_files[fd].handle = msg->data2;
+    RegisterExitClose();
     
     free(msg);    
     return fd;
@@ -60,6 +88,13 @@ int Close(int fd){
         return ERROR;
     }
 
+    Message* msg = (Message*)calloc(1, sizeof(Message));
+    msg->type = CLOSE;
+    msg->data1 = opened_files[fd].handle;
+
+    SendMessage(msg);
+    free(msg);
+
     opened_files[fd].valid = false;
 	return 0;
 }
@@ -68,32 +103,35 @@ int Create(char* pathname){
 	if (strlen(pathname) > MAXPATHNAMELEN) {
 		return ERROR;
     }
+
+    /* Check available slot before the server opens a handle */
+    int i;
+    for (i = 0; i < MAX_OPEN_FILES; ++i) {
+        if (!opened_files[i].valid) {
+            break;
+        }
+    }
+
+    if (i == MAX_OPEN_FILES) {
+        return ERROR;
+    }
 	
-	Message* msg = malloc(sizeof(Message));
+	Message* msg = calloc(1, sizeof(Message));
 	msg->type = CREATE;
 	msg->data1 = curr_inum;
 	msg->addr1 = (void*)pathname;
 
-	if (Send(msg, -FILE_SERVER) == ERROR) {
+	if (SendMessage(msg) == ERROR || msg->type == ERROR) {
         free(msg);
 		return ERROR;
     }
 
-    int i;
-    for(i = 0; i < MAX_OPEN_FILES; ++i){
-    	if(opened_files[i].valid == false){
-    		opened_files[i].valid = true;
-    		opened_files[i].curr_seek_pos = 0;
-    		opened_files[i].inum = msg->data1;
-    		break;
-    	}
-    }
+    opened_files[i].valid = true;
+    opened_files[i].inum = msg->data1;
+    opened_files[i].handle = msg->data2;
+    RegisterExitClose();
     
     free(msg);
-    if(i == MAXPATHNAMELEN){
-    	return ERROR;
-    }
-
 	return i;
 }
 
@@ -108,23 +146,17 @@ int Read(int fd, void* buf, int size){
 
     Message* msg = (Message*)calloc(1, sizeof(Message));
     msg->type = READ;
-    msg->data1 = opened_files[fd].inum;
+    msg->data1 = opened_files[fd].handle;
     msg->data2 = size;
-    msg->data3 = opened_files[fd].curr_seek_pos;
     msg->addr1 = buf;
 
-    if (Send(msg, -FILE_SERVER) == ERROR) {
+    if (SendMessage(msg) == ERROR) {
         free(msg);
         return ERROR;
     }
 
     int ret = msg->type;
     free(msg);
-    if (ret == ERROR) {
-        return ERROR;
-    }
-
-    opened_files[fd].curr_seek_pos += ret;
     return ret;
 }
 
@@ -139,12 +171,11 @@ int Write(int fd, void* buf, int size){
 
 	Message* msg = (Message*)calloc(1, sizeof(Message));
     msg->type = WRITE;
-    msg->data1 = opened_files[fd].inum;
+    msg->data1 = opened_files[fd].handle;
     msg->data2 = size;
-    msg->data3 = opened_files[fd].curr_seek_pos;
     msg->addr1 = buf;
 
-    if (Send(msg, -FILE_SERVER) == ERROR) {
+    if (SendMessage(msg) == ERROR) {
         free(msg);
         return ERROR;
     }
@@ -169,23 +200,17 @@ int Seek(int fd, int offset, int whence){
 
     Message* msg = (Message*)calloc(1, sizeof(Message));
     msg->type = SEEK;
-    msg->data1 = opened_files[fd].inum;
+    msg->data1 = opened_files[fd].handle;
     msg->data2 = offset;
     msg->data3 = whence;
-    msg->addr1 = &(opened_files[fd].curr_seek_pos);
 
-    if (Send(msg, -FILE_SERVER) == ERROR) {
+    if (SendMessage(msg) == ERROR) {
         free(msg);
         return ERROR;
     }
 
     int seek_pos = msg->type;
     free(msg);
-    if (seek_pos == ERROR) {
-        return ERROR;
-    }
-    
-    opened_files[fd].curr_seek_pos = seek_pos;
     return seek_pos;
 }
 
@@ -204,7 +229,7 @@ int Link(char* oldname, char* newname){
     msg->addr1 = oldname;
     msg->addr2 = newname;
 
-    if (Send(msg, -FILE_SERVER) == ERROR) {
+    if (SendMessage(msg) == ERROR) {
         free(msg);
         return ERROR;
     }
@@ -228,7 +253,7 @@ int Unlink(char* pathname){
     msg->data1 = curr_inum;
     msg->addr1 = pathname;
 
-    Send((void*)msg, -FILE_SERVER);
+    SendMessage(msg);
     if (msg->type == ERROR) {
         free(msg);
         return ERROR;
@@ -248,12 +273,12 @@ int SymLink(char* oldname, char* newname){
     }
 
     Message* msg = (Message*)calloc(1, sizeof(Message));
-    msg->type = UNLINK;
+    msg->type = SYMLINK;
     msg->data1 = curr_inum;
     msg->addr1 = oldname;
     msg->addr2 = newname;
 
-    if (Send(msg, -FILE_SERVER) == ERROR) {
+    if (SendMessage(msg) == ERROR) {
         free(msg);
         return ERROR;
     }
@@ -283,7 +308,7 @@ int ReadLink(char* pathname, char* buf, int len) {
     msg->addr2 = buf;
     msg->data2 = len;
 
-    if (Send(msg, -FILE_SERVER) == ERROR) {
+    if (SendMessage(msg) == ERROR) {
         free(msg);
         return ERROR;
     }
@@ -308,7 +333,7 @@ int MkDir(char* pathname) {
     msg->data1 = curr_inum;
     msg->addr1 = pathname;
 
-    if (Send(msg, -FILE_SERVER) == ERROR) {
+    if (SendMessage(msg) == ERROR) {
         free(msg);
         return ERROR;
     }
@@ -332,7 +357,7 @@ int RmDir(char* pathname) {
     msg->data1 = curr_inum;
     msg->addr1 = pathname;
 
-    if (Send(msg, -FILE_SERVER) == ERROR) {
+    if (SendMessage(msg) == ERROR) {
         free(msg);
         return ERROR;
     }
@@ -356,7 +381,7 @@ int ChDir(char* pathname) {
     msg->data1 = curr_inum;
     msg->addr1 = pathname;
 
-    if (Send(msg, -FILE_SERVER) == ERROR) {
+    if (SendMessage(msg) == ERROR) {
         free(msg);
         return ERROR;
     }
@@ -382,7 +407,7 @@ int Stat(char* pathname, struct Stat* statbuf) {
     msg->addr1 = (void*)pathname;
     msg->addr2 = (void*)statbuf;
 
-    if (Send(msg, -FILE_SERVER) == ERROR) {
+    if (SendMessage(msg) == ERROR) {
         free(msg);
         return ERROR;
     }
@@ -405,18 +430,371 @@ int Sync(void) {
 	Message* msg = (Message*)calloc(1, sizeof(Message));
     msg->type = SYNC;
 
-    Send((void*)msg, -FILE_SERVER);
+    SendMessage(msg);
 
     free(msg);
     return 0;
 }
 
 int Shutdown(void) {
+    /* The server is going away with every handle */
+    memset(opened_files, 0, sizeof(opened_files));
+
     Message* msg = (Message*)calloc(1, sizeof(Message));
     msg->type = SHUTDOWN;
 
-    Send((void*)msg, -FILE_SERVER);
+    SendMessage(msg);
 
     free(msg);
 	return 0;
-}
\ No newline at end of file
+}
+
+void BatchInit(struct Batch* batch, void* buf, int size) {
+    batch->buf = (char*)buf;
+    batch->size = size;
+    batch->count = 0;
+    batch->payload = size;
+}
+
+/* Carve len bytes off the back of the buffer without hitting the op array */
+static int ReserveBatchPayload(struct Batch* batch, int len) {
+    int ops_end = (batch->count + 1) * sizeof(struct BatchOp);
+    if (len < 0 || batch->payload - len < ops_end) {
+        return ERROR;
+    }
+
+    batch->payload -= len;
+    return batch->payload;
+}
+
+static struct BatchOp* NewBatchOp(struct Batch* batch, int type, int flags) {
+    struct BatchOp* op = (struct BatchOp*)batch->buf + batch->count;
+    memset(op, 0, sizeof(struct BatchOp));
+    op->type = type;
+    op->flags = flags;
+    op->result = ERROR;
+
+    return op;
+}
+
+int BatchAdd(struct Batch* batch, int type, int flags, char* pathname, char* pathname2) {
+    if (batch == NULL || pathname == NULL || strlen(pathname) >= MAXPATHNAMELEN) {
+        return ERROR;
+    }
+
+    if (pathname2 != NULL && strlen(pathname2) >= MAXPATHNAMELEN) {
+        return ERROR;
+    }
+
+    int payload = batch->payload;
+    int name = ReserveBatchPayload(batch, strlen(pathname) + 1);
+    if (name == ERROR) {
+        return ERROR;
+    }
+
+    int name2 = 0;
+    if (pathname2 != NULL) {
+        name2 = ReserveBatchPayload(batch, strlen(pathname2) + 1);
+        if (name2 == ERROR) {
+            batch->payload = payload;
+            return ERROR;
+        }
+
+        strcpy(batch->buf + name2, pathname2);
+    }
+
+    strcpy(batch->buf + name, pathname);
+
+    struct BatchOp* op = NewBatchOp(batch, type, flags);
+    op->name = name;
+    op->name2 = name2;
+
+    return batch->count++;
+}
+
+int BatchAddIO(struct Batch* batch, int type, int flags, int fd, void* buf, int size, int offset) {
+    if (batch == NULL || size < 0 || offset < 0) {
+        return ERROR;
+    }
+
+    if (type != BATCH_READ && type != BATCH_WRITE) {
+        return ERROR;
+    }
+
+    /* A chained op writes to the inode the previous op returned */
+    if (!(flags & BATCH_CHAIN)) {
+        if (fd < 0 || fd >= MAX_OPEN_FILES || !opened_files[fd].valid) {
+            return ERROR;
+        }
+    }
+
+    if (type == BATCH_WRITE && buf == NULL) {
+        return ERROR;
+    }
+
+    int data = ReserveBatchPayload(batch, size);
+    if (data == ERROR) {
+        return ERROR;
+    }
+
+    if (type == BATCH_WRITE) {
+        memcpy(batch->buf + data, buf, size);
+    }
+
+    struct BatchOp* op = NewBatchOp(batch, type, flags);
+    if (!(flags & BATCH_CHAIN)) {
+        op->inum = opened_files[fd].inum;
+    }
+    op->size = size;
+    op->offset = offset;
+    op->data = data;
+
+    return batch->count++;
+}
+
+int SubmitBatch(struct Batch* batch) {
+    if (batch == NULL || batch->count == 0) {
+        return 0;
+    }
+
+    Message* msg = (Message*)calloc(1, sizeof(Message));
+    msg->type = BATCH;
+    msg->data1 = curr_inum;
+    msg->data2 = batch->size;
+    msg->data3 = batch->count;
+    msg->addr1 = (void*)batch->buf;
+
+    if (SendMessage(msg) == ERROR) {
+        free(msg);
+        return ERROR;
+    }
+
+    int ret = msg->type;
+    free(msg);
+    return ret;
+}
+
+struct BatchOp* BatchOpResult(struct Batch* batch, int index) {
+    if (batch == NULL || index < 0 || index >= batch->count) {
+        return NULL;
+    }
+
+    return (struct BatchOp*)batch->buf + index;
+}
+
+/* Data written or read by a BATCH_READ/BATCH_WRITE op */
+void* BatchOpData(struct Batch* batch, int index) {
+    struct BatchOp* op = BatchOpResult(batch, index);
+    if (op == NULL) {
+        return NULL;
+    }
+
+    return (void*)(batch->buf + op->data);
+}
+
+int ReadDirPlus(int fd, void* buf, int len, int* cookie) {
+    if (fd < 0 || fd >= MAX_OPEN_FILES || !opened_files[fd].valid) {
+        return ERROR;
+    }
+
+    if (buf == NULL || cookie == NULL || *cookie < 0 || len < (int)sizeof(struct DirEntryPlus)) {
+        return ERROR;
+    }
+
+    Message* msg = (Message*)calloc(1, sizeof(Message));
+    msg->type = READDIRPLUS;
+    msg->data1 = opened_files[fd].inum;
+    msg->data2 = len;
+    msg->data3 = *cookie;
+    msg->addr1 = buf;
+
+    if (SendMessage(msg) == ERROR) {
+        free(msg);
+        return ERROR;
+    }
+
+    int ret = msg->type;
+    if (ret != ERROR) {
+        *cookie = msg->data3;
+    }
+
+    free(msg);
+    return ret;
+}
+
+/* Read or write at an explicit offset, leaving the file position alone */
+static int TransferAt(int type, int fd, void* buf, int size, int offset) {
+    if (fd < 0 || fd >= MAX_OPEN_FILES || !opened_files[fd].valid) {
+        return ERROR;
+    }
+
+    if (buf == NULL || size < 0 || offset < 0) {
+        return ERROR;
+    }
+
+    Message* msg = (Message*)calloc(1, sizeof(Message));
+    msg->type = type;
+    msg->data1 = opened_files[fd].handle;
+    msg->data2 = size;
+    msg->data3 = offset;
+    msg->addr1 = buf;
+
+    if (SendMessage(msg) == ERROR) {
+        free(msg);
+        return ERROR;
+    }
+
+    int ret = msg->type;
+    free(msg);
+    return ret;
+}
+
+int PRead(int fd, void* buf, int size, int offset) {
+    return TransferAt(PREAD, fd, buf, size, offset);
+}
+
+int PWrite(int fd, void* buf, int size, int offset) {
+    return TransferAt(PWRITE, fd, buf, size, offset);
+}
+
+/* Scatter/gather at the file position, advancing it */
+static int TransferV(int type, int fd, struct IoVec* iov, int count) {
+    if (fd < 0 || fd >= MAX_OPEN_FILES || !opened_files[fd].valid) {
+        return ERROR;
+    }
+
+    if (iov == NULL || count <= 0 || count > MAX_IOVEC) {
+        return ERROR;
+    }
+
+    Message* msg = (Message*)calloc(1, sizeof(Message));
+    msg->type = type;
+    msg->data1 = opened_files[fd].handle;
+    msg->data2 = count;
+    msg->data3 = -1;
+    msg->addr1 = (void*)iov;
+
+    if (SendMessage(msg) == ERROR) {
+        free(msg);
+        return ERROR;
+    }
+
+    int ret = msg->type;
+    free(msg);
+    return ret;
+}
+
+int ReadV(int fd, struct IoVec* iov, int count) {
+    return TransferV(READV, fd, iov, count);
+}
+
+int WriteV(int fd, struct IoVec* iov, int count) {
+    return TransferV(WRITEV, fd, iov, count);
+}
+
+/* Copy the server's counters into stats, then reset them if reset != 0 */
+int GetStats(struct YfsStats* stats, int reset) {
+    if (stats == NULL) {
+        return ERROR;
+    }
+
+    Message* msg = (Message*)calloc(1, sizeof(Message));
+    msg->type = STATS;
+    msg->data1 = reset;
+    msg->data2 = sizeof(struct YfsStats);
+    msg->addr1 = (void*)stats;
+
+    if (SendMessage(msg) == ERROR) {
+        free(msg);
+        return ERROR;
+    }
+
+    int ret = msg->type;
+    free(msg);
+    if (ret == ERROR || stats->version != YFS_STATS_VERSION) {
+        return ERROR;
+    }
+
+    return 0;
+}
+
+/* Have the server print its latency histograms, then reset them if reset != 0 */
+int PrintLatency(int reset) {
+    Message* msg = (Message*)calloc(1, sizeof(Message));
+    msg->type = LATENCY;
+    msg->data1 = reset;
+
+    if (SendMessage(msg) == ERROR || msg->type == ERROR) {
+        free(msg);
+        return ERROR;
+    }
+
+    free(msg);
+    return 0;
+}
+
+/* Cut the file to length bytes, or grow it to length with a hole */
+int Truncate(char* pathname, int length) {
+    if (pathname == NULL || strlen(pathname) > MAXPATHNAMELEN || length < 0) {
+        return ERROR;
+    }
+
+    Message* msg = (Message*)calloc(1, sizeof(Message));
+    msg->type = TRUNCATE;
+    msg->data1 = curr_inum;
+    msg->data2 = length;
+    msg->addr1 = pathname;
+
+    if (SendMessage(msg) == ERROR || msg->type == ERROR) {
+        free(msg);
+        return ERROR;
+    }
+
+    free(msg);
+    return 0;
+}
+
+/* Truncate for an open file */
+int FTruncate(int fd, int length) {
+    if (fd < 0 || fd >= MAX_OPEN_FILES || !opened_files[fd].valid || length < 0) {
+        return ERROR;
+    }
+
+    Message* msg = (Message*)calloc(1, sizeof(Message));
+    msg->type = FTRUNCATE;
+    msg->data1 = opened_files[fd].handle;
+    msg->data2 = length;
+
+    if (SendMessage(msg) == ERROR || msg->type == ERROR) {
+        free(msg);
+        return ERROR;
+    }
+
+    free(msg);
+    return 0;
+}
+
+/* Move oldname to newname in one step, replacing what newname named */
+int Rename(char* oldname, char* newname) {
+    if (oldname == NULL || strlen(oldname) > MAXPATHNAMELEN) {
+        return ERROR;
+    }
+
+    if (newname == NULL || strlen(newname) > MAXPATHNAMELEN) {
+        return ERROR;
+    }
+
+    Message* msg = (Message*)calloc(1, sizeof(Message));
+    msg->type = RENAME;
+    msg->data1 = curr_inum;
+    msg->addr1 = oldname;
+    msg->addr2 = newname;
+
+    if (SendMessage(msg) == ERROR || msg->type == ERROR) {
+        free(msg);
+        return ERROR;
+    }
+
+    free(msg);
+    return 0;
+}
@@ -10,10 +10,12 @@
  *  running "od -X DISK" or "od -c DISK" under Unix can be useful ways
  *  to get a quick look at the DISK contents.
  *
- *  Usage: mkyfs [num_inodes]
+ *  Usage: mkyfs [-B block_size] [num_inodes]
  *
  *  The default number of inodes if num_inodes is not specified is
- *  given by the DEFAULT_NUM_INODES constant below.
+ *  given by the DEFAULT_NUM_INODES constant below.  block_size is in
+ *  bytes, SECTORSIZE times a power of two up to MAX_BLOCKSIZE (see
+ *  yfs.h); by default a block is one sector.
  *
  *  RUN THIS COMMAND AS A UNIX PROGRAM, NOT AS A YALNIX PROGRAM.
  */
@@ -23,32 +25,52 @@
 #include <stdlib.h>
 
 #include <comp421/filesystem.h>
+#include "yfs.h"
 
 #define	INODES_PER_BLOCK	(BLOCKSIZE/INODESIZE)
 
 #define DISK_FILE_NAME		"DISK"
 #define DEFAULT_NUM_INODES	(6 * INODES_PER_BLOCK - 1)
 
+int block_shift = 0;
+
 union {
     struct fs_header hdr;
-    struct inode inode[INODES_PER_BLOCK];
-    char buf[BLOCKSIZE];
+    char buf[MAX_BLOCKSIZE];
 } block;
 
+void
+usage(void)
+{
+    fprintf(stderr, "usage: mkyfs [-B block_size] [num_inodes]\n");
+    exit(1);
+}
+
 main(int argc, char **argv)
 {
     int disk;
-    int num_inodes = DEFAULT_NUM_INODES;
+    int num_inodes;
+    int block_size;
     int i;
     struct inode *inodes;
     int inodes_size;
     struct dir_entry root[2];
 
+    if (argc > 2 && strcmp(argv[1], "-B") == 0) {
+	if (sscanf(argv[2], "%d", &block_size) != 1)
+	    usage();
+	while (block_shift <= MAX_BLOCK_SHIFT && BLOCKSIZE != block_size)
+	    block_shift++;
+	if (block_shift > MAX_BLOCK_SHIFT)
+	    usage();
+	argc -= 2;
+	argv += 2;
+    }
+
+    num_inodes = DEFAULT_NUM_INODES;
     if (argc > 1) {
-	if (sscanf(argv[1], "%d", &num_inodes) != 1) {
-	    fprintf(stderr, "usage: mkyfs [num_inodes]\n");
-	    exit(1);
-	}
+	if (sscanf(argv[1], "%d", &num_inodes) != 1)
+	    usage();
     }
 
     if ((disk = creat(DISK_FILE_NAME, 0666)) < 0) {
@@ -63,8 +85,10 @@ main(int argc, char **argv)
     inodes_size = (inodes_size + BLOCKSIZE - 1) & ~(BLOCKSIZE - 1);
     inodes = (struct inode *)malloc(inodes_size);
 
-    ((struct fs_header *)inodes)->num_blocks = NUMSECTORS;
+    memset(inodes, 0, inodes_size);
+    ((struct fs_header *)inodes)->num_blocks = NUMSECTORS >> block_shift;
     ((struct fs_header *)inodes)->num_inodes = num_inodes;
+    BLOCK_SHIFT((struct fs_header *)inodes) = block_shift;
 
     inodes[1].type = INODE_DIRECTORY;
     inodes[1].nlink = 2;
@@ -94,6 +118,18 @@ main(int argc, char **argv)
 	exit(1);
     }
 
+    /*
+     *  With blocks larger than a sector, sector 1 is in the boot block
+     *  and gets a copy of the header so the server can find the block
+     *  size before it reads block 1.
+     */
+    lseek(disk, SECTORSIZE, 0);
+    if (write(disk, inodes, SECTORSIZE) != SECTORSIZE) {
+	perror("write header");
+	unlink(DISK_FILE_NAME);
+	exit(1);
+    }
+
     /*
      *  Seek to the last block of the DISK and write it full of zeros.
      *  In Unix, this leaves a "hole" in the file, which will act
@@ -103,7 +139,7 @@ main(int argc, char **argv)
      *  and it saves real Unix disk space since a hole doesn't consume
      *  physical disk blocks.
      */
-    lseek(disk, BLOCKSIZE * (NUMSECTORS - 1), 0);
+    lseek(disk, BLOCKSIZE * ((NUMSECTORS >> block_shift) - 1), 0);
     memset((void *)&block, '\0', BLOCKSIZE);
     if (write(disk, &block, BLOCKSIZE) != BLOCKSIZE) {
 	perror("write last zero");
@@ -0,0 +1,78 @@
+#include "../include/config.h"
+#include "../include/yfs.h"
+#include <stdio.h>
+#include <string.h>
+
+/* Memory one cached entry costs, with its list and hash table nodes */
+#define BLOCK_ENTRY_SIZE (BLOCKSIZE + sizeof(CacheNode) + sizeof(HashNode))
+#define INODE_ENTRY_SIZE (sizeof(struct inode) + sizeof(CacheNode) + sizeof(HashNode))
+
+void InitCacheConfig(CacheConfig* config) {
+    memset(config, 0, sizeof(CacheConfig));
+    config->inode_share = DEFAULT_INODE_SHARE;
+}
+
+/*
+ * Consume "-b n" (block cache entries), "-i n" (inode cache entries),
+ * "-m kb" (memory budget) or "-s percent" (inode share of the budget).
+ * Return false if option isn't one of them or value is bad.
+ */
+bool ParseCacheOption(CacheConfig* config, char* option, char* value) {
+    int n;
+    if (value == NULL || sscanf(value, "%d", &n) != 1 || n <= 0) {
+        return false;
+    }
+
+    if (strcmp(option, "-b") == 0) {
+        config->block_entries = n;
+    } else if (strcmp(option, "-i") == 0) {
+        config->inode_entries = n;
+    } else if (strcmp(option, "-m") == 0) {
+        config->memory_kb = n;
+    } else if (strcmp(option, "-s") == 0 && n < 100) {
+        config->inode_share = n;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static int Clamp(int n, int low, int high) {
+    if (n > high) {
+        n = high;
+    }
+
+    return (n < low) ? low : n;
+}
+
+/*
+ * Fill in the sizes not given.  Without a budget the block cache holds
+ * 1/16 of the disk and the inode cache 1/4 of the inodes.  Neither is
+ * smaller than the compile-time default or larger than the disk.
+ */
+void SizeCaches(CacheConfig* config, int num_blocks, int num_inodes) {
+    if (config->memory_kb > 0) {
+        long budget = (long)config->memory_kb * 1024;
+        long inode_budget = budget * config->inode_share / 100;
+
+        if (config->inode_entries == 0) {
+            config->inode_entries = inode_budget / INODE_ENTRY_SIZE;
+        }
+
+        if (config->block_entries == 0) {
+            config->block_entries = (budget - inode_budget) / BLOCK_ENTRY_SIZE;
+        }
+    }
+
+    if (config->block_entries == 0) {
+        config->block_entries = num_blocks / 16;
+    }
+
+    if (config->inode_entries == 0) {
+        config->inode_entries = num_inodes / 4;
+    }
+
+    config->block_entries = Clamp(config->block_entries, BLOCK_CACHESIZE, num_blocks);
+    config->inode_entries = Clamp(config->inode_entries, INODE_CACHESIZE, num_inodes);
+}
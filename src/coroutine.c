@@ -0,0 +1,249 @@
+#include "../include/coroutine.h"
+#include "../include/stats.h"
+#include "../include/latency.h"
+#include "../include/yfstime.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <comp421/yalnix.h>
+
+static ucontext_t scheduler_context;
+
+/* Coroutine currently running, NULL while on the scheduler's stack */
+static Coroutine* current = NULL;
+
+static Coroutine* free_coroutines = NULL;
+
+static Coroutine* suspended = NULL;
+
+static int suspend_disabled = 0;
+
+/* Number of coroutines ever started, the epoch of the newest */
+static unsigned long long epoch = 0;
+
+/* Oldest first, so epochs only grow along the list */
+static DeferredFree* deferred = NULL;
+
+static DeferredFree* deferred_tail = NULL;
+
+void InitCoroutines(void) {
+    int i;
+    for (i = 0; i < MAX_COROUTINES; ++i) {
+        Coroutine* co = (Coroutine*)calloc(1, sizeof(Coroutine));
+        co->stack = (char*)malloc(COROUTINE_STACKSIZE);
+        if (co->stack == NULL) {
+            free(co);
+            break;
+        }
+
+        co->next = free_coroutines;
+        free_coroutines = co;
+    }
+}
+
+/*
+ * Only requests that never modify the file system may suspend.  Requests
+ * that modify it keep running to completion, so they never interleave with
+ * each other or observe a half-finished update.
+ */
+bool IsSuspendableRequest(int type) {
+    switch (type) {
+        case OPEN:
+        case READ:
+        case SEEK:
+        case READLINK:
+        case CHDIR:
+        case STAT:
+        case READDIRPLUS:
+        case PREAD:
+        case READV:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void RunCoroutine(void) {
+    Coroutine* co = current;
+
+    DispatchMessage(co->msg, co->pid);
+    free(co->msg);
+    co->msg = NULL;
+    co->finished = true;
+}
+
+static void SwitchTo(Coroutine* co) {
+    int prev_op = SetStatsOp(co->op);
+    current = co;
+    swapcontext(&scheduler_context, &co->context);
+    current = NULL;
+    SetStatsOp(prev_op);
+
+    if (co->finished) {
+        co->next = free_coroutines;
+        free_coroutines = co;
+    }
+
+    ReclaimDeferred();
+}
+
+bool SpawnCoroutine(Message* msg, int pid) {
+    if (free_coroutines == NULL || current != NULL) {
+        return false;
+    }
+
+    Coroutine* co = free_coroutines;
+    free_coroutines = co->next;
+
+    co->msg = msg;
+    co->pid = pid;
+    co->op = msg->type;
+    co->finished = false;
+    co->wait_bnum = 0;
+    co->wait_status = 0;
+    co->epoch = ++epoch;
+    co->next = NULL;
+
+    getcontext(&co->context);
+    co->context.uc_stack.ss_sp = co->stack;
+    co->context.uc_stack.ss_size = COROUTINE_STACKSIZE;
+    co->context.uc_link = &scheduler_context;
+    makecontext(&co->context, RunCoroutine, 0);
+
+    SwitchTo(co);
+    return true;
+}
+
+bool CanSuspend(void) {
+    return current != NULL && suspend_disabled == 0;
+}
+
+/* Park the running coroutine until block #bnum arrives */
+int SuspendCoroutine(int bnum) {
+    Coroutine* co = current;
+    if (co == NULL) {
+        return ERROR;
+    }
+
+    co->wait_bnum = bnum;
+    co->next = suspended;
+    suspended = co;
+
+    /* Time spent parked is charged to this request as disk wait */
+    RequestTiming* timing = SetRequestTiming(NULL);
+    unsigned long long start = ReadTimeStamp();
+
+    swapcontext(&co->context, &scheduler_context);
+
+    SetRequestTiming(timing);
+    AddDiskWait(ReadTimeStamp() - start);
+
+    return co->wait_status;
+}
+
+/* Resume every coroutine waiting on block #bnum, in the order they slept */
+void WakeCoroutines(int bnum, int status) {
+    Coroutine* ready = NULL;
+    Coroutine** link = &suspended;
+
+    while (*link != NULL) {
+        Coroutine* co = *link;
+        if (co->wait_bnum == bnum) {
+            *link = co->next;
+            co->next = ready;
+            ready = co;
+        } else {
+            link = &co->next;
+        }
+    }
+
+    while (ready != NULL) {
+        Coroutine* co = ready;
+        ready = co->next;
+        co->next = NULL;
+        co->wait_bnum = 0;
+        co->wait_status = status;
+        SwitchTo(co);
+    }
+}
+
+void DisableSuspend(void) {
+    ++suspend_disabled;
+}
+
+void EnableSuspend(void) {
+    --suspend_disabled;
+}
+
+/*
+ * Suspended coroutines may still hold pointers to evicted cache values,
+ * so those values are only released once every coroutine that was alive
+ * when they were evicted has finished.  One started later never saw
+ * them, so a steady stream of misses doesn't keep them around.
+ */
+static void AppendDeferred(DeferredFree* node) {
+    node->epoch = epoch;
+    node->next = NULL;
+
+    if (deferred_tail == NULL) {
+        deferred = node;
+    } else {
+        deferred_tail->next = node;
+    }
+    deferred_tail = node;
+}
+
+void DeferFree(void* ptr) {
+    DeferredFree* node = (DeferredFree*)calloc(1, sizeof(DeferredFree));
+    node->ptr = ptr;
+    AppendDeferred(node);
+}
+
+/*
+ * Call release(arg, count) the same way, at once if nothing is suspended.
+ * Freed blocks go through this: a suspended reader may wake up holding a
+ * block number it looked up before the free, so the block must not be
+ * reused for another file until that reader is done.
+ */
+void DeferRelease(void (*release)(int, int), int arg, int count) {
+    if (suspended == NULL && current == NULL) {
+        ReclaimDeferred();
+        release(arg, count);
+        return;
+    }
+
+    DeferredFree* node = (DeferredFree*)calloc(1, sizeof(DeferredFree));
+    node->release = release;
+    node->arg = arg;
+    node->count = count;
+    AppendDeferred(node);
+}
+
+void ReclaimDeferred(void) {
+    if (current != NULL) {
+        return;
+    }
+
+    /* Everything deferred before the oldest suspended coroutine started is unreachable */
+    unsigned long long oldest = epoch + 1;
+    Coroutine* co;
+    for (co = suspended; co != NULL; co = co->next) {
+        if (co->epoch < oldest) {
+            oldest = co->epoch;
+        }
+    }
+
+    while (deferred != NULL && deferred->epoch < oldest) {
+        DeferredFree* node = deferred;
+        deferred = node->next;
+        if (node->release != NULL) {
+            node->release(node->arg, node->count);
+        } else {
+            free(node->ptr);
+        }
+        free(node);
+    }
+
+    if (deferred == NULL) {
+        deferred_tail = NULL;
+    }
+}
@@ -0,0 +1,198 @@
+#include "../include/diskio.h"
+#include "../include/coroutine.h"
+#include "../include/stats.h"
+#include "../include/log.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <comp421/yalnix.h>
+#include <comp421/hardware.h>
+
+static DiskHelper helpers[NUM_DISK_HELPERS];
+
+static int num_helpers = 0;
+
+/* bnum -> PendingRead for every read not yet completed */
+static HashTable* pending_reads;
+
+/* Reads waiting for an idle helper */
+static PendingRead* queue_head = NULL;
+static PendingRead* queue_tail = NULL;
+
+static void RunDiskHelper(void) {
+    Message msg;
+    char block[MAX_BLOCKSIZE];
+
+    while (1) {
+        int pid = Receive((void*)&msg);
+        if (pid == ERROR || msg.type != DISK_READ) {
+            continue;
+        }
+
+        int bnum = msg.data1;
+        Reply((void*)&msg, pid);
+
+        /* A block is SECTORS_PER_BLOCK sectors, as in ReadBlockSector */
+        msg.type = DISK_DONE;
+        msg.data1 = bnum;
+        msg.data2 = 0;
+        int i;
+        for (i = 0; i < SECTORS_PER_BLOCK && msg.data2 != ERROR; ++i) {
+            msg.data2 = ReadSector((bnum << block_shift) + i, block + i * SECTORSIZE);
+        }
+        msg.addr1 = (void*)block;
+        Send((void*)&msg, -FILE_SERVER);
+    }
+}
+
+int InitDiskHelpers(void) {
+    pending_reads = InitHashTable(MAX_COROUTINES);
+
+    int i;
+    for (i = 0; i < NUM_DISK_HELPERS; ++i) {
+        int pid = Fork();
+        if (pid == 0) {
+            RunDiskHelper();
+            Exit(0);
+        }
+
+        if (pid == ERROR) {
+            LOG_ERROR("Can't fork disk helper, falling back to synchronous reads\n");
+            break;
+        }
+
+        helpers[num_helpers].pid = pid;
+        helpers[num_helpers].idle = true;
+        ++num_helpers;
+    }
+
+    return num_helpers;
+}
+
+static DiskHelper* GetIdleHelper(void) {
+    int i;
+    for (i = 0; i < num_helpers; ++i) {
+        if (helpers[i].idle) {
+            return helpers + i;
+        }
+    }
+
+    return NULL;
+}
+
+static void IssueDiskRead(DiskHelper* helper, PendingRead* read) {
+    Message msg;
+    msg.type = DISK_READ;
+    msg.data1 = read->bnum;
+
+    helper->idle = false;
+    read->issued = true;
+    Send((void*)&msg, helper->pid);
+}
+
+/*
+ * Start an asynchronous read of block #bnum unless one is already in
+ * flight.  Return false if no helper exists and the caller must read
+ * synchronously.
+ */
+bool RequestDiskRead(int bnum) {
+    if (num_helpers == 0) {
+        return false;
+    }
+
+    if (GetItemFromHashTable(pending_reads, bnum) != NULL) {
+        return true;
+    }
+
+    PendingRead* read = (PendingRead*)calloc(1, sizeof(PendingRead));
+    read->bnum = bnum;
+    read->op = GetStatsOp();
+    PutItemInHashTable(pending_reads, bnum, (void*)read);
+
+    DiskHelper* helper = GetIdleHelper();
+    if (helper != NULL) {
+        IssueDiskRead(helper, read);
+        return true;
+    }
+
+    if (queue_tail == NULL) {
+        queue_head = read;
+    } else {
+        queue_tail->next = read;
+    }
+    queue_tail = read;
+
+    return true;
+}
+
+void CompleteDiskRead(Message* msg, int pid) {
+    DiskHelper* helper = NULL;
+    int i;
+    for (i = 0; i < num_helpers; ++i) {
+        if (helpers[i].pid == pid) {
+            helper = helpers + i;
+            break;
+        }
+    }
+
+    if (helper == NULL) {
+        LOG_ERROR("ERROR : Disk completion from unknown process %d\n", pid);
+        msg->type = ERROR;
+        Reply((void*)msg, pid);
+        return;
+    }
+
+    int bnum = msg->data1;
+    int status = msg->data2;
+    void* block = malloc(BLOCKSIZE);
+    if (status != ERROR && CopyFrom(pid, block, msg->addr1, BLOCKSIZE) == ERROR) {
+        status = ERROR;
+    }
+
+    Reply((void*)msg, pid);
+    helper->idle = true;
+
+    PendingRead* read = (PendingRead*)GetItemFromHashTable(pending_reads, bnum);
+    RemoveItemFromHashTable(pending_reads, bnum);
+
+    if (read != NULL) {
+        int prev_op = SetStatsOp(read->op);
+        for (i = 0; i < SECTORS_PER_BLOCK; ++i) {
+            CountSectorRead();
+        }
+        SetStatsOp(prev_op);
+    }
+
+    /* Never replace a cached copy, it may be newer than the sector */
+    if (status == ERROR || read == NULL || read->stale ||
+        GetItemFromHashTable(block_cache->table, bnum) != NULL) {
+        free(block);
+    } else {
+        CacheBlock(bnum, block);
+    }
+    free(read);
+
+    if (queue_head != NULL) {
+        PendingRead* next = queue_head;
+        queue_head = next->next;
+        if (queue_head == NULL) {
+            queue_tail = NULL;
+        }
+
+        next->next = NULL;
+        IssueDiskRead(helper, next);
+    }
+
+    WakeCoroutines(bnum, status == ERROR ? ERROR : 0);
+}
+
+/* Called whenever block #bnum is written or read outside the helpers */
+void InvalidateDiskRead(int bnum) {
+    if (num_helpers == 0) {
+        return;
+    }
+
+    PendingRead* read = (PendingRead*)GetItemFromHashTable(pending_reads, bnum);
+    if (read != NULL) {
+        read->stale = true;
+    }
+}
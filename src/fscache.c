@@ -17,6 +17,27 @@ CacheNode* InitCacheNode(int key, void* val) {
     return node;
 }
 
+/* Unlink the least recently used node that is not pinned, NULL if all are */
+static CacheNode* EvictNode(Cache* cache) {
+    CacheNode* tail = cache->tail;
+    while (tail != NULL && tail->pins > 0) {
+        tail = tail->prev;
+    }
+
+    if (tail == NULL) {
+        return NULL;
+    }
+
+    RemoveNode(cache, tail);
+    RemoveItemFromHashTable(cache->table, tail->key);
+    ++cache->evictions;
+    if (tail->dirty) {
+        ++cache->dirty_evictions;
+    }
+
+    return tail;
+}
+
 CacheNode* PutItemInCache(Cache* cache, int key, void* value) {
     CacheNode* node = GetItemFromHashTable(cache->table, key);
 
@@ -35,28 +56,52 @@ CacheNode* PutItemInCache(Cache* cache, int key, void* value) {
             SetHead(cache, node);
             ++cache->len;
         } else {
-            CacheNode* tail = cache->tail;
-            RemoveNode(cache, tail);
-            RemoveItemFromHashTable(cache->table, tail->key);
+            /* Past capacity only while everything else is pinned */
+            CacheNode* tail = EvictNode(cache);
             SetHead(cache, node);
-
-            if (tail->dirty) {
-                return tail;
+            if (tail == NULL) {
+                ++cache->len;
+                return NULL;
             }
 
-            free(tail);
+            /* Caller writes back the evicted node if dirty and releases it */
+            return tail;
         }
     }
 
     return NULL;
 }
 
+/*
+ * Evict one node of a cache that pinned nodes pushed past its capacity,
+ * now that some are unpinned.  Call until it returns NULL, handling each
+ * node like one PutItemInCache evicted.
+ */
+CacheNode* TrimCache(Cache* cache) {
+    if (cache->len <= cache->capacity) {
+        return NULL;
+    }
+
+    CacheNode* node = EvictNode(cache);
+    if (node != NULL) {
+        --cache->len;
+    }
+
+    return node;
+}
+
 void* GetItemFromCache(Cache* cache, int key) {
+    if (cache->on_access != NULL) {
+        cache->on_access(cache, key);
+    }
+
     CacheNode* node = GetItemFromHashTable(cache->table, key);
     if (node == NULL) {
+        ++cache->misses;
         return NULL;
     }
-    
+
+    ++cache->hits;
     if (cache->head != node) {
         RemoveNode(cache, node);
         SetHead(cache, node);
@@ -65,6 +110,16 @@ void* GetItemFromCache(Cache* cache, int key) {
     return node->value;
 }
 
+/* Look up without counting a hit or miss or touching the LRU order */
+void* PeekItemInCache(Cache* cache, int key) {
+    CacheNode* node = GetItemFromHashTable(cache->table, key);
+    if (node == NULL) {
+        return NULL;
+    }
+
+    return node->value;
+}
+
 void SetHead(Cache* cache, CacheNode* node) {
     node->next = cache->head;
     node->prev = NULL;
@@ -85,7 +140,7 @@ void RemoveNode(Cache* cache, CacheNode* node) {
     CacheNode* next = node->next;
 
     if (prev != NULL) {
-        prev->next = NULL;
+        prev->next = next;
     } else {
         cache->head = next;
     }
@@ -102,10 +157,29 @@ void SetDirty(Cache* cache, int key) {
 
     if (node != NULL) {
         node->dirty = true;
+        if (cache->on_dirty != NULL) {
+            cache->on_dirty(cache, key);
+        }
 
         if (cache->head != node) {
             RemoveNode(cache, node);
             SetHead(cache, node);
         }
     }
-}
\ No newline at end of file
+}
+
+void PinCacheItem(Cache* cache, int key) {
+    CacheNode* node = GetItemFromHashTable(cache->table, key);
+
+    if (node != NULL) {
+        ++node->pins;
+    }
+}
+
+void UnpinCacheItem(Cache* cache, int key) {
+    CacheNode* node = GetItemFromHashTable(cache->table, key);
+
+    if (node != NULL && node->pins > 0) {
+        --node->pins;
+    }
+}
@@ -0,0 +1,64 @@
+#include "../include/histogram.h"
+#include <string.h>
+
+static int GetBucketIndex(unsigned long long value) {
+    if (value < HIST_SUB_BUCKETS) {
+        return (int)value;
+    }
+
+    int msb = 63 - __builtin_clzll(value);
+    if (msb >= HIST_MAX_BITS) {
+        return HIST_BUCKETS - 1;
+    }
+
+    int shift = msb - HIST_SUB_BITS;
+    int sub = (int)(value >> shift) & (HIST_SUB_BUCKETS - 1);
+    return HIST_SUB_BUCKETS + shift * HIST_SUB_BUCKETS + sub;
+}
+
+/* Largest value that falls into bucket #index */
+static unsigned long long GetBucketLimit(int index) {
+    if (index < HIST_SUB_BUCKETS) {
+        return (unsigned long long)index;
+    }
+
+    int shift = (index - HIST_SUB_BUCKETS) / HIST_SUB_BUCKETS;
+    int sub = (index - HIST_SUB_BUCKETS) % HIST_SUB_BUCKETS;
+    return ((unsigned long long)(HIST_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+void RecordValue(Histogram* hist, unsigned long long value) {
+    ++hist->counts[GetBucketIndex(value)];
+    ++hist->total;
+    hist->sum += value;
+    if (value > hist->max) {
+        hist->max = value;
+    }
+}
+
+unsigned long long GetPercentile(Histogram* hist, double percentile) {
+    if (hist->total == 0) {
+        return 0;
+    }
+
+    unsigned long long rank = (unsigned long long)(percentile / 100.0 * hist->total);
+    if (rank >= hist->total) {
+        rank = hist->total - 1;
+    }
+
+    unsigned long long seen = 0;
+    int i;
+    for (i = 0; i < HIST_BUCKETS; ++i) {
+        seen += hist->counts[i];
+        if (seen > rank) {
+            unsigned long long limit = GetBucketLimit(i);
+            return (limit < hist->max) ? limit : hist->max;
+        }
+    }
+
+    return hist->max;
+}
+
+void ResetHistogram(Histogram* hist) {
+    memset(hist, 0, sizeof(Histogram));
+}
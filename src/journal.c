@@ -0,0 +1,866 @@
+#include "../include/journal.h"
+#include "../include/reclaim.h"
+#include "../include/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <comp421/yalnix.h>
+
+#define MAP_BITS_PER_BLOCK (BLOCKSIZE * 8)
+
+/*
+ * Most blocks one step of a long request adds to the group: a path of
+ * indirect blocks with a new root, a free map block for each of those
+ * and the data block, and the inode's block.
+ */
+#define STEP_BLOCKS (2 * (MAX_INDIRECT_LEVELS + 1) + 1)
+
+/* A client whose reply waits for its group to commit */
+typedef struct DeferredReply {
+	Message msg;
+	int pid;
+} DeferredReply;
+
+/* Growable list of block or inode numbers */
+typedef struct NumberList {
+	int* items;
+	int len;
+	int cap;
+} NumberList;
+
+/* Points into header.padding, valid once a journal is mounted */
+static struct journal_header* journal = NULL;
+
+static bool active = false;
+
+static int group_size = DEFAULT_GROUP_SIZE;
+
+/* Next unused journal block, and the sequence number of the next group */
+static int head = 0;
+static int seq = 0;
+
+/* Longest group written since mounting, in journal blocks */
+static int longest_group = 0;
+
+/* Nesting of BeginTransaction, and whether the outermost one changed anything */
+static int depth = 0;
+static bool changed = false;
+
+/* Transactions in the running group */
+static int group_transactions = 0;
+
+/* Blocks and inodes the running group changed, pinned until it commits */
+static NumberList group_blocks;
+static NumberList group_inodes;
+static HashTable* group_block_set;
+static HashTable* group_inode_set;
+
+/* Blocks freed by the running group, and committed frees held for a checkpoint */
+static NumberList group_frees;
+static NumberList checkpoint_frees;
+
+/* The same for fragments, as pairs of a tail pointer and a fragment count */
+static NumberList group_frag_frees;
+static NumberList checkpoint_frag_frees;
+
+/* Blocks written to the journal since the last checkpoint */
+static HashTable* logged;
+
+static DeferredReply* replies = NULL;
+static int num_replies = 0;
+static int reply_cap = 0;
+
+/* Commit helper process, and whether it is timing a group now */
+static int helper_pid = ERROR;
+static bool ticking = false;
+
+void InitJournalConfig(JournalConfig* config) {
+	memset(config, 0, sizeof(JournalConfig));
+	config->group_size = DEFAULT_GROUP_SIZE;
+}
+
+/*
+ * Consume "-J blocks" (create a journal this big if the disk has none)
+ * or "-G n" (transactions per group commit).  Return false if option
+ * isn't one of them or value is bad.
+ */
+bool ParseJournalOption(JournalConfig* config, char* option, char* value) {
+	int n;
+	if (value == NULL || sscanf(value, "%d", &n) != 1 || n <= 0) {
+		return false;
+	}
+
+	if (strcmp(option, "-J") == 0 && n >= JOURNAL_MIN_BLOCKS) {
+		config->blocks = n;
+	} else if (strcmp(option, "-G") == 0) {
+		config->group_size = n;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+static void Append(NumberList* list, int n) {
+	if (list->len == list->cap) {
+		list->cap = (list->cap == 0) ? 64 : list->cap * 2;
+		list->items = (int*)realloc(list->items, list->cap * sizeof(int));
+	}
+
+	list->items[list->len++] = n;
+}
+
+/* Bits of the free map: blocks, inodes, then the fragments of every block */
+static int MapBits(void) {
+	return header.num_blocks + header.num_inodes + 1 + header.num_blocks * FRAGS_PER_BLOCK;
+}
+
+static int FragmentBit(int bnum, int frag) {
+	return header.num_blocks + header.num_inodes + 1 + bnum * FRAGS_PER_BLOCK + frag;
+}
+
+static int MapBlocks(void) {
+	return (MapBits() + MAP_BITS_PER_BLOCK - 1) / MAP_BITS_PER_BLOCK;
+}
+
+/* Journal blocks taking a group of count blocks */
+static int GroupLength(int count) {
+	return count + (count + JOURNAL_DESC_ENTRIES - 1) / JOURNAL_DESC_ENTRIES + 1;
+}
+
+static void StartJournal(JournalConfig* config) {
+	active = true;
+	head = 0;
+	seq = journal->seq;
+	group_size = (config != NULL) ? config->group_size : DEFAULT_GROUP_SIZE;
+	group_block_set = InitHashTable(journal->blocks);
+	group_inode_set = InitHashTable(journal->blocks);
+	logged = InitHashTable(journal->blocks);
+	inode_cache->on_dirty = JournalInode;
+}
+
+/* Write the header sector, with the journal fields, through the cached block */
+static int WriteHeader(void) {
+	void* block = GetBlockByBnum(1);
+	if (block == NULL) {
+		return ERROR;
+	}
+
+	memcpy(block, &header, sizeof(struct fs_header));
+	if (WriteBlockSector(1, block) == ERROR) {
+		LOG_ERROR("Write Sector #1 failed\n");
+		return ERROR;
+	}
+
+	return 0;
+}
+
+/* Copy every committed group after the last checkpoint to its home blocks */
+static int ReplayJournal(void) {
+	struct journal_record* record = (struct journal_record*)malloc(BLOCKSIZE);
+	char* block = (char*)malloc(BLOCKSIZE);
+	int* bnums = (int*)malloc(journal->blocks * sizeof(int));
+	int pos = 0;
+	int groups = 0;
+
+	while (pos < journal->blocks) {
+		int first = pos;
+		int count = 0;
+		bool committed = false;
+
+		/* Gather the group's descriptors, it counts only if its commit record made it */
+		while (pos < journal->blocks) {
+			if (ReadBlockSector(journal->start + pos, record) == ERROR || record->seq != seq) {
+				break;
+			}
+
+			if (record->magic == JOURNAL_COMMIT_MAGIC) {
+				committed = (record->count == count);
+				++pos;
+				break;
+			}
+
+			if (record->magic != JOURNAL_DESC_MAGIC || record->count <= 0 ||
+				record->count > JOURNAL_DESC_ENTRIES || pos + 1 + record->count > journal->blocks) {
+				break;
+			}
+
+			memcpy(bnums + count, record->bnums, record->count * sizeof(int));
+			count += record->count;
+			pos += 1 + record->count;
+		}
+
+		if (!committed) {
+			break;
+		}
+
+		/* Block images follow their descriptor, skip the descriptors */
+		int image = first;
+		int i;
+		for (i = 0; i < count; ++i) {
+			if (i % JOURNAL_DESC_ENTRIES == 0) {
+				++image;
+			}
+
+			if (ReadBlockSector(journal->start + image, block) == ERROR) {
+				groups = ERROR;
+				break;
+			}
+			++image;
+
+			if (bnums[i] > 0 && bnums[i] < journal->map_start + journal->map_blocks &&
+				WriteBlockSector(bnums[i], block) == ERROR) {
+				LOG_ERROR("Write Sector #%d failed\n", bnums[i]);
+				groups = ERROR;
+				break;
+			}
+		}
+
+		if (groups == ERROR) {
+			break;
+		}
+
+		++seq;
+		++groups;
+	}
+
+	free(record);
+	free(block);
+	free(bnums);
+	if (groups == ERROR) {
+		return ERROR;
+	}
+
+	LOG_INFO("Replayed %d journal groups\n", groups);
+	return groups;
+}
+
+static bool MapBit(unsigned char* map, int bit) {
+	return (map[(bit % MAP_BITS_PER_BLOCK) / 8] >> (bit % 8)) & 1;
+}
+
+static void SetMapBit(unsigned char* map, int bit, bool used) {
+	unsigned char mask = 1 << (bit % 8);
+	int byte = (bit % MAP_BITS_PER_BLOCK) / 8;
+	if (used) {
+		map[byte] |= mask;
+	} else {
+		map[byte] &= ~mask;
+	}
+}
+
+static int LoadFreeMaps(void) {
+	unsigned char map[BLOCKSIZE];
+	int total = MapBits();
+	int frag_base = FragmentBit(0, 0);
+	num_free_blocks = 0;
+	num_free_inodes = 0;
+
+	int bit;
+	for (bit = 0; bit < total; ++bit) {
+		if (bit % MAP_BITS_PER_BLOCK == 0 &&
+			ReadBlockSector(journal->map_start + bit / MAP_BITS_PER_BLOCK, map) == ERROR) {
+			return ERROR;
+		}
+
+		bool used = MapBit(map, bit);
+		if (bit < header.num_blocks) {
+			free_blocks[bit] = (bit > 0) && !used;
+			num_free_blocks += free_blocks[bit];
+		} else if (bit >= frag_base) {
+			if (used) {
+				frag_maps[(bit - frag_base) / FRAGS_PER_BLOCK] |= 1u << ((bit - frag_base) % FRAGS_PER_BLOCK);
+			}
+		} else if (bit > header.num_blocks) {
+			free_inodes[bit - header.num_blocks] = !used;
+			num_free_inodes += !used;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Mount the journal described by the header: replay committed groups,
+ * then load the free maps from disk.  Return 1 if the disk has a
+ * journal, 0 if it needs the usual scan, ERROR if it can't be used.
+ */
+int MountJournal(JournalConfig* config) {
+	journal = (struct journal_header*)header.padding;
+	if (journal->magic != JOURNAL_MAGIC) {
+		return 0;
+	}
+
+	if (journal->blocks < JOURNAL_MIN_BLOCKS || journal->map_blocks != MapBlocks() ||
+		journal->map_start + journal->map_blocks != journal->start ||
+		journal->start + journal->blocks != header.num_blocks) {
+		LOG_ERROR("Bad journal header\n");
+		return ERROR;
+	}
+
+	seq = journal->seq;
+	int groups = ReplayJournal();
+	if (groups == ERROR) {
+		return ERROR;
+	}
+
+	/* Replayed groups are home now, start the journal over after them */
+	if (groups > 0) {
+		journal->seq = seq;
+		if (WriteHeader() == ERROR) {
+			return ERROR;
+		}
+	}
+
+	if (LoadFreeMaps() == ERROR) {
+		LOG_ERROR("Can't read the free map\n");
+		return ERROR;
+	}
+
+	StartJournal(config);
+	return 1;
+}
+
+/*
+ * Reserve config->blocks journal blocks and the free map at the end of a
+ * freshly scanned disk.  Leave the disk without a journal if any of
+ * those blocks is in use.
+ */
+int CreateJournal(JournalConfig* config) {
+	if (config == NULL || config->blocks == 0) {
+		return 0;
+	}
+
+	int map_blocks = MapBlocks();
+	int first = header.num_blocks - config->blocks - map_blocks;
+	int bnum;
+	for (bnum = (first > 0) ? first : 1; bnum < header.num_blocks; ++bnum) {
+		if (first <= 0 || !free_blocks[bnum]) {
+			LOG_ERROR("Blocks %d to %d aren't free, no journal\n", first, header.num_blocks - 1);
+			return 0;
+		}
+	}
+
+	for (bnum = first; bnum < header.num_blocks; ++bnum) {
+		free_blocks[bnum] = false;
+		--num_free_blocks;
+	}
+
+	unsigned char map[BLOCKSIZE];
+	int total = MapBits();
+	int frag_base = FragmentBit(0, 0);
+	int bit;
+	for (bit = 0; bit < total; ++bit) {
+		if (bit % MAP_BITS_PER_BLOCK == 0) {
+			memset(map, 0, BLOCKSIZE);
+		}
+
+		bool used;
+		if (bit < header.num_blocks) {
+			used = !free_blocks[bit];
+		} else if (bit >= frag_base) {
+			used = (frag_maps[(bit - frag_base) / FRAGS_PER_BLOCK] >> ((bit - frag_base) % FRAGS_PER_BLOCK)) & 1;
+		} else {
+			used = (bit == header.num_blocks) || !free_inodes[bit - header.num_blocks];
+		}
+		SetMapBit(map, bit, used);
+
+		if (bit % MAP_BITS_PER_BLOCK == MAP_BITS_PER_BLOCK - 1 || bit == total - 1) {
+			if (WriteBlockSector(first + bit / MAP_BITS_PER_BLOCK, map) == ERROR) {
+				LOG_ERROR("Write Sector #%d failed\n", first + bit / MAP_BITS_PER_BLOCK);
+				return ERROR;
+			}
+		}
+	}
+
+	journal = (struct journal_header*)header.padding;
+	journal->start = first + map_blocks;
+	journal->blocks = config->blocks;
+	journal->map_start = first;
+	journal->map_blocks = map_blocks;
+	journal->seq = 1;
+	journal->magic = JOURNAL_MAGIC;
+	if (WriteHeader() == ERROR) {
+		return ERROR;
+	}
+
+	LOG_INFO("Created a %d block journal at block %d\n", journal->blocks, journal->start);
+	StartJournal(config);
+	return 0;
+}
+
+/* Commit helper: time a partial group, then tell the server to commit it */
+static void RunJournalHelper(void) {
+	Message msg;
+
+	while (1) {
+		int pid = Receive((void*)&msg);
+		if (pid == ERROR || msg.type != JOURNAL_TICK) {
+			continue;
+		}
+
+		Reply((void*)&msg, pid);
+		Delay(JOURNAL_TICKS);
+
+		msg.type = JOURNAL_TICK;
+		Send((void*)&msg, -FILE_SERVER);
+	}
+}
+
+/* Without the helper a partial group waits for the next full one or a Sync */
+void InitJournalHelper(void) {
+	if (!active || group_size <= 1) {
+		return;
+	}
+
+	int pid = Fork();
+	if (pid == 0) {
+		RunJournalHelper();
+		Exit(0);
+	}
+
+	if (pid == ERROR) {
+		LOG_ERROR("Can't fork journal helper, partial groups wait for a full one\n");
+		return;
+	}
+
+	helper_pid = pid;
+}
+
+void CompleteJournalTick(Message* msg, int pid) {
+	Reply((void*)msg, pid);
+	if (pid != helper_pid) {
+		LOG_ERROR("ERROR : Journal tick from unknown process %d\n", pid);
+		return;
+	}
+
+	ticking = false;
+	CommitJournal();
+}
+
+static void StartTicking(void) {
+	if (helper_pid == ERROR || ticking) {
+		return;
+	}
+
+	Message msg;
+	memset(&msg, 0, sizeof(Message));
+	msg.type = JOURNAL_TICK;
+	ticking = true;
+	Send((void*)&msg, helper_pid);
+}
+
+/*
+ * Every request that may change the disk is one transaction.  Nested
+ * ones, the operations of a BATCH, belong to the outermost.
+ */
+void BeginTransaction(void) {
+	++depth;
+}
+
+void EndTransaction(void) {
+	if (--depth > 0 || !changed) {
+		return;
+	}
+
+	changed = false;
+	++group_transactions;
+
+	/* Commit a full group, or one nearing a quarter of the journal */
+	if (group_transactions >= group_size ||
+		GroupLength(group_blocks.len + group_inodes.len) > journal->blocks / 4) {
+		CommitJournal();
+	} else {
+		StartTicking();
+	}
+}
+
+/* Add block #bnum, just changed in block_cache, to the running group */
+void JournalBlock(int bnum) {
+	if (!active) {
+		return;
+	}
+
+	changed = true;
+	if (GetItemFromHashTable(group_block_set, bnum) != NULL) {
+		return;
+	}
+
+	PutItemInHashTable(group_block_set, bnum, (void*)journal);
+	Append(&group_blocks, bnum);
+	PinCacheItem(block_cache, bnum);
+}
+
+/* on_dirty hook of inode_cache: the inode joins the running group */
+void JournalInode(Cache* cache, int inum) {
+	changed = true;
+	if (GetItemFromHashTable(group_inode_set, inum) != NULL) {
+		return;
+	}
+
+	PutItemInHashTable(group_inode_set, inum, (void*)journal);
+	Append(&group_inodes, inum);
+	PinCacheItem(cache, inum);
+}
+
+static void NoteUsed(int bit, bool used) {
+	int bnum = journal->map_start + bit / MAP_BITS_PER_BLOCK;
+	unsigned char* map = (unsigned char*)GetBlockByBnum(bnum);
+	if (map == NULL) {
+		LOG_ERROR("Can't read free map block #%d\n", bnum);
+		return;
+	}
+
+	SetMapBit(map, bit, used);
+	SetDirty(block_cache, bnum);
+	JournalBlock(bnum);
+}
+
+/* Record an allocation or free in the on-disk free map */
+void NoteBlockUsed(int bnum, bool used) {
+	if (active) {
+		NoteUsed(bnum, used);
+	}
+}
+
+void NoteInodeUsed(int inum, bool used) {
+	if (active) {
+		NoteUsed(header.num_blocks + inum, used);
+	}
+}
+
+void NoteFragmentsUsed(int bnum, int frag, int count, bool used) {
+	if (!active) {
+		return;
+	}
+
+	int i;
+	for (i = frag; i < frag + count; ++i) {
+		NoteUsed(FragmentBit(bnum, i), used);
+	}
+}
+
+/*
+ * Free block #bnum on disk but keep it from being reused for now.  A
+ * block reused before the free commits would be lost if the server
+ * crashed, and one still in the journal could be overwritten by replay,
+ * so it is released at commit or at the next checkpoint respectively.
+ * Return false without a journal, where blocks are reused at once.
+ */
+bool DeferBlockFree(int bnum) {
+	if (!active) {
+		return false;
+	}
+
+	NoteBlockUsed(bnum, false);
+	Append(&group_frees, bnum);
+	return true;
+}
+
+/* DeferBlockFree for count blocks, looking up each free map block once */
+bool DeferBlockFrees(int* bnums, int count) {
+	if (!active) {
+		return false;
+	}
+
+	int map_bnum = 0;
+	unsigned char* map = NULL;
+	int i;
+	for (i = 0; i < count; ++i) {
+		int bnum = journal->map_start + bnums[i] / MAP_BITS_PER_BLOCK;
+		if (bnum != map_bnum) {
+			/* The blocks are already cut from their file, so the frees so far may commit */
+			SplitTransaction();
+
+			/* Journaling pins it, so map stays valid for the rest */
+			map_bnum = bnum;
+			map = (unsigned char*)GetBlockByBnum(bnum);
+			if (map == NULL) {
+				LOG_ERROR("Can't read free map block #%d\n", bnum);
+			} else {
+				SetDirty(block_cache, bnum);
+				JournalBlock(bnum);
+			}
+		}
+
+		if (map != NULL) {
+			SetMapBit(map, bnums[i], false);
+		}
+		Append(&group_frees, bnums[i]);
+	}
+
+	return true;
+}
+
+/* DeferBlockFree for the count fragments of tail pointer ptr */
+bool DeferFragmentFree(int ptr, int count) {
+	if (!active) {
+		return false;
+	}
+
+	NoteFragmentsUsed(TAIL_BLOCK(ptr), TAIL_FRAG(ptr), count, false);
+	Append(&group_frag_frees, ptr);
+	Append(&group_frag_frees, count);
+	return true;
+}
+
+/*
+ * Record in the header whether inodes wait for reclamation (see
+ * reclaim.h), so mounting scans for them only then.  It is written
+ * before the transaction queueing the first of them commits, and
+ * cleared only once the one freeing the last has.
+ */
+void NoteOrphans(bool pending) {
+	if (!active || ORPHANS_PENDING(&header) == pending) {
+		return;
+	}
+
+	if (!pending) {
+		CommitJournal();
+	}
+
+	ORPHANS_PENDING(&header) = pending;
+	WriteHeader();
+}
+
+/* Hold the reply to a transaction that changed the disk until it commits */
+bool DeferReply(Message* msg, int pid) {
+	if (!active || depth == 0 || !changed) {
+		return false;
+	}
+
+	if (num_replies == reply_cap) {
+		reply_cap = (reply_cap == 0) ? 16 : reply_cap * 2;
+		replies = (DeferredReply*)realloc(replies, reply_cap * sizeof(DeferredReply));
+	}
+
+	replies[num_replies].msg = *msg;
+	replies[num_replies].pid = pid;
+	++num_replies;
+	return true;
+}
+
+static void ReleaseReplies(void) {
+	int i;
+	for (i = 0; i < num_replies; ++i) {
+		Reply((void*)&replies[i].msg, replies[i].pid);
+	}
+
+	num_replies = 0;
+}
+
+/* Write the group's descriptors, block images and commit record at head */
+static int WriteGroup(void) {
+	struct journal_record* record = (struct journal_record*)malloc(BLOCKSIZE);
+	int pos = journal->start + head;
+	int status = 0;
+	int i = 0;
+
+	while (i < group_blocks.len && status == 0) {
+		memset(record, 0, BLOCKSIZE);
+		record->magic = JOURNAL_DESC_MAGIC;
+		record->seq = seq;
+		record->count = group_blocks.len - i;
+		if (record->count > JOURNAL_DESC_ENTRIES) {
+			record->count = JOURNAL_DESC_ENTRIES;
+		}
+		memcpy(record->bnums, group_blocks.items + i, record->count * sizeof(int));
+		status = WriteBlockSector(pos++, record);
+
+		int j;
+		for (j = 0; j < record->count && status == 0; ++j) {
+			void* block = PeekItemInCache(block_cache, record->bnums[j]);
+			if (block == NULL || WriteBlockSector(pos++, block) == ERROR) {
+				status = ERROR;
+			}
+		}
+
+		i += record->count;
+	}
+
+	if (status == 0) {
+		memset(record, 0, BLOCKSIZE);
+		record->magic = JOURNAL_COMMIT_MAGIC;
+		record->seq = seq;
+		record->count = group_blocks.len;
+		status = WriteBlockSector(pos, record);
+	}
+
+	free(record);
+	return status;
+}
+
+/* Drop the running group's pins, its blocks stay dirty in the cache */
+static void ClearGroup(void) {
+	int i;
+	for (i = 0; i < group_blocks.len; ++i) {
+		UnpinCacheItem(block_cache, group_blocks.items[i]);
+		RemoveItemFromHashTable(group_block_set, group_blocks.items[i]);
+		PutItemInHashTable(logged, group_blocks.items[i], (void*)journal);
+	}
+
+	group_blocks.len = 0;
+	group_transactions = 0;
+
+	/* A group bigger than the block cache pushed it past capacity */
+	TrimCaches();
+}
+
+/* Write everything home and start the journal over */
+static void Checkpoint(void) {
+	SyncInodeCache();
+	SyncBlockCache();
+
+	head = 0;
+	journal->seq = seq;
+	WriteHeader();
+
+	int i;
+	for (i = 0; i < checkpoint_frees.len; ++i) {
+		ReleaseBlock(checkpoint_frees.items[i]);
+	}
+	checkpoint_frees.len = 0;
+
+	for (i = 0; i < checkpoint_frag_frees.len; i += 2) {
+		ReleaseFragments(checkpoint_frag_frees.items[i], checkpoint_frag_frees.items[i + 1]);
+	}
+	checkpoint_frag_frees.len = 0;
+
+	DestroyHashTable(logged);
+	logged = InitHashTable(journal->blocks);
+}
+
+/*
+ * Make the running group durable: its inodes go into their inode blocks,
+ * and every block it changed is written to the journal with one commit
+ * record.  Only then are the waiting clients answered.
+ */
+void CommitJournal(void) {
+	if (!active || (group_blocks.len == 0 && group_inodes.len == 0)) {
+		return;
+	}
+
+	/* Inode blocks joining below don't make the caller's transaction a change */
+	bool was_changed = changed;
+	int i;
+	for (i = 0; i < group_inodes.len; ++i) {
+		int inum = group_inodes.items[i];
+		CacheNode* node = (CacheNode*)GetItemFromHashTable(inode_cache->table, inum);
+		void* block = GetBlockByInum(inum);
+		int bnum = GetBlockNumFromInodeNum(inum);
+		if (node != NULL && block != NULL) {
+			memcpy((struct inode*)block + inum % INODE_PER_BLOCK, node->value, sizeof(struct inode));
+			node->dirty = false;
+			SetDirty(block_cache, bnum);
+			JournalBlock(bnum);
+		}
+
+		UnpinCacheItem(inode_cache, inum);
+		RemoveItemFromHashTable(group_inode_set, inum);
+	}
+	group_inodes.len = 0;
+	changed = was_changed;
+
+	int length = GroupLength(group_blocks.len);
+	bool logged_group = (head + length <= journal->blocks);
+	if (logged_group && WriteGroup() == ERROR) {
+		LOG_ERROR("Journal write failed\n");
+		logged_group = false;
+	}
+
+	if (!logged_group) {
+		/* Too big for what is left of the journal: write it in place, not atomically */
+		LOG_ERROR("Group of %d blocks doesn't fit the journal, writing it in place\n", group_blocks.len);
+		for (i = 0; i < group_frees.len; ++i) {
+			Append(&checkpoint_frees, group_frees.items[i]);
+		}
+		group_frees.len = 0;
+		for (i = 0; i < group_frag_frees.len; ++i) {
+			Append(&checkpoint_frag_frees, group_frag_frees.items[i]);
+		}
+		group_frag_frees.len = 0;
+		ClearGroup();
+		++seq;
+		Checkpoint();
+		ReleaseReplies();
+		return;
+	}
+
+	/* Frees of blocks still in the journal wait for the checkpoint */
+	ClearGroup();
+	for (i = 0; i < group_frees.len; ++i) {
+		int bnum = group_frees.items[i];
+		if (GetItemFromHashTable(logged, bnum) != NULL) {
+			Append(&checkpoint_frees, bnum);
+		} else {
+			ReleaseBlock(bnum);
+		}
+	}
+	group_frees.len = 0;
+
+	for (i = 0; i < group_frag_frees.len; i += 2) {
+		int ptr = group_frag_frees.items[i];
+		int count = group_frag_frees.items[i + 1];
+		if (GetItemFromHashTable(logged, TAIL_BLOCK(ptr)) != NULL) {
+			Append(&checkpoint_frag_frees, ptr);
+			Append(&checkpoint_frag_frees, count);
+		} else {
+			ReleaseFragments(ptr, count);
+		}
+	}
+	group_frag_frees.len = 0;
+
+	head += length;
+	++seq;
+	if (length > longest_group) {
+		longest_group = length;
+	}
+
+	/* Keep room for another group, and reclaim held frees when space runs low */
+	if (journal->blocks - head < 2 * longest_group || checkpoint_frees.len > num_free_blocks) {
+		Checkpoint();
+	}
+
+	ReleaseReplies();
+}
+
+/* Whether the running group, grown by count more blocks, fits what is left of the journal */
+static bool GroupFits(int count) {
+	return head + GroupLength(group_blocks.len + group_inodes.len + count) <= journal->blocks;
+}
+
+/*
+ * Called by a long request between steps that each leave the disk
+ * consistent.  The group so far is committed once it passes a quarter
+ * of the journal or the next step might not fit what is left, and the
+ * journal checkpointed if even an empty group would not, so a request
+ * changing any number of blocks goes out as several groups each
+ * logged whole.
+ */
+void SplitTransaction(void) {
+	if (!active || depth == 0) {
+		return;
+	}
+
+	int entries = group_blocks.len + group_inodes.len;
+	if (entries > 0 && (GroupLength(entries) > journal->blocks / 4 || !GroupFits(STEP_BLOCKS))) {
+		CommitJournal();
+		changed = false;
+	}
+
+	if (group_blocks.len + group_inodes.len == 0 && !GroupFits(STEP_BLOCKS)) {
+		Checkpoint();
+	}
+}
+
+/* Make everything durable and home, as Sync and Shutdown promise */
+void SyncFileSystem(void) {
+	if (!active) {
+		SyncInodeCache();
+		SyncBlockCache();
+		return;
+	}
+
+	CommitJournal();
+	Checkpoint();
+}
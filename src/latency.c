@@ -0,0 +1,115 @@
+#include "../include/latency.h"
+#include "../include/yfstime.h"
+#include <stdio.h>
+
+/* Per request type: client send to server receive */
+static Histogram queue_hist[YFS_STATS_OPS];
+
+/* Per request type: start to finish of the handler */
+static Histogram service_hist[YFS_STATS_OPS];
+
+/* Per request type: part of the service time spent waiting for the disk */
+static Histogram disk_hist[YFS_STATS_OPS];
+
+/* Per request type: service time minus disk time */
+static Histogram cpu_hist[YFS_STATS_OPS];
+
+static RequestTiming* current_timing = NULL;
+
+static const char* op_names[YFS_STATS_OPS] = {
+    "none", "Open", "Create", "Read", "Write", "Seek", "Link", "Unlink",
+    "SymLink", "ReadLink", "MkDir", "RmDir", "ChDir", "Stat", "Sync",
+    "Shutdown", "DiskRead", "DiskDone", "Batch", "ReadDirPlus", "Close",
+    "PRead", "PWrite", "ReadV", "WriteV", "Stats", "Latency", "JournalTick",
+    "Truncate", "FTruncate", "ReclaimTick", "Rename"
+};
+
+void BeginRequestTiming(RequestTiming* timing, Message* msg) {
+    timing->type = (msg->type > 0 && msg->type < YFS_STATS_OPS) ? msg->type : 0;
+    timing->start = ReadTimeStamp();
+    timing->disk = 0;
+    timing->inum = 0;
+    timing->size = 0;
+
+    /* Clients stamp the low 32 bits of their counter on every message */
+    if (msg->send_time != 0) {
+        unsigned int delay = (unsigned int)timing->start - msg->send_time;
+        RecordValue(&queue_hist[timing->type], delay);
+    }
+}
+
+void EndRequestTiming(RequestTiming* timing) {
+    unsigned long long service = ReadTimeStamp() - timing->start;
+    timing->service = service;
+    unsigned long long disk = (timing->disk < service) ? timing->disk : service;
+
+    RecordValue(&service_hist[timing->type], service);
+    RecordValue(&disk_hist[timing->type], disk);
+    RecordValue(&cpu_hist[timing->type], service - disk);
+}
+
+/* Make timing the one disk waits are charged to, return the previous one */
+RequestTiming* SetRequestTiming(RequestTiming* timing) {
+    RequestTiming* prev = current_timing;
+    current_timing = timing;
+
+    return prev;
+}
+
+void AddDiskWait(unsigned long long cycles) {
+    if (current_timing != NULL) {
+        current_timing->disk += cycles;
+    }
+}
+
+void NoteRequestFile(int inum, int size) {
+    if (current_timing != NULL) {
+        current_timing->inum = inum;
+        current_timing->size = size;
+    }
+}
+
+const char* OpName(int type) {
+    if (type < 0 || type >= YFS_STATS_OPS || op_names[type] == NULL) {
+        return "?";
+    }
+
+    return op_names[type];
+}
+
+static void DumpHistogram(const char* name, Histogram* hist) {
+    if (hist->total == 0) {
+        return;
+    }
+
+    printf("    %-8s p50 %10llu  p99 %10llu  p99.9 %10llu  max %10llu  mean %10llu\n",
+        name, GetPercentile(hist, 50.0), GetPercentile(hist, 99.0),
+        GetPercentile(hist, 99.9), hist->max, hist->sum / hist->total);
+}
+
+void DumpLatency(void) {
+    printf("YFS request latency in cycles\n");
+
+    int i;
+    for (i = 0; i < YFS_STATS_OPS; ++i) {
+        if (service_hist[i].total == 0) {
+            continue;
+        }
+
+        printf("  %s (%u requests)\n", OpName(i), service_hist[i].total);
+        DumpHistogram("queue", &queue_hist[i]);
+        DumpHistogram("service", &service_hist[i]);
+        DumpHistogram("disk", &disk_hist[i]);
+        DumpHistogram("cpu", &cpu_hist[i]);
+    }
+}
+
+void ResetLatency(void) {
+    int i;
+    for (i = 0; i < YFS_STATS_OPS; ++i) {
+        ResetHistogram(&queue_hist[i]);
+        ResetHistogram(&service_hist[i]);
+        ResetHistogram(&disk_hist[i]);
+        ResetHistogram(&cpu_hist[i]);
+    }
+}
@@ -0,0 +1,745 @@
+#include "../include/openfile.h"
+#include "../include/coroutine.h"
+#include "../include/reclaim.h"
+#include "../include/journal.h"
+#include "../include/stats.h"
+#include "../include/log.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <comp421/yalnix.h>
+
+#define INITIAL_HANDLES 16
+
+/* inum -> OpenFile for every inode with at least one handle */
+static HashTable* open_files;
+
+static FileHandle** handles = NULL;
+
+/* Generation of each slot, see HANDLE_NUMBER */
+static int* generations = NULL;
+
+static int num_handles = 0;
+
+/* Stack of unused slots */
+static int* free_handles = NULL;
+
+static int num_free_handles = 0;
+
+void InitOpenFiles(void) {
+    open_files = InitHashTable(inode_cache->capacity);
+}
+
+static int AllocateHandle(void) {
+    if (num_free_handles == 0) {
+        int capacity = (num_handles == 0) ? INITIAL_HANDLES : num_handles * 2;
+        handles = (FileHandle**)realloc(handles, capacity * sizeof(FileHandle*));
+        generations = (int*)realloc(generations, capacity * sizeof(int));
+        free_handles = (int*)realloc(free_handles, capacity * sizeof(int));
+
+        int i;
+        for (i = capacity - 1; i >= num_handles; --i) {
+            handles[i] = NULL;
+            generations[i] = 0;
+            free_handles[num_free_handles++] = i;
+        }
+
+        num_handles = capacity;
+    }
+
+    return free_handles[--num_free_handles];
+}
+
+static bool HoldsHandle(FileHandle* file_handle, int pid) {
+    int i;
+    for (i = 0; i < file_handle->num_pids; ++i) {
+        if (file_handle->pids[i] == pid) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void AddHandleHolder(FileHandle* file_handle, int pid) {
+    file_handle->pids = (int*)realloc(file_handle->pids, (file_handle->num_pids + 1) * sizeof(int));
+    file_handle->pids[file_handle->num_pids++] = pid;
+}
+
+int OpenFileHandle(int inum, int pid) {
+    if (num_free_handles == 0 && num_handles == MAX_HANDLES) {
+        LOG_INFO("Handle table full\n");
+        return ERROR;
+    }
+
+    OpenFile* file = (OpenFile*)GetItemFromHashTable(open_files, inum);
+    if (file == NULL) {
+        struct inode* inode = GetInodeByInum(inum);
+        if (inode == NULL) {
+            return ERROR;
+        }
+
+        /* Another request may have opened it while this one was suspended */
+        file = (OpenFile*)GetItemFromHashTable(open_files, inum);
+    }
+
+    if (file == NULL) {
+        file = (OpenFile*)calloc(1, sizeof(OpenFile));
+        file->inum = inum;
+        file->inode = GetInodeByInum(inum);
+        file->map_len = -1;
+
+        PinCacheItem(inode_cache, inum);
+        PutItemInHashTable(open_files, inum, (void*)file);
+    }
+
+    ++file->refcount;
+
+    int slot = AllocateHandle();
+    FileHandle* file_handle = (FileHandle*)calloc(1, sizeof(FileHandle));
+    file_handle->file = file;
+    file_handle->pos = 0;
+    file_handle->number = HANDLE_NUMBER(slot, generations[slot]);
+    AddHandleHolder(file_handle, pid);
+    handles[slot] = file_handle;
+
+    return file_handle->number;
+}
+
+/*
+ * Drop pid's hold on the handle, and the handle with the last holder.  A
+ * forked child closing a handle it never used leaves the parent's alone.
+ */
+int CloseFileHandle(int handle, int pid) {
+    if (handle < 0 || HANDLE_SLOT(handle) >= num_handles) {
+        return ERROR;
+    }
+
+    int slot = HANDLE_SLOT(handle);
+    FileHandle* file_handle = handles[slot];
+    if (file_handle == NULL || file_handle->number != handle) {
+        return ERROR;
+    }
+
+    int i = 0;
+    while (i < file_handle->num_pids && file_handle->pids[i] != pid) {
+        ++i;
+    }
+    if (i == file_handle->num_pids) {
+        return 0;
+    }
+
+    file_handle->pids[i] = file_handle->pids[--file_handle->num_pids];
+    if (file_handle->num_pids > 0) {
+        return 0;
+    }
+
+    handles[slot] = NULL;
+    ++generations[slot];
+    free_handles[num_free_handles++] = slot;
+
+    /* A suspended read may still be using the handle */
+    OpenFile* file = file_handle->file;
+    free(file_handle->pids);
+    DeferFree(file_handle);
+
+    if (--file->refcount == 0) {
+        RemoveItemFromHashTable(open_files, file->inum);
+
+        /* Unlinked while open, see ReleaseInode */
+        if (file->inode->nlink == 0 && file->inode->type != INODE_FREE) {
+            ReleaseClosedInode(file->inum);
+        }
+
+        UnpinCacheItem(inode_cache, file->inum);
+        TrimCaches();
+        if (file->bmap != NULL) {
+            DeferFree(file->bmap);
+        }
+        for (i = 0; i < MAX_INDIRECT_LEVELS - 1; ++i) {
+            if (file->path_blocks[i] != NULL) {
+                DeferFree(file->path_blocks[i]);
+            }
+        }
+        DeferFree(file);
+    }
+
+    return 0;
+}
+
+bool IsFileOpen(int inum) {
+    return GetItemFromHashTable(open_files, inum) != NULL;
+}
+
+/* The handle, if it is still open; pid becomes a holder if it wasn't (a forked child) */
+FileHandle* GetFileHandle(int handle, int pid) {
+    if (handle < 0 || HANDLE_SLOT(handle) >= num_handles) {
+        return NULL;
+    }
+
+    FileHandle* file_handle = handles[HANDLE_SLOT(handle)];
+    if (file_handle == NULL || file_handle->number != handle) {
+        return NULL;
+    }
+
+    if (!HoldsHandle(file_handle, pid)) {
+        AddHandleHolder(file_handle, pid);
+    }
+
+    return file_handle;
+}
+
+static void AppendToBlockMap(OpenFile* file, int bnum) {
+    if (file->map_len == file->map_cap) {
+        file->map_cap = (file->map_cap == 0) ? NUM_DIRECT : file->map_cap * 2;
+        file->bmap = (int*)realloc(file->bmap, file->map_cap * sizeof(int));
+    }
+
+    file->bmap[file->map_len++] = bnum;
+}
+
+/* True if the blocks past the direct ones are more than one level down */
+static bool HasIndirectTree(struct inode* inode) {
+    return inode->indirect > 0 && INDIRECT_LEVELS(inode->indirect) > 1;
+}
+
+/* Decode the direct and single indirect block numbers of the file once, 0 for a hole */
+static int BuildBlockMap(OpenFile* file) {
+    struct inode* inode = file->inode;
+    bool single = inode->indirect > 0 && !HasIndirectTree(inode);
+
+    /* Fetch the indirect block first, this is the only step that may wait */
+    if (single && GetBlockByBnum(inode->indirect) == NULL) {
+        return ERROR;
+    }
+
+    DisableSuspend();
+    file->map_len = 0;
+    file->leaf_bnum = 0;
+    memset(file->path_bnums, 0, sizeof(file->path_bnums));
+
+    /* Holes are mapped too, up to the last block the file has */
+    int last = 0;
+    int i;
+    for (i = 0; i < NUM_DIRECT && !IS_INLINE(inode); ++i) {
+        AppendToBlockMap(file, inode->direct[i]);
+        if (inode->direct[i] != 0) {
+            last = file->map_len;
+        }
+    }
+
+    if (single) {
+        int* indirect_block = (int*)GetBlockByBnum(inode->indirect);
+        if (indirect_block == NULL) {
+            file->map_len = -1;
+            EnableSuspend();
+            return ERROR;
+        }
+
+        int j;
+        for (j = 0; j < BLOCKSIZE / sizeof(int); ++j) {
+            AppendToBlockMap(file, indirect_block[j]);
+            if (indirect_block[j] != 0) {
+                last = file->map_len;
+            }
+        }
+    }
+
+    file->map_len = last;
+    EnableSuspend();
+    return 0;
+}
+
+/* Block #index past the direct ones of a file with an indirect tree, 0 for a hole */
+static int GetBnumFromTree(OpenFile* file, int index) {
+    if (file->leaf_bnum != 0 && index >= file->leaf_first &&
+        index < file->leaf_first + PTRS_PER_BLOCK) {
+        CountMapLookup(true);
+        return GetBnumFromIndirectBlock(file->leaf_bnum, index - file->leaf_first);
+    }
+
+    CountMapLookup(false);
+
+    int indirect = file->inode->indirect;
+    int levels = INDIRECT_LEVELS(indirect);
+    if (levels > MAX_INDIRECT_LEVELS || index >= IndirectSpan(levels)) {
+        return 0;
+    }
+
+    /* Down the upper levels, copying a block only when the path moves to another */
+    int bnum = INDIRECT_BLOCK(indirect);
+    int depth;
+    for (depth = 0; depth < levels - 1; ++depth) {
+        if (file->path_bnums[depth] != bnum) {
+            int* block = (int*)GetBlockByBnum(bnum);
+            if (block == NULL) {
+                return ERROR;
+            }
+
+            if (file->path_blocks[depth] == NULL) {
+                file->path_blocks[depth] = (int*)malloc(BLOCKSIZE);
+            }
+            memcpy(file->path_blocks[depth], block, BLOCKSIZE);
+            file->path_bnums[depth] = bnum;
+        }
+
+        int span = IndirectSpan(levels - 1 - depth);
+        bnum = file->path_blocks[depth][index / span % PTRS_PER_BLOCK];
+        if (bnum == 0) {
+            return 0;
+        }
+    }
+
+    file->leaf_bnum = bnum;
+    file->leaf_first = index - index % PTRS_PER_BLOCK;
+    return GetBnumFromIndirectBlock(bnum, index % PTRS_PER_BLOCK);
+}
+
+/* Block number of block #block_index of the file, 0 if it is a hole */
+int GetBnumFromMap(OpenFile* file, int block_index) {
+    bool built = file->map_len >= 0;
+    if (!built && BuildBlockMap(file) == ERROR) {
+        return ERROR;
+    }
+
+    if (block_index < 0) {
+        return ERROR;
+    }
+
+    if (block_index >= NUM_DIRECT && HasIndirectTree(file->inode)) {
+        return GetBnumFromTree(file, block_index - NUM_DIRECT);
+    }
+
+    CountMapLookup(built);
+
+    if (block_index >= file->map_len) {
+        return 0;
+    }
+
+    return file->bmap[block_index];
+}
+
+/* Called by the allocator so open files never re-walk the inode */
+void UpdateBlockMap(int inum, int block_index, int bnum) {
+    OpenFile* file = (OpenFile*)GetItemFromHashTable(open_files, inum);
+    if (file == NULL || file->map_len < 0) {
+        return;
+    }
+
+    /* Found through the leaf, which already holds bnum */
+    if (block_index >= NUM_DIRECT && HasIndirectTree(file->inode)) {
+        return;
+    }
+
+    /* A block past the end leaves holes before it */
+    while (block_index > file->map_len) {
+        AppendToBlockMap(file, 0);
+    }
+
+    if (block_index == file->map_len) {
+        AppendToBlockMap(file, bnum);
+    } else {
+        file->bmap[block_index] = bnum;
+    }
+}
+
+void InvalidateBlockMap(int inum) {
+    OpenFile* file = (OpenFile*)GetItemFromHashTable(open_files, inum);
+    if (file != NULL) {
+        file->map_len = -1;
+    }
+}
+
+int ReadOpenFile(OpenFile* file, char* buf, int size, int pos) {
+    struct inode* inode = file->inode;
+    if (pos < 0 || size < 0) {
+        return ERROR;
+    }
+
+    if (pos >= inode->size) {
+        return 0;
+    }
+
+    if (size > inode->size - pos) {
+        size = inode->size - pos;
+    }
+
+    if (IS_INLINE(inode)) {
+        memcpy(buf, (char*)inode->direct + pos, size);
+        return size;
+    }
+
+    int len = 0;
+    while (len < size) {
+        int bnum = GetBnumFromMap(file, (pos + len) / BLOCKSIZE);
+        if (bnum == ERROR) {
+            return ERROR;
+        }
+
+        int offset = (pos + len) % BLOCKSIZE;
+        int chunk = BLOCKSIZE - offset;
+        if (chunk > size - len) {
+            chunk = size - len;
+        }
+
+        /* A hole reads as zeros without touching the disk */
+        if (bnum == 0) {
+            memset(buf + len, 0, chunk);
+            len += chunk;
+            continue;
+        }
+
+        char* block = IS_TAIL(bnum) ? GetTailData(bnum) : (char*)GetBlockByBnum(bnum);
+        if (block == NULL) {
+            return ERROR;
+        }
+
+        memcpy(buf + len, block + offset, chunk);
+        len += chunk;
+    }
+
+    return len;
+}
+
+/* A last block of a file size bytes long is kept as a tail if that saves space */
+static bool PacksTail(int size) {
+    return size % BLOCKSIZE != 0 && TAIL_FRAGS(size) < FRAGS_PER_BLOCK;
+}
+
+/* Current bytes of block #index of the file, zero filled, into buf */
+static int LoadTail(OpenFile* file, int index, char* buf) {
+    struct inode* inode = file->inode;
+    memset(buf, 0, BLOCKSIZE);
+    if (IS_INLINE(inode)) {
+        memcpy(buf, inode->direct, inode->size);
+        return 0;
+    }
+
+    int len = inode->size - index * BLOCKSIZE;
+    int ptr = GetBnumFromMap(file, index);
+    if (ptr == ERROR) {
+        return ERROR;
+    }
+
+    if (ptr == 0 || len <= 0) {
+        return 0;
+    }
+
+    char* data = IS_TAIL(ptr) ? GetTailData(ptr) : (char*)GetBlockByBnum(ptr);
+    if (data == NULL) {
+        return ERROR;
+    }
+
+    memcpy(buf, data, (len < BLOCKSIZE) ? len : BLOCKSIZE);
+    return 0;
+}
+
+/*
+ * Store buf as the tail at block #index of a file growing to new_size
+ * bytes: in the fragments it has when they still hold it or can grow in
+ * place, otherwise in new ones.
+ */
+static int StoreTail(OpenFile* file, int index, char* buf, int new_size) {
+    struct inode* inode = file->inode;
+    int count = TAIL_FRAGS(new_size);
+    int old = IS_INLINE(inode) ? 0 : GetBnumFromMap(file, index);
+    if (old == ERROR) {
+        return ERROR;
+    }
+
+    int old_count = IS_TAIL(old) ? TAIL_FRAGS(inode->size) : 0;
+
+    int ptr = old;
+    if (old_count == 0 || (count > old_count && GrowFragments(old, old_count, count) == ERROR)) {
+        ptr = AllocateFragments(count);
+        if (ptr == ERROR) {
+            return ERROR;
+        }
+    }
+
+    char* data = GetTailData(ptr);
+    if (data == NULL) {
+        return ERROR;
+    }
+
+    memcpy(data, buf, count * FRAGSIZE);
+    SetDirty(block_cache, TAIL_BLOCK(ptr));
+    if (ptr == old) {
+        return 0;
+    }
+
+    if (IS_INLINE(inode)) {
+        memset(inode->direct, 0, sizeof(inode->direct));
+        inode->indirect = 0;
+        InvalidateBlockMap(file->inum);
+    }
+
+    if (SetBlockPointer(inode, file->inum, index, ptr) == ERROR) {
+        RecycleFragments(ptr, count);
+        return ERROR;
+    }
+
+    if (old_count > 0) {
+        RecycleFragments(old, old_count);
+    } else if (old != 0) {
+        RecycleFreeBlock(old);
+    }
+
+    return 0;
+}
+
+/* Move the tail at block #index of the file into a whole block, as the file grows past it */
+static int UnpackTail(OpenFile* file, int index, int ptr) {
+    struct inode* inode = file->inode;
+    char* tail = GetTailData(ptr);
+    if (tail == NULL) {
+        return ERROR;
+    }
+
+    int bnum = FindFreeBlock();
+    if (bnum == ERROR) {
+        return ERROR;
+    }
+
+    char* block = (char*)GetNewBlock(bnum);
+    memcpy(block, tail, TAIL_LENGTH(inode->size));
+    if (SetBlockPointer(inode, file->inum, index, bnum) == ERROR) {
+        RecycleFreeBlock(bnum);
+        return ERROR;
+    }
+
+    RecycleFragments(ptr, TAIL_FRAGS(inode->size));
+    return bnum;
+}
+
+int WriteOpenFile(OpenFile* file, char* buf, int size, int pos) {
+    struct inode* inode = file->inode;
+    if (inode->type == INODE_DIRECTORY || pos < 0 || size < 0) {
+        return ERROR;
+    }
+
+    /* Nothing written, so a position past the end does not grow the file */
+    if (size == 0) {
+        return 0;
+    }
+
+    /* A partial last block the write reaches is built in tail and stored at the end */
+    int new_size = (pos + size > inode->size) ? pos + size : inode->size;
+    int tail_index = ERROR;
+    if (PacksTail(new_size) && pos + size > (new_size - 1) / BLOCKSIZE * BLOCKSIZE) {
+        tail_index = (new_size - 1) / BLOCKSIZE;
+    }
+
+    /* Stay in the inode while the data fits, otherwise move it out first */
+    if (IS_INLINE(inode)) {
+        if (pos + size <= INLINE_SIZE) {
+            if (pos > inode->size) {
+                memset((char*)inode->direct + inode->size, 0, pos - inode->size);
+            }
+            memcpy((char*)inode->direct + pos, buf, size);
+            if (pos + size > inode->size) {
+                inode->size = pos + size;
+            }
+            SetDirty(inode_cache, file->inum);
+            return size;
+        }
+
+        if (tail_index != 0 && SpillInlineData(inode, file->inum) == ERROR) {
+            return ERROR;
+        }
+    }
+
+    /*
+     * A write starting past the block holding the end of the file leaves
+     * a hole, so a tail there is no longer the last block and is moved
+     * into a whole one first.
+     */
+    if (!IS_INLINE(inode) && inode->size > 0 && pos / BLOCKSIZE > (inode->size - 1) / BLOCKSIZE) {
+        int last = (inode->size - 1) / BLOCKSIZE;
+        int ptr = GetBnumFromMap(file, last);
+        if (ptr == ERROR || (IS_TAIL(ptr) && UnpackTail(file, last, ptr) == ERROR)) {
+            return ERROR;
+        }
+    }
+
+    /* On the heap, a block may be bigger than is safe on a coroutine stack */
+    char* tail = NULL;
+    if (tail_index != ERROR) {
+        tail = (char*)malloc(BLOCKSIZE);
+        if (LoadTail(file, tail_index, tail) == ERROR) {
+            free(tail);
+            return ERROR;
+        }
+    }
+
+    int len = 0;
+    while (len < size) {
+        int index = (pos + len) / BLOCKSIZE;
+        int offset = (pos + len) % BLOCKSIZE;
+        int chunk = BLOCKSIZE - offset;
+        if (chunk > size - len) {
+            chunk = size - len;
+        }
+
+        /* The file is whole up to here, so a long write may commit what it has done */
+        if (len > 0) {
+            SplitTransaction();
+        }
+
+        if (index == tail_index) {
+            memcpy(tail + offset, buf + len, chunk);
+            len += chunk;
+            continue;
+        }
+
+        char* block;
+        int bnum = GetBnumFromMap(file, index);
+        if (bnum == ERROR) {
+            break;
+        } else if (bnum == 0) {
+            /* Map only the block written, whatever lies before it stays a hole */
+            bnum = FindFreeBlock();
+            if (bnum == ERROR) {
+                break;
+            }
+
+            block = (char*)GetNewBlock(bnum);
+            if (SetBlockPointer(inode, file->inum, index, bnum) == ERROR) {
+                RecycleFreeBlock(bnum);
+                break;
+            }
+        } else if (IS_TAIL(bnum)) {
+            bnum = UnpackTail(file, index, bnum);
+            block = (bnum == ERROR) ? NULL : (char*)GetBlockByBnum(bnum);
+        } else if (chunk == BLOCKSIZE) {
+            /* The whole block is overwritten, so skip reading it */
+            block = (char*)GetNewBlock(bnum);
+        } else {
+            block = (char*)GetBlockByBnum(bnum);
+        }
+
+        if (block == NULL) {
+            break;
+        }
+
+        memcpy(block + offset, buf + len, chunk);
+        SetDirty(block_cache, bnum);
+        len += chunk;
+        if (pos + len > inode->size) {
+            inode->size = pos + len;
+            SetDirty(inode_cache, file->inum);
+        }
+    }
+
+    /* Without room for the tail only the blocks before it were written */
+    if (tail_index != ERROR && len == size && StoreTail(file, tail_index, tail, new_size) == ERROR) {
+        len = tail_index * BLOCKSIZE - pos;
+        if (len < 0) {
+            len = 0;
+        }
+    }
+    free(tail);
+
+    if (len > 0 && pos + len > inode->size) {
+        inode->size = pos + len;
+        SetDirty(inode_cache, file->inum);
+    }
+
+    if (len == 0) {
+        return ERROR;
+    }
+
+    return len;
+}
+
+/*
+ * Zero the bytes past length in the block that now ends the file, so
+ * growing it again reads zeros there, and keep only the fragments a
+ * tail still needs, or pack a whole block into a tail as a write would.
+ */
+static int TrimLastBlock(OpenFile* file, int length) {
+    struct inode* inode = file->inode;
+    int index = (length - 1) / BLOCKSIZE;
+    int offset = TAIL_LENGTH(length);
+    int ptr = GetBnumFromMap(file, index);
+    if (ptr == ERROR) {
+        return ERROR;
+    }
+
+    if (ptr == 0) {
+        return 0;
+    }
+
+    if (IS_TAIL(ptr)) {
+        char* data = GetTailData(ptr);
+        if (data == NULL) {
+            return ERROR;
+        }
+
+        int count = TAIL_FRAGS(length);
+        int old_count = TAIL_FRAGS(inode->size);
+        memset(data + offset, 0, count * FRAGSIZE - offset);
+        SetDirty(block_cache, TAIL_BLOCK(ptr));
+        if (count < old_count) {
+            RecycleFragments(TAIL_POINTER(TAIL_BLOCK(ptr), TAIL_FRAG(ptr) + count), old_count - count);
+        }
+        return 0;
+    }
+
+    char* block = (char*)GetBlockByBnum(ptr);
+    if (block == NULL) {
+        return ERROR;
+    }
+
+    memset(block + offset, 0, BLOCKSIZE - offset);
+    SetDirty(block_cache, ptr);
+
+    /* Without fragments to spare the zeroed block just stays */
+    if (PacksTail(length)) {
+        char* tail = (char*)malloc(BLOCKSIZE);
+        memcpy(tail, block, BLOCKSIZE);
+        StoreTail(file, index, tail, length);
+        free(tail);
+    }
+
+    return 0;
+}
+
+/*
+ * Cut the file to length bytes, freeing only the blocks past that, or
+ * grow it to length with a hole before the new last byte.
+ */
+int TruncateOpenFile(OpenFile* file, int length) {
+    struct inode* inode = file->inode;
+    if (inode->type != INODE_REGULAR || length < 0) {
+        return ERROR;
+    }
+
+    if (length >= inode->size) {
+        char zero = 0;
+        if (length == inode->size || WriteOpenFile(file, &zero, 1, length - 1) == 1) {
+            return 0;
+        }
+        return ERROR;
+    }
+
+    if (length == 0) {
+        return RecycleBlocksInInode(file->inum);
+    }
+
+    if (IS_INLINE(inode)) {
+        memset((char*)inode->direct + length, 0, inode->size - length);
+    } else {
+        if (TruncateBlocks(inode, file->inum, (length + BLOCKSIZE - 1) / BLOCKSIZE) == ERROR) {
+            return ERROR;
+        }
+
+        if (TrimLastBlock(file, length) == ERROR) {
+            return ERROR;
+        }
+    }
+
+    inode->size = length;
+    SetDirty(inode_cache, file->inum);
+    return 0;
+}
@@ -0,0 +1,264 @@
+#include "../include/reclaim.h"
+#include "../include/journal.h"
+#include "../include/openfile.h"
+#include "../include/log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <comp421/yalnix.h>
+
+/* Inodes waiting for their blocks to be freed, oldest first from queue_head */
+static int* queue = NULL;
+static int queue_head = 0;
+static int queue_len = 0;
+static int queue_cap = 0;
+
+/* Inodes with nlink 0 still open, queued when their last handle closes */
+static int open_orphans = 0;
+
+static int helper_pid = ERROR;
+
+/* The helper has a tick on its way back */
+static bool ticking = false;
+
+/* Slice helper: hand every tick straight back, behind the requests already queued */
+static void RunReclaimHelper(void) {
+	Message msg;
+
+	while (1) {
+		int pid = Receive((void*)&msg);
+		if (pid == ERROR || msg.type != RECLAIM_TICK) {
+			continue;
+		}
+
+		Reply((void*)&msg, pid);
+
+		msg.type = RECLAIM_TICK;
+		Send((void*)&msg, -FILE_SERVER);
+	}
+}
+
+int PendingReclaims(void) {
+	return queue_len - queue_head;
+}
+
+static void StartTicking(void) {
+	if (helper_pid == ERROR || ticking || PendingReclaims() == 0) {
+		return;
+	}
+
+	Message msg;
+	memset(&msg, 0, sizeof(Message));
+	msg.type = RECLAIM_TICK;
+	ticking = true;
+	Send((void*)&msg, helper_pid);
+}
+
+/* Without the helper a slice runs after every request instead */
+void InitReclaimHelper(void) {
+	int pid = Fork();
+	if (pid == 0) {
+		RunReclaimHelper();
+		Exit(0);
+	}
+
+	if (pid == ERROR) {
+		LOG_ERROR("Can't fork reclaim helper, reclaiming between requests\n");
+		return;
+	}
+
+	helper_pid = pid;
+
+	/* Start on the orphans mounting found */
+	StartTicking();
+}
+
+void QueueOrphan(int inum) {
+	if (queue_head > 0 && queue_head == queue_len) {
+		queue_head = 0;
+		queue_len = 0;
+	}
+
+	if (queue_len == queue_cap) {
+		queue_cap = (queue_cap == 0) ? 16 : queue_cap * 2;
+		queue = (int*)realloc(queue, queue_cap * sizeof(int));
+	}
+
+	queue[queue_len++] = inum;
+}
+
+/*
+ * Free an inode whose last name is gone: now if it is small, otherwise
+ * in slices.  An open one is left as it is until its last handle closes.
+ */
+void ReleaseInode(int inum) {
+	struct inode* inode = GetInodeByInum(inum);
+	if (inode == NULL) {
+		return;
+	}
+
+	if (IsFileOpen(inum)) {
+		++open_orphans;
+		NoteOrphans(true);
+		return;
+	}
+
+	if (inode->indirect <= 0) {
+		RecycleBlocksInInode(inum);
+		RecycleFreeInode(inum);
+		return;
+	}
+
+	QueueOrphan(inum);
+	NoteOrphans(true);
+	StartTicking();
+}
+
+/* The last handle on inode inum, which has no name left, just closed */
+void ReleaseClosedInode(int inum) {
+	if (open_orphans > 0) {
+		--open_orphans;
+	}
+
+	QueueOrphan(inum);
+	NoteOrphans(true);
+	StartTicking();
+}
+
+/*
+ * Block index of the first block the last bottom level indirect block
+ * of the inode lists, past its direct blocks, or ERROR.  Freeing from
+ * there frees that indirect block and at most PTRS_PER_BLOCK others.
+ */
+static int LastLeafStart(struct inode* inode) {
+	int bnum = INDIRECT_BLOCK(inode->indirect);
+	int levels = INDIRECT_LEVELS(inode->indirect);
+	if (levels > MAX_INDIRECT_LEVELS) {
+		return ERROR;
+	}
+
+	int first = 0;
+	for (; levels > 1; --levels) {
+		if (bnum < 1 || bnum > header.num_blocks) {
+			return ERROR;
+		}
+
+		int* block = (int*)GetBlockByBnum(bnum);
+		if (block == NULL) {
+			return ERROR;
+		}
+
+		int i = PTRS_PER_BLOCK - 1;
+		while (i > 0 && block[i] == 0) {
+			--i;
+		}
+
+		/* An empty block goes as a whole */
+		if (block[i] == 0) {
+			break;
+		}
+
+		first += i * IndirectSpan(levels - 1);
+		bnum = block[i];
+	}
+
+	return NUM_DIRECT + first;
+}
+
+/* Free the last bottom level indirect block's worth of the oldest queued inode, or all of a small one */
+static void ReclaimSlice(void) {
+	if (queue_head == queue_len) {
+		return;
+	}
+
+	int inum = queue[queue_head];
+	struct inode* inode = GetInodeByInum(inum);
+	if (inode == NULL) {
+		LOG_ERROR("Can't get inode #%d to reclaim\n", inum);
+		++queue_head;
+		return;
+	}
+
+	/* Opened by number since it was queued, it comes back when closed */
+	if (IsFileOpen(inum)) {
+		++open_orphans;
+		++queue_head;
+		return;
+	}
+
+	BeginTransaction();
+	int keep = (inode->indirect > 0) ? LastLeafStart(inode) : 0;
+	if (keep > 0 && TruncateBlocks(inode, inum, keep) == 0) {
+		if (inode->size > keep * BLOCKSIZE) {
+			inode->size = keep * BLOCKSIZE;
+		}
+		SetDirty(inode_cache, inum);
+	} else {
+		/* Done down to the direct blocks, or the tree is unreadable */
+		RecycleBlocksInInode(inum);
+		RecycleFreeInode(inum);
+		++queue_head;
+	}
+	EndTransaction();
+
+	if (queue_head == queue_len && open_orphans == 0) {
+		NoteOrphans(false);
+	}
+}
+
+void CompleteReclaimTick(Message* msg, int pid) {
+	Reply((void*)msg, pid);
+	if (pid != helper_pid) {
+		LOG_ERROR("ERROR : Reclaim tick from unknown process %d\n", pid);
+		return;
+	}
+
+	ticking = false;
+	ReclaimSlice();
+	StartTicking();
+}
+
+void ReclaimBetweenRequests(void) {
+	if (helper_pid == ERROR) {
+		ReclaimSlice();
+	}
+}
+
+/* Free everything still queued, before the server goes away */
+void FinishReclaim(void) {
+	while (queue_head < queue_len) {
+		ReclaimSlice();
+		/* Shutdown is itself a transaction, so each slice commits here on its own */
+		CommitJournal();
+	}
+}
+
+/*
+ * Queue the inodes with nlink 0 a crash left behind, on a disk whose
+ * journal header says there are some.  The disk without a journal
+ * finds them in the scan it does anyway.
+ */
+int FindOrphans(void) {
+	if (!ORPHANS_PENDING(&header)) {
+		return 0;
+	}
+
+	int inum;
+	for (inum = ROOTINODE + 1; inum <= header.num_inodes; ++inum) {
+		struct inode* inode = GetInodeByInum(inum);
+		if (inode == NULL) {
+			LOG_ERROR("Can't get inode #%d\n", inum);
+			return ERROR;
+		}
+
+		if (inode->type != INODE_FREE && inode->nlink == 0) {
+			QueueOrphan(inum);
+		}
+	}
+
+	LOG_INFO("%d inodes to reclaim\n", PendingReclaims());
+	if (PendingReclaims() == 0) {
+		NoteOrphans(false);
+	}
+
+	return 0;
+}
@@ -0,0 +1,122 @@
+#include "../include/record.h"
+#include <stdlib.h>
+#include <string.h>
+#include <comp421/yalnix.h>
+#include <comp421/hardware.h>
+
+int RecordPathCount(int type) {
+    switch (type) {
+        case LINK:
+        case SYMLINK:
+        case RENAME:
+            return 2;
+        case OPEN:
+        case CREATE:
+        case UNLINK:
+        case READLINK:
+        case MKDIR:
+        case RMDIR:
+        case CHDIR:
+        case STAT:
+        case TRUNCATE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+#ifdef YFS_RECORD
+
+static char* record_buf = NULL;
+
+static int record_len = 0;
+
+static int record_cap = 0;
+
+/* Copy the request's pathnames before the handler overwrites the message */
+void CopyRecordPaths(Message* msg, int pid, char* path, char* path2) {
+    int count = RecordPathCount(msg->type);
+    path[0] = '\0';
+    path2[0] = '\0';
+
+    if (count >= 1 && YfsCopyFrom(pid, (void*)path, msg->addr1, MAXPATHNAMELEN) == ERROR) {
+        path[0] = '\0';
+    }
+
+    if (count >= 2 && YfsCopyFrom(pid, (void*)path2, msg->addr2, MAXPATHNAMELEN) == ERROR) {
+        path2[0] = '\0';
+    }
+}
+
+static int PathLength(char* path) {
+    int len = 0;
+    while (len < MAXPATHNAMELEN && path[len] != '\0') {
+        ++len;
+    }
+
+    return len;
+}
+
+void RecordRequest(Message* request, Message* reply, int pid, RequestTiming* timing,
+    char* path, char* path2) {
+    RecordHeader header;
+    memset(&header, 0, sizeof(RecordHeader));
+    header.time_lo = (unsigned int)timing->start;
+    header.time_hi = (unsigned int)(timing->start >> 32);
+    header.service = (timing->service > 0xffffffffULL) ? 0xffffffffU : (unsigned int)timing->service;
+    header.type = (short)request->type;
+    header.path_len = (short)PathLength(path);
+    header.path2_len = (short)PathLength(path2);
+    header.pid = pid;
+    header.data1 = request->data1;
+    header.data2 = request->data2;
+    header.data3 = request->data3;
+    header.reply_type = reply->type;
+    header.reply_data1 = reply->data1;
+    header.reply_data2 = reply->data2;
+    header.inum = timing->inum;
+    header.size = timing->size;
+
+    int len = sizeof(RecordHeader) + header.path_len + header.path2_len;
+    if (record_len + len > record_cap) {
+        record_cap = (record_cap == 0) ? RECORD_FLUSH_SIZE * 2 : record_cap * 2;
+        record_buf = (char*)realloc(record_buf, record_cap);
+    }
+
+    char* record = record_buf + record_len;
+    memcpy(record, &header, sizeof(RecordHeader));
+    memcpy(record + sizeof(RecordHeader), path, header.path_len);
+    memcpy(record + sizeof(RecordHeader) + header.path_len, path2, header.path2_len);
+    record_len += len;
+
+    if (record_len >= RECORD_FLUSH_SIZE) {
+        FlushRecords();
+    }
+}
+
+/* Write every buffered record to the TRACE file, one line each */
+void FlushRecords(void) {
+    static const char digits[] = "0123456789abcdef";
+    char line[2 * (sizeof(RecordHeader) + 2 * MAXPATHNAMELEN) + 1];
+
+    int offset = 0;
+    while (offset < record_len) {
+        RecordHeader* header = (RecordHeader*)(record_buf + offset);
+        int len = sizeof(RecordHeader) + header->path_len + header->path2_len;
+
+        int i;
+        for (i = 0; i < len; ++i) {
+            unsigned char byte = (unsigned char)record_buf[offset + i];
+            line[2 * i] = digits[byte >> 4];
+            line[2 * i + 1] = digits[byte & 0xf];
+        }
+        line[2 * len] = '\0';
+
+        TracePrintf(RECORD_TRACE_LEVEL, "%s %s\n", RECORD_TAG, line);
+        offset += len;
+    }
+
+    record_len = 0;
+}
+
+#endif
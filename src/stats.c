@@ -0,0 +1,90 @@
+#include "../include/stats.h"
+#include <string.h>
+
+/*
+ * Request type that sector I/O is charged to.  Slot 0 collects I/O done
+ * outside any request, such as mounting.
+ */
+static int current_op = 0;
+
+static unsigned int requests[YFS_STATS_OPS];
+
+static unsigned int sectors_read[YFS_STATS_OPS];
+
+static unsigned int sectors_written[YFS_STATS_OPS];
+
+static unsigned int map_hits;
+
+static unsigned int map_misses;
+
+/* Charge following sector I/O to request type, return the previous one */
+int SetStatsOp(int type) {
+    int prev = current_op;
+    current_op = (type > 0 && type < YFS_STATS_OPS) ? type : 0;
+
+    return prev;
+}
+
+int GetStatsOp(void) {
+    return current_op;
+}
+
+void CountRequest(int type) {
+    if (type > 0 && type < YFS_STATS_OPS) {
+        ++requests[type];
+    }
+}
+
+void CountSectorRead(void) {
+    ++sectors_read[current_op];
+}
+
+void CountSectorWrite(void) {
+    ++sectors_written[current_op];
+}
+
+void CountMapLookup(bool hit) {
+    if (hit) {
+        ++map_hits;
+    } else {
+        ++map_misses;
+    }
+}
+
+static void FillCacheStats(struct CacheStats* stats, Cache* cache) {
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    stats->evictions = cache->evictions;
+    stats->dirty_evictions = cache->dirty_evictions;
+}
+
+static void ResetCacheStats(Cache* cache) {
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->evictions = 0;
+    cache->dirty_evictions = 0;
+}
+
+void FillStats(struct YfsStats* stats) {
+    memset(stats, 0, sizeof(struct YfsStats));
+    stats->version = YFS_STATS_VERSION;
+    stats->size = sizeof(struct YfsStats);
+
+    FillCacheStats(&stats->block_cache, block_cache);
+    FillCacheStats(&stats->inode_cache, inode_cache);
+    memcpy(stats->requests, requests, sizeof(requests));
+    memcpy(stats->sectors_read, sectors_read, sizeof(sectors_read));
+    memcpy(stats->sectors_written, sectors_written, sizeof(sectors_written));
+    stats->map_hits = map_hits;
+    stats->map_misses = map_misses;
+}
+
+void ResetStats(void) {
+    ResetCacheStats(block_cache);
+    ResetCacheStats(inode_cache);
+    memset(requests, 0, sizeof(requests));
+    memset(sectors_read, 0, sizeof(sectors_read));
+    memset(sectors_written, 0, sizeof(sectors_written));
+    map_hits = 0;
+    map_misses = 0;
+}
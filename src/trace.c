@@ -0,0 +1,41 @@
+#include "../include/trace.h"
+
+#ifdef YFS_TRACE
+
+#include "../include/yfstime.h"
+#include <stdio.h>
+
+static TraceRecord ring[TRACE_RING_SIZE];
+
+/* Number of requests ever recorded, the ring keeps the newest */
+static unsigned int num_records = 0;
+
+void TraceRequest(int type, int status, int inum, int size, unsigned long long latency) {
+    TraceRecord* record = ring + (num_records++ % TRACE_RING_SIZE);
+    record->time = (unsigned int)ReadTimeStamp();
+    record->type = (short)type;
+    record->status = (short)status;
+    record->inum = inum;
+    record->size = size;
+    record->latency = (latency > 0xffffffffULL) ? 0xffffffffU : (unsigned int)latency;
+}
+
+/* Print the ring oldest first */
+void DumpTrace(void) {
+    unsigned int first = 0;
+    if (num_records > TRACE_RING_SIZE) {
+        first = num_records - TRACE_RING_SIZE;
+    }
+
+    printf("YFS trace: last %u of %u requests\n", num_records - first, num_records);
+    printf("%10s %4s %6s %8s %10s %10s\n", "time", "type", "status", "inum", "size", "cycles");
+
+    unsigned int i;
+    for (i = first; i < num_records; ++i) {
+        TraceRecord* record = ring + (i % TRACE_RING_SIZE);
+        printf("%10u %4d %6d %8d %10d %10u\n", record->time, record->type,
+            record->status, record->inum, record->size, record->latency);
+    }
+}
+
+#endif
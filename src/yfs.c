@@ -1,102 +1,423 @@
 #include "../include/yfs.h"
+#include "../include/coroutine.h"
+#include "../include/diskio.h"
+#include "../include/openfile.h"
+#include "../include/stats.h"
+#include "../include/latency.h"
+#include "../include/yfstime.h"
+#include "../include/log.h"
+#include "../include/trace.h"
+#include "../include/record.h"
+#include "../include/config.h"
+#include "../include/journal.h"
+#include "../include/reclaim.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <limits.h>
 #include <comp421/yalnix.h>
 #include <comp421/hardware.h>
 
+struct fs_header header;
+
+int block_shift = 0;
+
+BatchContext* current_batch;
+
+Cache* inode_cache;
+
+Cache* block_cache;
+
+bool* free_inodes;
+
+int num_free_inodes;
+
+bool* free_blocks;
+
+int num_free_blocks;
+
+unsigned int* frag_maps;
+
+/* Fragments freed but not reusable until the free commits */
+static unsigned int* frag_pending;
+
+/* Block fragments were last allocated from, tried first next time */
+static int frag_hint = 0;
+
+/* Host tools such as yfsreplay link the server without its main loop */
+#ifndef YFS_HOST
+/*
+ * Usage: yfs [-b blocks] [-i inodes] [-m kb] [-s inode_percent]
+ *	[-J journal_blocks] [-G group] program [args]
+ */
 int main(int argc, char* argv[]) {
-	if (InitFileSystem() == ERROR) {
+	CacheConfig config;
+	InitCacheConfig(&config);
+	JournalConfig journal_config;
+	InitJournalConfig(&journal_config);
+
+	int arg = 1;
+	while (arg + 1 < argc && argv[arg][0] == '-' &&
+		(ParseCacheOption(&config, argv[arg], argv[arg + 1]) ||
+		ParseJournalOption(&journal_config, argv[arg], argv[arg + 1]))) {
+		arg += 2;
+	}
+
+	if (InitFileSystem(&config, &journal_config) == ERROR) {
 		return ERROR;
 	}
 
 	if (Register(FILE_SERVER) == ERROR) {
-		printf("ERROR : Cannot register yfs as file server!\n");
+		LOG_ERROR("ERROR : Cannot register yfs as file server!\n");
 		return ERROR;
 	}
 
-	if(Fork() == 0) {
-		Exec(argv[1], argv + 1);
+	InitCoroutines();
+	InitDiskHelpers();
+	InitJournalHelper();
+	InitReclaimHelper();
+	InitOpenFiles();
+
+	if(arg < argc && Fork() == 0) {
+		Exec(argv[arg], argv + arg);
 	}
 
 	while(1){
 		 Message* msg = (Message*)calloc(1, sizeof(Message));
 		 int pid = Receive((void*)msg);
 
-		 switch(msg->type){
-		 	case OPEN: 
-		 		YfsOpen(msg, pid);
-		 		break;
-		 	case CREATE :
-		 		YfsCreate(msg, pid);
-		 		break;
-		 	case READ:
-		 		YfsRead(msg, pid);
-		 		break;
-		 	case WRITE:
-		 		YfsWrite(msg, pid);
-		 		break;
-		 	case SEEK:
-		 		YfsSeek(msg, pid);
-		 		break;
-		 	case UNLINK:
-		 		YfsUnlink(msg, pid);
-		 		break;
-		 	case SYMLINK:
-		 		YfsSymLink(msg, pid);
-		 		break;
-		 	case READLINK:
-		 		YfsReadLink(msg, pid);
-		 		break;
-		 	case MKDIR:
-		 		YfsMkDir(msg, pid);
-		 		break;
-		 	case RMDIR:
-		 		YfsRmDir(msg, pid);
-		 		break;
-		 	case CHDIR:
-		 		YfsChDir(msg, pid);
-		 		break;
-		 	case STAT:
-		 		YfsStat(msg, pid);
-		 		break;
-		 	case SYNC:
-		 		YfsSync(msg, pid);
-		 		break;
-		 	case SHUTDOWN:
-		 		YfsShutDown(msg, pid);
-		 		break;
-		 	default :
-		 		printf("ERROR : Invalid message type!\n");
-		 		break;
+		 /* A disk helper finished a read, resume whoever waits on it */
+		 if (msg->type == DISK_DONE) {
+		 	CompleteDiskRead(msg, pid);
+		 	free(msg);
+		 	continue;
 		 }
 
+		 /* Time for a partial group to commit */
+		 if (msg->type == JOURNAL_TICK) {
+		 	CompleteJournalTick(msg, pid);
+		 	free(msg);
+		 	continue;
+		 }
+
+		 /* Time to free another slice of an unlinked file */
+		 if (msg->type == RECLAIM_TICK) {
+		 	CompleteReclaimTick(msg, pid);
+		 	free(msg);
+		 	continue;
+		 }
+
+		 /* The coroutine owns msg from here on and frees it when done */
+		 if (IsSuspendableRequest(msg->type) && SpawnCoroutine(msg, pid)) {
+		 	continue;
+		 }
+
+		 DispatchMessage(msg, pid);
 		 free(msg);
+		 ReclaimDeferred();
+		 ReclaimBetweenRequests();
 	}
 
 	return 0;
 }
+#endif
+
+void DispatchMessage(Message* msg, int pid) {
+	int prev_op = SetStatsOp(msg->type);
+	CountRequest(msg->type);
+
+	RequestTiming timing;
+	BeginRequestTiming(&timing, msg);
+	RequestTiming* prev_timing = SetRequestTiming(&timing);
+
+#ifdef YFS_RECORD
+	Message request = *msg;
+	char path[MAXPATHNAMELEN];
+	char path2[MAXPATHNAMELEN];
+	CopyRecordPaths(msg, pid, path, path2);
+#endif
+
+	/* Requests that may suspend only read, the rest are transactions */
+	bool transaction = !IsSuspendableRequest(msg->type);
+	if (transaction) {
+		BeginTransaction();
+	}
 
-int InitFileSystem() {
-	/* Init cache */
-	inode_cache = InitCache(INODE_CACHESIZE);
-	block_cache = InitCache(BLOCK_CACHESIZE);
+	switch(msg->type){
+		case OPEN: 
+			YfsOpen(msg, pid);
+			break;
+		case CREATE :
+			YfsCreate(msg, pid);
+			break;
+		case READ:
+			YfsRead(msg, pid);
+			break;
+		case WRITE:
+			YfsWrite(msg, pid);
+			break;
+		case SEEK:
+			YfsSeek(msg, pid);
+			break;
+		case LINK:
+			YfsLink(msg, pid);
+			break;
+		case UNLINK:
+			YfsUnlink(msg, pid);
+			break;
+		case SYMLINK:
+			YfsSymLink(msg, pid);
+			break;
+		case READLINK:
+			YfsReadLink(msg, pid);
+			break;
+		case MKDIR:
+			YfsMkDir(msg, pid);
+			break;
+		case RMDIR:
+			YfsRmDir(msg, pid);
+			break;
+		case CHDIR:
+			YfsChDir(msg, pid);
+			break;
+		case STAT:
+			YfsStat(msg, pid);
+			break;
+		case SYNC:
+			YfsSync(msg, pid);
+			break;
+		case SHUTDOWN:
+			YfsShutDown(msg, pid);
+			break;
+		case CLOSE:
+			YfsClose(msg, pid);
+			break;
+		case PREAD:
+			YfsPRead(msg, pid);
+			break;
+		case PWRITE:
+			YfsPWrite(msg, pid);
+			break;
+		case READV:
+			YfsReadV(msg, pid);
+			break;
+		case WRITEV:
+			YfsWriteV(msg, pid);
+			break;
+		case STATS:
+			YfsStats(msg, pid);
+			break;
+		case BATCH:
+			YfsBatch(msg, pid);
+			break;
+		case READDIRPLUS:
+			YfsReadDirPlus(msg, pid);
+			break;
+		case LATENCY:
+			YfsLatency(msg, pid);
+			break;
+		case TRUNCATE:
+			YfsTruncate(msg, pid);
+			break;
+		case FTRUNCATE:
+			YfsFTruncate(msg, pid);
+			break;
+		case RENAME:
+			YfsRename(msg, pid);
+			break;
+		default :
+			LOG_INFO("ERROR : Invalid message type!\n");
+			msg->type = ERROR;
+			Reply((void*)msg, pid);
+			break;
+	}
 
-	/* Init file system header */
-	void* second_block = GetBlockByBnum(1);
-	if (second_block == NULL) {
-		printf("Read Sector #1 failed\n");
+	if (transaction) {
+		EndTransaction();
+	}
+
+	EndRequestTiming(&timing);
+	TRACE_REQUEST(timing.type, msg->type == ERROR ? ERROR : 0, timing.inum, timing.size, timing.service);
+#ifdef YFS_RECORD
+	RecordRequest(&request, msg, pid, &timing, path, path2);
+#endif
+
+	/* A batched operation's disk time also counts toward the batch */
+	SetRequestTiming(prev_timing);
+	AddDiskWait(timing.disk);
+
+	SetStatsOp(prev_op);
+}
+
+/*
+ * Handlers copy and reply through these wrappers.  While a BATCH message
+ * runs, client addresses point into the batch buffer, which the server
+ * already holds, so no IPC happens until the whole batch is done.
+ */
+int YfsCopyFrom(int pid, void* dest, void* src, int len) {
+	if (current_batch == NULL) {
+		return CopyFrom(pid, dest, src, len);
+	}
+
+	int offset = (char*)src - current_batch->client_buf;
+	if (offset < 0 || offset >= current_batch->len || len < 0) {
+		return ERROR;
+	}
+
+	/* Pathnames are always copied at full length, so clip at the end */
+	int avail = current_batch->len - offset;
+	if (len > avail) {
+		memset((char*)dest + avail, 0, len - avail);
+		len = avail;
+	}
+
+	memcpy(dest, current_batch->buf + offset, len);
+	return 0;
+}
+
+int YfsCopyTo(int pid, void* dest, void* src, int len) {
+	if (current_batch == NULL) {
+		return CopyTo(pid, dest, src, len);
+	}
+
+	int offset = (char*)dest - current_batch->client_buf;
+	if (offset < 0 || len < 0 || offset + len > current_batch->len) {
+		return ERROR;
+	}
+
+	memcpy(current_batch->buf + offset, src, len);
+	return 0;
+}
+
+void YfsReply(Message* msg, int pid) {
+	/* Batched operations report through their BatchOp instead */
+	if (current_batch != NULL) {
+		return;
+	}
+
+	/* Changes are reported only once they are durable */
+	if (DeferReply(msg, pid)) {
+		return;
+	}
+
+	Reply((void*)msg, pid);
+}
+
+/* Mark block #bnum as used while scanning the inodes at startup */
+static void ClaimBlock(int bnum) {
+	if (bnum > 0 && bnum < header.num_blocks && free_blocks[bnum]) {
+		free_blocks[bnum] = false;
+		--num_free_blocks;
+	}
+}
+
+/* Claim a block pointer of an inode of size bytes, a tail claims its fragments */
+static void ClaimPointer(int ptr, int size) {
+	if (!IS_TAIL(ptr)) {
+		ClaimBlock(ptr);
+		return;
+	}
+
+	int bnum = TAIL_BLOCK(ptr);
+	if (bnum > 0 && bnum < header.num_blocks && TAIL_FRAG(ptr) + TAIL_FRAGS(size) <= FRAGS_PER_BLOCK) {
+		ClaimBlock(bnum);
+		frag_maps[bnum] |= FRAG_MASK(TAIL_FRAG(ptr), TAIL_FRAGS(size));
+	}
+}
+
+/* Claim an indirect block levels above the data and everything below it */
+static int ClaimIndirect(int bnum, int levels, int size) {
+	ClaimBlock(bnum);
+	int i;
+	for (i = 0; i < PTRS_PER_BLOCK; ++i) {
+		int ptr = GetBnumFromIndirectBlock(bnum, i);
+		if (ptr == ERROR) {
+			return ERROR;
+		}
+
+		if (ptr == 0) {
+			continue;
+		}
+
+		if (levels > 1) {
+			if (ClaimIndirect(ptr, levels - 1, size) == ERROR) {
+				return ERROR;
+			}
+		} else {
+			ClaimPointer(ptr, size);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Read the header into hdr and set block_shift from it: sector 1 gives
+ * the block size, then the live header is at the start of block 1.
+ */
+int ReadFileSystemHeader(struct fs_header* hdr) {
+	char sector[SECTORSIZE];
+	block_shift = 0;
+	if (ReadBlockSector(1, sector) == ERROR) {
+		LOG_ERROR("Read Sector #1 failed\n");
+		return ERROR;
+	}
+
+	int shift = BLOCK_SHIFT((struct fs_header*)sector);
+	if (shift < 0 || shift > MAX_BLOCK_SHIFT) {
+		LOG_ERROR("Bad block size 2^%d sectors\n", shift);
 		return ERROR;
 	}
 
-	header.num_blocks = ((struct fs_header*)second_block)->num_blocks;
-	header.num_inodes = ((struct fs_header*)second_block)->num_inodes;
+	/* With one sector blocks that sector is block 1 already */
+	block_shift = shift;
+	int status = 0;
+	if (shift == 0) {
+		memcpy(hdr, sector, sizeof(struct fs_header));
+	} else {
+		char* block = (char*)malloc(BLOCKSIZE);
+		status = ReadBlockSector(1, block);
+		memcpy(hdr, block, sizeof(struct fs_header));
+		free(block);
+	}
+
+	if (status == ERROR || BLOCK_SHIFT(hdr) != shift || hdr->num_blocks > NUMSECTORS >> shift) {
+		LOG_ERROR("Bad header in block #1\n");
+		return ERROR;
+	}
+
+	return 0;
+}
+
+int InitFileSystem(CacheConfig* config, JournalConfig* journal_config) {
+	/* Init file system header, the caches are sized from it */
+	if (ReadFileSystemHeader(&header) == ERROR) {
+		return ERROR;
+	}
+
+	/* Init cache */
+	SizeCaches(config, header.num_blocks, header.num_inodes);
+	inode_cache = InitCache(config->inode_entries);
+	block_cache = InitCache(config->block_entries);
+	LOG_INFO("Caching %d inodes and %d blocks\n", config->inode_entries, config->block_entries);
 
 	/* Never care about index 0 in free blocks */
 	free_blocks = (bool*)calloc(header.num_blocks + 1, sizeof(bool));
 	/* Never care about index 0 in free_inodes */
 	free_inodes = (bool*)calloc(header.num_inodes + 1, sizeof(bool));
+	frag_maps = (unsigned int*)calloc(header.num_blocks + 1, sizeof(unsigned int));
+	frag_pending = (unsigned int*)calloc(header.num_blocks + 1, sizeof(unsigned int));
+
+	/* A journal keeps the free maps on disk, so there is nothing to scan */
+	int journal = MountJournal(journal_config);
+	if (journal == ERROR) {
+		return ERROR;
+	}
+
+	if (journal) {
+		return FindOrphans();
+	}
 
 	/* Initialize all_inodes array */
 	int i;
@@ -104,65 +425,78 @@ int InitFileSystem() {
 	for (i = 1; i < header.num_inodes + 1; ++i) {
 		struct inode* inode = GetInodeByInum(i);
 		if (inode == NULL) {
-			printf("Can't get inode #%d\n", i);
+			LOG_ERROR("Can't get inode #%d\n", i);
 			return ERROR;
 		}
 
 		if (inode->type == INODE_FREE) {
 			free_inodes[i] = true;
 			++num_free_inodes;
+		} else if (i != ROOTINODE && inode->nlink == 0) {
+			/* Unlinked, its blocks not all freed yet */
+			QueueOrphan(i);
 		}
 	}
 
-	/* Initialize free_blocks array based on free_inodes array */
-	num_free_blocks = header.num_blocks - (header.num_inodes + 1) / INODE_PER_BLOCK;
-	i = 1 + (header.num_blocks + 1) / INODE_PER_BLOCK;
-	for (; i <= header.num_blocks; ++i) {
+	/* Every block after the inode blocks starts free, then used ones are claimed */
+	num_free_blocks = 0;
+	i = 1 + (header.num_inodes + INODE_PER_BLOCK) / INODE_PER_BLOCK;
+	for (; i < header.num_blocks; ++i) {
 		free_blocks[i] = true;
+		++num_free_blocks;
 	}
 
 	for (i = 1; i < header.num_inodes + 1; ++i) {
-		/* Traverse all free inodes */
+		/* Traverse all used inodes */
 		if (!free_inodes[i]) {
 			struct inode* inode = GetInodeByInum(i);
 			if (inode == NULL) {
-				printf("Can't get inode #%d\n", i);
+				LOG_ERROR("Can't get inode #%d\n", i);
 				return ERROR;
 			}
 
-			/* Check direct block */
+			/* Inline data uses no blocks */
+			if (IS_INLINE(inode)) {
+				continue;
+			}
+
+			/* Check direct block, a 0 is a hole */
 			int j;
 			for (j = 0; j < NUM_DIRECT; ++j) {
 				if (inode->direct[j] == 0) {
-					break;
+					continue;
 				}
 
-				free_blocks[inode->direct[j]] = false;
-				--num_free_blocks;
+				ClaimPointer(inode->direct[j], inode->size);
 			}
 
-			/* Check indirect block */
-			if (inode->indirect > 0) {
-				int indirect_block_size = inode->size - NUM_DIRECT * BLOCKSIZE;
-				j = 0;
-				while (indirect_block_size > 0) {
-					int bnum = GetBnumFromIndirectBlock(inode->indirect, j);
-					if (bnum == ERROR) {
-						return ERROR;
-					}
-
-					free_blocks[bnum] = false;
-					--num_free_blocks;
-					indirect_block_size -= BLOCKSIZE;
-				}
+			/* Check the indirect blocks and the blocks they list */
+			if (inode->indirect > 0 && ClaimIndirect(INDIRECT_BLOCK(inode->indirect),
+				INDIRECT_LEVELS(inode->indirect), inode->size) == ERROR) {
+				return ERROR;
 			}
 		}
 	}
 
+	if (CreateJournal(journal_config) == ERROR) {
+		return ERROR;
+	}
+
+	/* A journal just created needs to know about them too */
+	if (PendingReclaims() > 0) {
+		NoteOrphans(true);
+	}
+
 	return 0;
 }
 
 int ParsePathName(int inum, char* pathname){
+	int symlinks = 0;
+	return ResolvePathName(inum, pathname, &symlinks);
+}
+
+/* Symbolic links inside the path are followed, a link in the last component is not */
+int ResolvePathName(int inum, char* pathname, int* symlinks) {
 	if (pathname == NULL) {
 		return ERROR;
 	}
@@ -177,42 +511,47 @@ int ParsePathName(int inum, char* pathname){
 		inum = ROOTINODE;
 	}
 
+	/* Directory holding inum, relative symbolic links start from it */
+	int dir_inum = inum;
 	int index = 0;
 	char* component_name = NULL;
-	index = ParseComponent(pathname, component_name, index);
+	index = ParseComponent(pathname, &component_name, index);
 
 	while (component_name != NULL) {
 		/* Check the current inode */
 		struct inode* inode = GetInodeByInum(inum);
-		if (inode->type == INODE_FREE || (inode->type == INODE_REGULAR && pathname[index] != '\0')) {
-			return ERROR;
+		while (inode != NULL && inode->type == INODE_SYMLINK) {
+			inum = ParseSymbolicLink(dir_inum, inode, symlinks);
+			inode = (inum == ERROR) ? NULL : GetInodeByInum(inum);
 		}
 
-		/* Get child inode number by component name */
-		if (inode->type == INODE_DIRECTORY) {
-			inum = GetInumByComponentName(inode, component_name);
-
-		/* Get inode number by symbolic link recursively */
-		} else if (inode->type == INODE_SYMLINK && pathname[index] != '\0') {
-			inum = ParseSymbolicLink(inode, 0);		
-		}
-
-		if (inum == ERROR) {
+		if (inode == NULL || inode->type != INODE_DIRECTORY) {
+			free(component_name);
 			return ERROR;
 		}
 
+		/* Get child inode number by component name */
+		dir_inum = inum;
+		inum = GetInumByComponentName(inode, component_name);
+
 		/* Release component name */
 		free(component_name);
 		component_name = NULL;
 
+		if (inum == ERROR || inum == 0) {
+			return ERROR;
+		}
+
 		/* Get next component name */
-		index = ParseComponent(pathname, component_name, index);
+		index = ParseComponent(pathname, &component_name, index);
 	}
 
 	return inum;
 }
 
-int ParseComponent(char* pathname, char* component_name, int index) {
+int ParseComponent(char* pathname, char** component_name, int index) {
+	*component_name = NULL;
+
 	/* Jump continuous slash symbol */
 	while (pathname[index] == '/') {
 		++index;
@@ -233,8 +572,8 @@ int ParseComponent(char* pathname, char* component_name, int index) {
 	}
 
 	/* Parse something */
-	component_name = (char*)calloc(component_end - component_start + 1, sizeof(char));
-	memcpy(component_name, pathname + component_start, component_end - component_start);
+	*component_name = (char*)calloc(component_end - component_start + 1, sizeof(char));
+	memcpy(*component_name, pathname + component_start, component_end - component_start);
 
 	return index;
 }
@@ -258,7 +597,7 @@ int GetInumByComponentName(struct inode* inode, char* component_name) {
 		if (block_index < NUM_DIRECT) {
 			bnum = inode->direct[block_index];
 		} else {
-			bnum = GetBnumFromIndirectBlock(inode->indirect, block_index - NUM_DIRECT);
+			bnum = GetBnumFromIndirect(inode->indirect, block_index - NUM_DIRECT);
 		}
 
 		void* block = GetBlockByBnum(bnum);
@@ -277,31 +616,23 @@ int GetInumByComponentName(struct inode* inode, char* component_name) {
 	return 0;
 }
 
-int ParseSymbolicLink(struct inode* inode, int traverse_count) {
-	if (inode->type != INODE_SYMLINK || traverse_count > MAXSYMLINKS) {
+/* Resolve the path stored in a symbolic link found in directory dir_inum */
+int ParseSymbolicLink(int dir_inum, struct inode* inode, int* symlinks) {
+	if (inode->type != INODE_SYMLINK || ++*symlinks > MAXSYMLINKS) {
 		return ERROR;
 	}
 
-	void* block = GetBlockByBnum(inode->direct[0]);
-	if (block == NULL) {
+	char* link = GetLinkTarget(inode);
+	if (link == NULL) {
 		return ERROR;
 	}
 
-	int inum = ((struct dir_entry*)block)->inum;
-	if (inum == 0) {
-		return ERROR;
-	}
+	char target[MAXPATHNAMELEN + 1];
+	int len = (inode->size < MAXPATHNAMELEN) ? inode->size : MAXPATHNAMELEN;
+	memcpy(target, link, len);
+	target[len] = '\0';
 
-	struct inode* child = GetInodeByInum(inum);
-	if (child == NULL) {
-		return ERROR;
-	}
-
-	if (child->type == INODE_SYMLINK) {
-		return ParseSymbolicLink(child, ++traverse_count);
-	}
-
-	return inum;
+	return ResolvePathName(dir_inum, target, symlinks);
 }
 
 struct inode* GetInodeByInum(int inum) {
@@ -318,14 +649,24 @@ struct inode* GetInodeByInum(int inum) {
 			return NULL;
 		}
 
-		struct inode* inode = (struct inode*)calloc(1, sizeof(struct inode));
+		/* Another request may have cached it while this one was suspended */
+		inode = (struct inode*)PeekItemInCache(inode_cache, inum);
+		if (inode != NULL) {
+			return inode;
+		}
+
+		inode = (struct inode*)calloc(1, sizeof(struct inode));
 		int offset = inum % INODE_PER_BLOCK;
 		memcpy(inode, (struct inode*)block + offset, sizeof(struct inode));
 
 		/* Cache inode */
 		CacheNode* inode_cache_node = PutItemInCache(inode_cache, inum, inode);
-		if (inode_cache_node != NULL && inode_cache_node->dirty) {
-			WriteBackInode(inode_cache_node);
+		if (inode_cache_node != NULL) {
+			if (inode_cache_node->dirty) {
+				WriteBackInode(inode_cache_node);
+			}
+
+			DiscardCacheNode(inode_cache_node);
 		}
 	}
 
@@ -338,24 +679,109 @@ void* GetBlockByBnum(int bnum) {
 	}
 
 	void* block = GetItemFromCache(block_cache, bnum);
+
+	/* Let other requests run while a disk helper fetches the block */
+	while (block == NULL && CanSuspend() && RequestDiskRead(bnum)) {
+		if (SuspendCoroutine(bnum) == ERROR) {
+			LOG_ERROR("Read Sector #%d failed\n", bnum);
+			return NULL;
+		}
+
+		block = PeekItemInCache(block_cache, bnum);
+	}
+
 	if (block == NULL) {
-		block = malloc(SECTORSIZE);
-		if (ReadSector(bnum, block) == ERROR) {
-			printf("Read Sector #%d failed\n", bnum);
+		block = malloc(BLOCKSIZE);
+		if (ReadBlockSector(bnum, block) == ERROR) {
+			LOG_ERROR("Read Sector #%d failed\n", bnum);
 			free(block);
 			return NULL;
 		}
 
-		/* Cache block */
-		CacheNode* block_cache_node = PutItemInCache(block_cache, bnum, block);
-		if (block_cache_node != NULL && block_cache_node->dirty) {
+		InvalidateDiskRead(bnum);
+		CacheBlock(bnum, block);
+	}
+
+	return block;
+}
+
+void CacheBlock(int bnum, void* block) {
+	CacheNode* block_cache_node = PutItemInCache(block_cache, bnum, block);
+	if (block_cache_node != NULL) {
+		if (block_cache_node->dirty) {
 			WriteBackBlock(block_cache_node);
 		}
+
+		DiscardCacheNode(block_cache_node);
+	}
+}
+
+/*
+ * All sector I/O goes through these so it is counted per request type.
+ * Block #bnum is the SECTORS_PER_BLOCK sectors from bnum << block_shift.
+ */
+int ReadBlockSector(int bnum, void* buf) {
+	unsigned long long start = ReadTimeStamp();
+	int ret = 0;
+	int i;
+	for (i = 0; i < SECTORS_PER_BLOCK && ret != ERROR; ++i) {
+		CountSectorRead();
+		ret = ReadSector((bnum << block_shift) + i, (char*)buf + i * SECTORSIZE);
 	}
+	AddDiskWait(ReadTimeStamp() - start);
+	return ret;
+}
 
+int WriteBlockSector(int bnum, void* buf) {
+	unsigned long long start = ReadTimeStamp();
+	int ret = 0;
+	int i;
+	for (i = 0; i < SECTORS_PER_BLOCK && ret != ERROR; ++i) {
+		CountSectorWrite();
+		ret = WriteSector((bnum << block_shift) + i, (char*)buf + i * SECTORSIZE);
+	}
+	AddDiskWait(ReadTimeStamp() - start);
+	return ret;
+}
+
+/* Cache block #bnum as zeros without reading it, for freshly used blocks */
+void* GetNewBlock(int bnum) {
+	void* block = GetItemFromCache(block_cache, bnum);
+	if (block == NULL) {
+		block = malloc(BLOCKSIZE);
+		InvalidateDiskRead(bnum);
+		CacheBlock(bnum, block);
+	}
+
+	memset(block, 0, BLOCKSIZE);
+	SetDirty(block_cache, bnum);
 	return block;
 }
 
+/* Shrink caches that pinned entries pushed past capacity, once they are unpinned */
+void TrimCaches(void) {
+	CacheNode* node;
+	while ((node = TrimCache(inode_cache)) != NULL) {
+		if (node->dirty) {
+			WriteBackInode(node);
+		}
+		DiscardCacheNode(node);
+	}
+
+	while ((node = TrimCache(block_cache)) != NULL) {
+		if (node->dirty) {
+			WriteBackBlock(node);
+		}
+		DiscardCacheNode(node);
+	}
+}
+
+/* Release an evicted node once no suspended request can still see it */
+void DiscardCacheNode(CacheNode* node) {
+	DeferFree(node->value);
+	free(node);
+}
+
 void* GetBlockByInum(int inum) {
 	if (inum <= 0 || inum > header.num_inodes) {
 		return NULL;
@@ -367,7 +793,10 @@ void* GetBlockByInum(int inum) {
 }
 
 void WriteBackInode(CacheNode* inode) {
+	/* The evicted inode is in nobody's cache, so finish before anyone runs */
+	DisableSuspend();
 	void* block = GetBlockByInum(inode->key);
+	EnableSuspend();
 	int bnum = GetBlockNumFromInodeNum(inode->key);
 	if (block == NULL) {
 		return;
@@ -377,19 +806,14 @@ void WriteBackInode(CacheNode* inode) {
     int offset = inode->key % INODE_PER_BLOCK;
     memcpy((struct inode*)block + offset, (struct inode*)(inode->value), sizeof(struct inode));
     SetDirty(block_cache, bnum);
-
-    free(inode->value);
-    free(inode);
 }
 
 void WriteBackBlock(CacheNode* block) {
     /* Maybe it needs to do other things here */
-    if (WriteSector(block->key, block->value) == ERROR) {
-        printf("Write Sector #%d failed\n", block->key);
+    InvalidateDiskRead(block->key);
+    if (WriteBlockSector(block->key, block->value) == ERROR) {
+        LOG_ERROR("Write Sector #%d failed\n", block->key);
     }
-
-    free(block->value);
-    free(block);
 }
 
 int GetBlockNumFromInodeNum(int inum) {
@@ -398,7 +822,7 @@ int GetBlockNumFromInodeNum(int inum) {
 
 int GetBnumFromIndirectBlock(int indirect_bnum, int index) {
 	if (indirect_bnum < 1 || indirect_bnum > header.num_blocks) {
-		printf("Illegal indirect block number #%d\n", indirect_bnum);
+		LOG_ERROR("Illegal indirect block number #%d\n", indirect_bnum);
 		return ERROR;
 	}
 
@@ -410,6 +834,51 @@ int GetBnumFromIndirectBlock(int indirect_bnum, int index) {
 	return ((int*)indirect_block)[index];
 }
 
+/* Blocks an indirect tree of levels levels reaches, capped at INT_MAX */
+int IndirectSpan(int levels) {
+	int span = 1;
+	for (; levels > 0; --levels) {
+		span = (span > INT_MAX / PTRS_PER_BLOCK) ? INT_MAX : span * PTRS_PER_BLOCK;
+	}
+
+	return span;
+}
+
+/*
+ * The bottom level indirect block listing block #index past the direct
+ * ones, in the tree rooted at indirect (an inode's indirect field), 0 if
+ * the tree has a hole there or doesn't reach that far.
+ */
+static int GetIndirectLeaf(int indirect, int index) {
+	if (indirect <= 0 || index < 0) {
+		return 0;
+	}
+
+	int levels = INDIRECT_LEVELS(indirect);
+	if (levels > MAX_INDIRECT_LEVELS || index >= IndirectSpan(levels)) {
+		return 0;
+	}
+
+	int bnum = INDIRECT_BLOCK(indirect);
+	for (; levels > 1 && bnum > 0; --levels) {
+		int span = IndirectSpan(levels - 1);
+		bnum = GetBnumFromIndirectBlock(bnum, index / span);
+		index %= span;
+	}
+
+	return bnum;
+}
+
+/* Block number of block #index past the direct ones, 0 for a hole */
+int GetBnumFromIndirect(int indirect, int index) {
+	int leaf = GetIndirectLeaf(indirect, index);
+	if (leaf <= 0) {
+		return leaf;
+	}
+
+	return GetBnumFromIndirectBlock(leaf, index % PTRS_PER_BLOCK);
+}
+
 int GetBnumBySeekPosition(struct inode* inode, int seek_pos) {
 	int block_index = seek_pos / BLOCKSIZE;
 
@@ -422,69 +891,187 @@ int GetBnumBySeekPosition(struct inode* inode, int seek_pos) {
 		return inode->direct[block_index];
 	}
 
-	/* Get Bnum from indirect block */
-	if (inode->indirect == 0) {
+	/* Get Bnum from the indirect blocks */
+	int bnum = GetBnumFromIndirect(inode->indirect, block_index - NUM_DIRECT);
+	if (bnum == 0) {
 		return ERROR;
 	}
 
-	int bnum = GetBnumFromIndirectBlock(inode->indirect, block_index - NUM_DIRECT);
-	if (bnum == 0) {
+	return bnum;
+}
+
+/* Map a new block right after the whole blocks of the inode, return its number */
+int AllocateBlockInInode(struct inode* inode, int inum) {
+	int bnum = FindFreeBlock();
+	if (bnum == ERROR) {
+		return ERROR;
+	}
+
+	if (SetBlockPointer(inode, inum, inode->size / BLOCKSIZE, bnum) == ERROR) {
+		RecycleFreeBlock(bnum);
 		return ERROR;
 	}
 
 	return bnum;
 }
 
-int AllocateBlockInInode(struct inode* inode, int inum) {
-	int i;
-	for (i = 0; i < NUM_DIRECT; ++i) {
-		if (inode->direct[i] == 0) {
-			int bnum = FindFreeBlock();
-			if (bnum == ERROR) {
+/* Move the data of an inline inode into a block of its own */
+int SpillInlineData(struct inode* inode, int inum) {
+	char data[INLINE_SIZE];
+	memcpy(data, inode->direct, INLINE_SIZE);
+	memset(inode->direct, 0, sizeof(inode->direct));
+	inode->indirect = 0;
+	SetDirty(inode_cache, inum);
+	InvalidateBlockMap(inum);
+	if (inode->size == 0) {
+		return 0;
+	}
+
+	int bnum = AllocateBlockInInode(inode, inum);
+	if (bnum == ERROR) {
+		memcpy(inode->direct, data, INLINE_SIZE);
+		inode->indirect = INLINE_DATA;
+		return ERROR;
+	}
+
+	/* Logged like metadata, since the inode it came from was */
+	char* block = (char*)GetNewBlock(bnum);
+	memcpy(block, data, inode->size);
+	JournalBlock(bnum);
+	return 0;
+}
+
+/* The path a symbolic link holds, in its inode, its tail or its first block */
+char* GetLinkTarget(struct inode* inode) {
+	if (IS_INLINE(inode)) {
+		return (char*)inode->direct;
+	}
+
+	if (inode->direct[0] == 0) {
+		return NULL;
+	}
+
+	if (IS_TAIL(inode->direct[0])) {
+		return GetTailData(inode->direct[0]);
+	}
+
+	return (char*)GetBlockByBnum(inode->direct[0]);
+}
+
+/* First byte of the fragments a tail pointer names, in the cached block */
+char* GetTailData(int ptr) {
+	char* block = (char*)GetBlockByBnum(TAIL_BLOCK(ptr));
+	if (block == NULL) {
+		return NULL;
+	}
+
+	return block + TAIL_FRAG(ptr) * FRAGSIZE;
+}
+
+/* A new, zeroed indirect block, logged like the rest of the metadata */
+static int AllocateIndirectBlock(void) {
+	int bnum = FindFreeBlock();
+	if (bnum == ERROR) {
+		return ERROR;
+	}
+
+	if (GetNewBlock(bnum) == NULL) {
+		RecycleFreeBlock(bnum);
+		return ERROR;
+	}
+
+	JournalBlock(bnum);
+	return bnum;
+}
+
+/*
+ * Point block #index of the file at ptr, a block number or a tail
+ * pointer, adding the indirect blocks the index needs and, once it is
+ * past the reach of the tree, levels above the root.
+ */
+int SetBlockPointer(struct inode* inode, int inum, int index, int ptr) {
+	if (index < NUM_DIRECT) {
+		inode->direct[index] = ptr;
+		SetDirty(inode_cache, inum);
+		UpdateBlockMap(inum, index, ptr);
+		return 0;
+	}
+
+	int rest = index - NUM_DIRECT;
+	int levels = (inode->indirect > 0) ? INDIRECT_LEVELS(inode->indirect) : 1;
+	while (rest >= IndirectSpan(levels)) {
+		if (levels == MAX_INDIRECT_LEVELS) {
+			return ERROR;
+		}
+
+		++levels;
+		if (inode->indirect > 0) {
+			int root = AllocateIndirectBlock();
+			if (root == ERROR) {
 				return ERROR;
 			}
 
-			inode->direct[i] = bnum;
+			((int*)GetBlockByBnum(root))[0] = INDIRECT_BLOCK(inode->indirect);
+			inode->indirect = INDIRECT_POINTER(root, levels);
 			SetDirty(inode_cache, inum);
-			return 0;
+			InvalidateBlockMap(inum);
 		}
 	}
 
 	if (inode->indirect == 0) {
-		int bnum = FindFreeBlock();
-		if (bnum == ERROR) {
+		int root = AllocateIndirectBlock();
+		if (root == ERROR) {
 			return ERROR;
 		}
 
-		void* block = GetBlockByBnum(bnum);
+		inode->indirect = INDIRECT_POINTER(root, levels);
+		SetDirty(inode_cache, inum);
+	}
+
+	/* Walk down from the root, filling holes on the way with new indirect blocks */
+	int bnum = INDIRECT_BLOCK(inode->indirect);
+	int* block;
+	for (; levels > 1; --levels) {
+		int span = IndirectSpan(levels - 1);
+		block = (int*)GetBlockByBnum(bnum);
 		if (block == NULL) {
 			return ERROR;
 		}
 
-		memset(block, 0, BLOCKSIZE);
-		inode->indirect = bnum;
-		SetDirty(inode_cache, inum);
-	}
-
-	void* indirect_block = GetBlockByBnum(inode->indirect);
-	if (indirect_block == NULL) {
-		return ERROR;
-	}
+		int next = block[rest / span];
+		if (next == 0) {
+			next = AllocateIndirectBlock();
+			if (next == ERROR) {
+				return ERROR;
+			}
 
-	for (i = 0; i < BLOCKSIZE / sizeof(int); ++i) {
-		if (((int*)indirect_block)[i] == 0) {
-			int bnum = FindFreeBlock();
-			if (bnum == ERROR) {
+			/* The new block may have pushed this one out of the cache */
+			block = (int*)GetBlockByBnum(bnum);
+			if (block == NULL) {
 				return ERROR;
 			}
 
-			((int*)indirect_block)[i] = bnum;
-			SetDirty(block_cache, inode->indirect);
-			return 0;
+			block[rest / span] = next;
+			SetDirty(block_cache, bnum);
+			JournalBlock(bnum);
+			/* An open file has a copy of the upper levels */
+			InvalidateBlockMap(inum);
 		}
+
+		bnum = next;
+		rest %= span;
 	}
 
-	return ERROR;
+	block = (int*)GetBlockByBnum(bnum);
+	if (block == NULL) {
+		return ERROR;
+	}
+
+	block[rest] = ptr;
+	SetDirty(block_cache, bnum);
+	JournalBlock(bnum);
+	UpdateBlockMap(inum, index, ptr);
+	return 0;
 }
 
 int CountDirEntry(struct inode* dir_inode, int dir_inum) {
@@ -504,7 +1091,7 @@ int CountDirEntry(struct inode* dir_inode, int dir_inum) {
 		if (block_index < NUM_DIRECT) {
 			bnum = dir_inode->direct[block_index];
 		} else {
-			bnum = GetBnumFromIndirectBlock(dir_inode->indirect, block_index - NUM_DIRECT);
+			bnum = GetBnumFromIndirect(dir_inode->indirect, block_index - NUM_DIRECT);
 		}
 
 		void* block = GetBlockByBnum(bnum);
@@ -540,7 +1127,7 @@ int DeleteDirEntry(struct inode* dir_inode, int dir_inum, int inum) {
 		if (block_index < NUM_DIRECT) {
 			bnum = dir_inode->direct[block_index];
 		} else {
-			bnum = GetBnumFromIndirectBlock(dir_inode->indirect, block_index - NUM_DIRECT);
+			bnum = GetBnumFromIndirect(dir_inode->indirect, block_index - NUM_DIRECT);
 		}
 
 		void* block = GetBlockByBnum(bnum);
@@ -548,16 +1135,58 @@ int DeleteDirEntry(struct inode* dir_inode, int dir_inum, int inum) {
 			return ERROR;
 		}
 
-		struct dir_entry entry = ((struct dir_entry*)block)[i % DIR_ENTRY_PER_BLOCK];
-		if (entry.inum == inum) {
-			entry.inum = 0;
+		struct dir_entry* entry = (struct dir_entry*)block + i % DIR_ENTRY_PER_BLOCK;
+		if (entry->inum == inum) {
+			entry->inum = 0;
 			SetDirty(block_cache, bnum);
+			JournalBlock(bnum);
 			return 0;
 		}
 	}
 	return ERROR;
 }
 
+/* Point the entry called name at inum, 0 to remove it, and return the inode it named */
+int SetDirEntry(struct inode* dir_inode, int dir_inum, char* name, int inum) {
+	if (dir_inode == NULL || dir_inode->type != INODE_DIRECTORY) {
+		return ERROR;
+	}
+
+	if (inum < 0 || inum > header.num_inodes) {
+		return ERROR;
+	}
+
+	int i;
+	for (i = 0; i < dir_inode->size / sizeof(struct dir_entry); ++i) {
+		int block_index = i * sizeof(struct dir_entry) / BLOCKSIZE;
+		if (block_index >= NUM_DIRECT && dir_inode->indirect == 0) {
+			return ERROR;
+		}
+
+		int bnum;
+		if (block_index < NUM_DIRECT) {
+			bnum = dir_inode->direct[block_index];
+		} else {
+			bnum = GetBnumFromIndirect(dir_inode->indirect, block_index - NUM_DIRECT);
+		}
+
+		void* block = GetBlockByBnum(bnum);
+		if (block == NULL) {
+			return ERROR;
+		}
+
+		struct dir_entry* entry = (struct dir_entry*)block + i % DIR_ENTRY_PER_BLOCK;
+		if (entry->inum > 0 && strncmp(name, entry->name, DIRNAMELEN) == 0) {
+			int old_inum = entry->inum;
+			entry->inum = inum;
+			SetDirty(block_cache, bnum);
+			JournalBlock(bnum);
+			return old_inum;
+		}
+	}
+	return ERROR;
+}
+
 int CreateDirEntry(struct inode* dir_inode, int dir_inum, int inum, char* name) {
 	if (dir_inode == NULL || dir_inode->type != INODE_DIRECTORY) {
 		return ERROR;
@@ -588,7 +1217,7 @@ int CreateDirEntry(struct inode* dir_inode, int dir_inum, int inum, char* name)
 		if (block_index < NUM_DIRECT) {
 			bnum = dir_inode->direct[block_index];
 		} else {
-			bnum = GetBnumFromIndirectBlock(dir_inode->indirect, block_index - NUM_DIRECT);
+			bnum = GetBnumFromIndirect(dir_inode->indirect, block_index - NUM_DIRECT);
 		}
 
 		void* block = GetBlockByBnum(bnum);
@@ -596,39 +1225,46 @@ int CreateDirEntry(struct inode* dir_inode, int dir_inum, int inum, char* name)
 			return ERROR;
 		}
 
-		struct dir_entry entry = ((struct dir_entry*)block)[i % DIR_ENTRY_PER_BLOCK];
-		if (entry.inum == 0) {
-			entry.inum = inum;
-			memcpy(entry.name, name, len);
+		struct dir_entry* entry = (struct dir_entry*)block + i % DIR_ENTRY_PER_BLOCK;
+		if (entry->inum == 0) {
+			entry->inum = inum;
+			memset(entry->name, 0, DIRNAMELEN);
+			memcpy(entry->name, name, len);
 			SetDirty(block_cache, bnum);
+			JournalBlock(bnum);
 			return 0;
 		}
 	}
 
-	/* Allocate new block */
+	/* Allocate a new, zeroed block */
+	int bnum;
+	void* block;
 	if (dir_inode->size % BLOCKSIZE == 0) {
-		AllocateBlockInInode(dir_inode, dir_inum);
-	}
+		bnum = AllocateBlockInInode(dir_inode, dir_inum);
+		if (bnum == ERROR) {
+			return ERROR;
+		}
 
-	/* Setup a dir entry out of the current size */
-	dir_inode->size += sizeof(struct dir_entry);
-	int bnum;
-	int block_index = i * sizeof(struct dir_entry) / BLOCKSIZE;
-	if (block_index < NUM_DIRECT) {
-		bnum = dir_inode->direct[block_index];
+		block = GetNewBlock(bnum);
 	} else {
-		bnum = GetBnumFromIndirectBlock(dir_inode->indirect, block_index - NUM_DIRECT);
+		bnum = GetBnumBySeekPosition(dir_inode, dir_inode->size);
+		block = (bnum == ERROR) ? NULL : GetBlockByBnum(bnum);
 	}
 
-	void* block = GetBlockByBnum(bnum);
 	if (block == NULL) {
 		return ERROR;
 	}
 
-	struct dir_entry entry = ((struct dir_entry*)block)[i % DIR_ENTRY_PER_BLOCK];
-	entry.inum = inum;
-	memcpy(entry.name, name, len);
+	/* Setup a dir entry out of the current size */
+	struct dir_entry* entry = (struct dir_entry*)block + i % DIR_ENTRY_PER_BLOCK;
+	entry->inum = inum;
+	memset(entry->name, 0, DIRNAMELEN);
+	memcpy(entry->name, name, len);
 	SetDirty(block_cache, bnum);
+	JournalBlock(bnum);
+
+	dir_inode->size += sizeof(struct dir_entry);
+	SetDirty(inode_cache, dir_inum);
 	return 0;
 }
 
@@ -659,7 +1295,9 @@ int FindFreeBlock(void) {
 	int i;
     for (i = 1; i <= header.num_blocks; ++i) {
         if (free_blocks[i]) {
+        	free_blocks[i] = false;
         	--num_free_blocks;
+        	NoteBlockUsed(i, true);
             return i;
         }
     }
@@ -672,8 +1310,151 @@ void RecycleFreeBlock(int bnum) {
 		return;
 	}
 
-	free_blocks[bnum] = false;
-	++num_free_blocks;
+	if (free_blocks[bnum]) {
+		return;
+	}
+
+	/* With a journal the block is reused only once that is safe */
+	if (DeferBlockFree(bnum)) {
+		return;
+	}
+
+	ReleaseBlock(bnum);
+}
+
+/* RecycleFreeBlock for count blocks, with one free map update for them all */
+void RecycleFreeBlocks(int* bnums, int count) {
+	int len = 0;
+	int i;
+	for (i = 0; i < count; ++i) {
+		if (bnums[i] >= 1 && bnums[i] <= header.num_blocks && !free_blocks[bnums[i]]) {
+			bnums[len++] = bnums[i];
+		}
+	}
+
+	if (DeferBlockFrees(bnums, len)) {
+		return;
+	}
+
+	for (i = 0; i < len; ++i) {
+		ReleaseBlock(bnums[i]);
+	}
+}
+
+static void MarkBlockFree(int bnum, int unused) {
+	if (!free_blocks[bnum]) {
+		free_blocks[bnum] = true;
+		++num_free_blocks;
+	}
+}
+
+/* Let a freed block be allocated again once no suspended reader can still use it */
+void ReleaseBlock(int bnum) {
+	DeferRelease(MarkBlockFree, bnum, 0);
+}
+
+/* First of count free fragments in a row in block #bnum, or ERROR */
+static int FindFragmentRun(int bnum, int count) {
+	unsigned int busy = frag_maps[bnum] | frag_pending[bnum];
+	unsigned int mask = FRAG_MASK(0, count);
+	int frag;
+	for (frag = 0; frag + count <= FRAGS_PER_BLOCK; ++frag) {
+		if ((busy & (mask << frag)) == 0) {
+			return frag;
+		}
+	}
+
+	return ERROR;
+}
+
+/*
+ * Allocate count fragments in a row for a tail, in a block already
+ * holding tails if one has room, otherwise in a new block.  Return the
+ * tail pointer, its block is cached.
+ */
+int AllocateFragments(int count) {
+	if (count <= 0 || count > FRAGS_PER_BLOCK) {
+		return ERROR;
+	}
+
+	int bnum = ERROR;
+	int frag = ERROR;
+	if (frag_hint > 0 && frag_maps[frag_hint] != 0) {
+		bnum = frag_hint;
+		frag = FindFragmentRun(bnum, count);
+	}
+
+	int i;
+	for (i = 1; i < header.num_blocks && frag == ERROR; ++i) {
+		if (frag_maps[i] != 0) {
+			bnum = i;
+			frag = FindFragmentRun(bnum, count);
+		}
+	}
+
+	if (frag == ERROR) {
+		bnum = FindFreeBlock();
+		if (bnum == ERROR) {
+			return ERROR;
+		}
+
+		GetNewBlock(bnum);
+		frag = 0;
+	} else if (GetBlockByBnum(bnum) == NULL) {
+		return ERROR;
+	}
+
+	frag_maps[bnum] |= FRAG_MASK(frag, count);
+	NoteFragmentsUsed(bnum, frag, count, true);
+	frag_hint = bnum;
+	return TAIL_POINTER(bnum, frag);
+}
+
+/* Extend a tail of count fragments to new_count in place, if the next ones are free */
+int GrowFragments(int ptr, int count, int new_count) {
+	int bnum = TAIL_BLOCK(ptr);
+	int frag = TAIL_FRAG(ptr);
+	if (frag + new_count > FRAGS_PER_BLOCK) {
+		return ERROR;
+	}
+
+	unsigned int more = FRAG_MASK(frag + count, new_count - count);
+	if (((frag_maps[bnum] | frag_pending[bnum]) & more) != 0) {
+		return ERROR;
+	}
+
+	frag_maps[bnum] |= more;
+	NoteFragmentsUsed(bnum, frag + count, new_count - count, true);
+	return 0;
+}
+
+/* Free the count fragments of a tail, and its block with the last of them */
+void RecycleFragments(int ptr, int count) {
+	int bnum = TAIL_BLOCK(ptr);
+	unsigned int mask = FRAG_MASK(TAIL_FRAG(ptr), count);
+	if (bnum < 1 || bnum >= header.num_blocks || (frag_maps[bnum] & mask) == 0) {
+		return;
+	}
+
+	/* With a journal the fragments are reused only once that is safe */
+	frag_pending[bnum] |= mask;
+	if (!DeferFragmentFree(ptr, count)) {
+		ReleaseFragments(ptr, count);
+	}
+
+	frag_maps[bnum] &= ~mask;
+	if (frag_maps[bnum] == 0) {
+		RecycleFreeBlock(bnum);
+	}
+}
+
+static void ClearFragmentsPending(int ptr, int count) {
+	frag_pending[TAIL_BLOCK(ptr)] &= ~FRAG_MASK(TAIL_FRAG(ptr), count);
+}
+
+/* Let fragments whose free has committed be allocated again, as ReleaseBlock */
+void ReleaseFragments(int ptr, int count) {
+	DeferRelease(ClearFragmentsPending, ptr, count);
 }
 
 int FindFreeInode(void) {
@@ -684,7 +1465,9 @@ int FindFreeInode(void) {
 	int i;
     for (i = 1; i <= header.num_inodes; ++i) {
         if (free_inodes[i]) {
+        	free_inodes[i] = false;
         	--num_free_inodes;
+        	NoteInodeUsed(i, true);
             return i;
         }
     }
@@ -697,12 +1480,24 @@ void RecycleFreeInode(int inum) {
 		return;
 	}
 
-	free_inodes[inum] = false;
+	if (free_inodes[inum]) {
+		return;
+	}
+
+	/* Mounting without a journal finds free inodes by their type */
+	struct inode* inode = GetInodeByInum(inum);
+	if (inode != NULL) {
+		inode->type = INODE_FREE;
+		SetDirty(inode_cache, inum);
+	}
+
+	free_inodes[inum] = true;
 	++num_free_inodes;
+	NoteInodeUsed(inum, false);
 }
 
 int ParsePathDir(int inum, char* pathname) {
-    char dir[MAXPATHNAMELEN];
+    char dir[MAXPATHNAMELEN + 1];
     int filename_index = GetFileNameIndex(pathname);
     if (filename_index == ERROR) {
         return ERROR;
@@ -712,8 +1507,10 @@ int ParsePathDir(int inum, char* pathname) {
         return inum;
     }
 
+    /* Look up "." in the directory so a symbolic link to it is followed */
     memcpy(dir, pathname, filename_index);
-    dir[filename_index] = '\0';
+    dir[filename_index] = '.';
+    dir[filename_index + 1] = '\0';
     return ParsePathName(inum, dir);
 }
 
@@ -747,8 +1544,9 @@ void SyncBlockCache() {
 		if (current->dirty) {
 			current->dirty = false;
 
-			if (WriteSector(current->key, current->value) == ERROR) {
-		        printf("Write Sector #%d failed\n", current->key);
+			InvalidateDiskRead(current->key);
+			if (WriteBlockSector(current->key, current->value) == ERROR) {
+		        LOG_ERROR("Write Sector #%d failed\n", current->key);
 		    }
 		}
 
@@ -756,37 +1554,163 @@ void SyncBlockCache() {
 	}
 }
 
+/* Blocks a truncate frees, handed to the free map together once the walk is done */
+typedef struct FreedBlocks {
+	int* bnums;
+	int len;
+	int cap;
+	/* A tail past the new end, at most one */
+	int tail;
+} FreedBlocks;
+
+static void AddFreedBlock(FreedBlocks* freed, int ptr) {
+	if (IS_TAIL(ptr)) {
+		freed->tail = ptr;
+		return;
+	}
+
+	if (freed->len == freed->cap) {
+		freed->cap = (freed->cap == 0) ? 64 : freed->cap * 2;
+		freed->bnums = (int*)realloc(freed->bnums, freed->cap * sizeof(int));
+	}
+
+	freed->bnums[freed->len++] = ptr;
+}
+
+/*
+ * Free what indirect block bnum, levels above the data, lists from its
+ * block #keep on, and the block itself if keep is 0.  Each block is read
+ * once: its entries are copied out before the levels below are walked,
+ * which may push it out of the cache.
+ */
+static int TrimIndirect(int bnum, int levels, int keep, FreedBlocks* freed) {
+	if (bnum < 1 || bnum > header.num_blocks) {
+		LOG_ERROR("Illegal indirect block number #%d\n", bnum);
+		return ERROR;
+	}
+
+	int* block = (int*)GetBlockByBnum(bnum);
+	if (block == NULL) {
+		return ERROR;
+	}
+
+	int span = IndirectSpan(levels - 1);
+	int first = keep / span;
+	int cut = first + (keep % span != 0);
+	int count = PTRS_PER_BLOCK - first;
+	int* entries = (int*)malloc(count * sizeof(int));
+	memcpy(entries, block + first, count * sizeof(int));
+
+	if (keep > 0 && cut < PTRS_PER_BLOCK) {
+		memset(block + cut, 0, (PTRS_PER_BLOCK - cut) * sizeof(int));
+		SetDirty(block_cache, bnum);
+		JournalBlock(bnum);
+	}
+
+	int i;
+	for (i = 0; i < count; ++i) {
+		if (entries[i] == 0) {
+			continue;
+		}
+
+		if (levels == 1) {
+			AddFreedBlock(freed, entries[i]);
+			continue;
+		}
+
+		int child_keep = (first + i < cut) ? keep - (first + i) * span : 0;
+		if (TrimIndirect(entries[i], levels - 1, child_keep, freed) == ERROR) {
+			free(entries);
+			return ERROR;
+		}
+	}
+
+	free(entries);
+	if (keep == 0) {
+		AddFreedBlock(freed, bnum);
+	}
+
+	return 0;
+}
+
+/*
+ * Free the blocks of the inode from block #keep on, with the indirect
+ * blocks left empty, and drop levels of the tree no longer needed to
+ * reach the rest.  Only those blocks are visited, and the free map is
+ * updated once for all of them.  The size is left to the caller.
+ */
+int TruncateBlocks(struct inode* inode, int inum, int keep) {
+	if (IS_INLINE(inode)) {
+		return 0;
+	}
+
+	FreedBlocks freed;
+	memset(&freed, 0, sizeof(freed));
+
+	int i;
+	for (i = keep; i < NUM_DIRECT; ++i) {
+		if (inode->direct[i] != 0) {
+			AddFreedBlock(&freed, inode->direct[i]);
+			inode->direct[i] = 0;
+		}
+	}
+
+	int ret = 0;
+	if (inode->indirect > 0) {
+		int root = INDIRECT_BLOCK(inode->indirect);
+		int levels = INDIRECT_LEVELS(inode->indirect);
+		int rest = (keep > NUM_DIRECT) ? keep - NUM_DIRECT : 0;
+		ret = TrimIndirect(root, levels, rest, &freed);
+		if (rest == 0) {
+			inode->indirect = 0;
+		}
+
+		/* The first entry of a root with nothing else left takes its place */
+		while (ret == 0 && inode->indirect > 0 && levels > 1 && rest <= IndirectSpan(levels - 1)) {
+			int* block = (int*)GetBlockByBnum(root);
+			if (block == NULL) {
+				ret = ERROR;
+				break;
+			}
+
+			AddFreedBlock(&freed, root);
+			root = block[0];
+			--levels;
+			inode->indirect = (root == 0) ? 0 : INDIRECT_POINTER(root, levels);
+		}
+	}
+
+	SetDirty(inode_cache, inum);
+	InvalidateBlockMap(inum);
+
+	RecycleFreeBlocks(freed.bnums, freed.len);
+	free(freed.bnums);
+	if (freed.tail != 0) {
+		RecycleFragments(freed.tail, TAIL_FRAGS(inode->size));
+	}
+
+	return ret;
+}
+
 int RecycleBlocksInInode(int inum) {
 	struct inode* inode = GetInodeByInum(inum);
     if (inode == NULL) {
         return ERROR;
     }
 
-    int i;
-    for (i = 0; i < NUM_DIRECT; ++i) {
-        if (inode->direct[i] == 0) {
-            break;
-        }
+    TruncateBlocks(inode, inum, 0);
 
-        RecycleFreeBlock(inode->direct[i]);
-        inode->direct[i] = 0;
-    }
-
-    if (inode->indirect > 0) {
-    	int j;
-    	for (j = 0; j < BLOCKSIZE / sizeof(int); ++j) {
-    		int bnum = GetBnumFromIndirectBlock(inode->indirect, j);
-    		if (bnum == 0) {
-    			break;
-    		}
-
-    		RecycleFreeBlock(bnum);
-    	}
-    	RecycleFreeBlock(inode->indirect);
-    	inode->indirect = 0;
+    /* An emptied regular file starts over inline */
+    if (inode->type == INODE_REGULAR) {
+        memset(inode->direct, 0, sizeof(inode->direct));
+        inode->indirect = INLINE_DATA;
+    } else if (IS_INLINE(inode)) {
+        memset(inode->direct, 0, sizeof(inode->direct));
+        inode->indirect = 0;
     }
 
     inode->size = 0;
     SetDirty(inode_cache, inum);
+    InvalidateBlockMap(inum);
     return 0;
-}
\ No newline at end of file
+}
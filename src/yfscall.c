@@ -2,16 +2,25 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include <comp421/yalnix.h>
 #include "../include/fscache.h"
+#include "../include/openfile.h"
+#include "../include/stats.h"
+#include "../include/latency.h"
+#include "../include/log.h"
+#include "../include/trace.h"
+#include "../include/record.h"
+#include "../include/journal.h"
+#include "../include/reclaim.h"
 
 void YfsOpen(Message* msg, int pid) {
-    printf("Executing YfsOpen()\n");
+    LOG_DEBUG("Executing YfsOpen()\n");
     char pathname[MAXPATHNAMELEN];
-    if (CopyFrom(pid, pathname, msg->addr1, MAXPATHNAMELEN) == ERROR) {
-        printf("CopyFrom() error\n");
+    if (YfsCopyFrom(pid, pathname, msg->addr1, MAXPATHNAMELEN) == ERROR) {
+        LOG_INFO("CopyFrom() error\n");
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
@@ -19,37 +28,46 @@ void YfsOpen(Message* msg, int pid) {
     int inum = ParsePathName(msg->data1, pathname);
     if (inum == ERROR) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
     	return;
     }
    
     struct inode* inode = GetInodeByInum(inum);
     if (inode == NULL) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
+    int handle = OpenFileHandle(inum, pid);
+    if (handle == ERROR) {
+        msg->type = ERROR;
+        YfsReply(msg, pid);
+        return;
+    }
+
+	NoteRequestFile(inum, inode->size);
 	msg->data1 = inum;
-	Reply((void*)msg, pid);
+	msg->data2 = handle;
+	YfsReply(msg, pid);
 }
 
 void YfsCreate(Message* msg, int pid) {
-    printf("Executing YfsCreate()\n");
+    LOG_DEBUG("Executing YfsCreate()\n");
     char pathname[MAXPATHNAMELEN];
-    if (CopyFrom(pid, pathname, msg->addr1, MAXPATHNAMELEN) == ERROR) {
-        printf("CopyFrom() error\n");
+    if (YfsCopyFrom(pid, pathname, msg->addr1, MAXPATHNAMELEN) == ERROR) {
+        LOG_INFO("CopyFrom() error\n");
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
     /* Check if all directores is valid */
     int dir_inum = ParsePathDir(msg->data1, pathname);
     if (dir_inum == ERROR) {
-        printf("Invalid directory\n");
+        LOG_INFO("Invalid directory\n");
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
@@ -58,9 +76,9 @@ void YfsCreate(Message* msg, int pid) {
     memcpy(filename, pathname + filename_index, strlen(pathname) - filename_index);
     filename[strlen(pathname) - filename_index] = '\0';
     if (strcmp(filename, ".") == 0 || strcmp(filename, "..") == 0) {
-        printf("Invalid file name\n");
+        LOG_INFO("Invalid file name\n");
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
@@ -72,14 +90,14 @@ void YfsCreate(Message* msg, int pid) {
         inum = FindFreeInode();
         if (inum == ERROR) {
             msg->type = ERROR;
-            Reply((void*)msg, pid);
+            YfsReply(msg, pid);
             return;
         }
 
         struct inode* inode = GetInodeByInum(inum);
         if (inode == NULL) {
             msg->type = ERROR;
-            Reply((void*)msg, pid);
+            YfsReply(msg, pid);
             return;
         }
 
@@ -88,205 +106,389 @@ void YfsCreate(Message* msg, int pid) {
         ++inode->reuse;
         inode->size = 0;
         memset(inode->direct, 0, NUM_DIRECT * sizeof(int));
-        inode->indirect = 0;
+        inode->indirect = INLINE_DATA;
 
         if (CreateDirEntry(dir_inode, dir_inum, inum, filename) == ERROR) {
-            printf("Can't create new dir entry\n");
+            LOG_INFO("Can't create new dir entry\n");
             msg->type = ERROR;
-            Reply((void*)msg, pid);
+            YfsReply(msg, pid);
             return;
         }
 
         SetDirty(inode_cache, inum);
     /* If file name can be found */
     } else {
-        printf("File has existed. Set file size to 0\n");
+        LOG_DEBUG("File has existed. Set file size to 0\n");
         if (RecycleBlocksInInode(inum) == ERROR) {
             msg->type = ERROR;
-            Reply((void*)msg, pid);
+            YfsReply(msg, pid);
             return;
         }
     }
 
+    int handle = OpenFileHandle(inum, pid);
+    if (handle == ERROR) {
+        msg->type = ERROR;
+        YfsReply(msg, pid);
+        return;
+    }
+
+    NoteRequestFile(inum, 0);
     msg->data1 = inum;
-    Reply((void*)msg, pid);
+    msg->data2 = handle;
+    YfsReply(msg, pid);
 }
 
-void YfsRead(Message* msg, int pid) {
-    printf("Executing YfsRead()\n");
-    struct inode* inode = GetInodeByInum(msg->data1);
-    if (inode == NULL) {
-        msg->type = ERROR;
-        Reply((void*)msg, pid);
-        return;
+/*
+ * Client data moves through a staging buffer of at most TRANSFER_BLOCKS
+ * blocks, so a request of any size needs only that much memory.
+ */
+#define TRANSFER_BLOCKS 16
+
+/* Length of the next piece at pos, ending on a block boundary unless it is the last */
+static int TransferChunk(int pos, int left) {
+    int chunk = TRANSFER_BLOCKS * BLOCKSIZE - pos % BLOCKSIZE;
+    return (chunk < left) ? chunk : left;
+}
+
+static char* AllocTransferBuffer(int size) {
+    int len = TRANSFER_BLOCKS * BLOCKSIZE;
+    char* buf = (char*)malloc((size < len) ? size : len);
+    if (buf == NULL) {
+        LOG_ERROR("No memory for a %d byte transfer\n", size);
     }
+    return buf;
+}
 
-    int size = msg->data2;
-    int seek_pos = msg->data3;
-    if (seek_pos + size > inode->size) {
-        size = inode->size - seek_pos;
+/* Copy len bytes between buf and the client's segments, offset bytes into them */
+static int CopySegments(int pid, struct IoVec* iov, int count, int offset, char* buf, int len,
+    bool to_client) {
+    int i = 0;
+    while (i < count && offset >= iov[i].len) {
+        offset -= iov[i].len;
+        ++i;
     }
 
-    int len = 0;
-    char* buf = (char*)malloc(size);
-    while (size > 0) {
-        int bnum = GetBnumBySeekPosition(inode, seek_pos);
-        if (bnum == ERROR) {
-            free(buf);
-            msg->type = ERROR;
-            Reply((void*)msg, pid);
-            return;
+    int done = 0;
+    for (; i < count && done < len; ++i) {
+        int chunk = iov[i].len - offset;
+        if (chunk > len - done) {
+            chunk = len - done;
         }
 
-        char* block = (char*)GetBlockByBnum(bnum);
-        int remaining_len = BLOCKSIZE - (seek_pos % BLOCKSIZE);
-        if (remaining_len < size) {
-            memcpy(block, block + seek_pos % BLOCKSIZE, remaining_len);
-            len += remaining_len;
-            seek_pos += remaining_len;
-            size -= remaining_len;
-            continue;
+        char* base = (char*)iov[i].base + offset;
+        int status = to_client ? YfsCopyTo(pid, (void*)base, (void*)(buf + done), chunk)
+            : YfsCopyFrom(pid, (void*)(buf + done), (void*)base, chunk);
+        if (status == ERROR) {
+            return ERROR;
         }
 
-        memcpy(block, block + seek_pos % BLOCKSIZE, size);
-        len += size;
-        seek_pos += size;
-        size = 0;
+        done += chunk;
+        offset = 0;
     }
 
-    if (CopyTo(pid, msg->addr1, (void*)buf, len) == ERROR) {
-        free(buf);
+    return 0;
+}
+
+/* Read up to size bytes at pos into the segments, return the length read or ERROR */
+static int ReadSegments(OpenFile* file, int pid, struct IoVec* iov, int count, int size, int pos) {
+    /* Never buffer more than what is left in the file */
+    int remaining = file->inode->size - pos;
+    if (size > remaining) {
+        size = (remaining > 0) ? remaining : 0;
+    }
+    if (size == 0) {
+        return 0;
+    }
+
+    char* buf = AllocTransferBuffer(size);
+    if (buf == NULL) {
+        return ERROR;
+    }
+
+    int done = 0;
+    bool failed = false;
+    while (done < size) {
+        int chunk = TransferChunk(pos + done, size - done);
+        int len = ReadOpenFile(file, buf, chunk, pos + done);
+        if (len == ERROR || CopySegments(pid, iov, count, done, buf, len, true) == ERROR) {
+            failed = true;
+            break;
+        }
+
+        done += len;
+        if (len < chunk) {
+            break;
+        }
+    }
+
+    free(buf);
+    return (failed && done == 0) ? ERROR : done;
+}
+
+/* Write size bytes from the segments at pos, return the length written or ERROR */
+static int WriteSegments(OpenFile* file, int pid, struct IoVec* iov, int count, int size, int pos) {
+    /* Sizes and offsets are ints, so no file grows past INT_MAX bytes */
+    if (size > INT_MAX - pos) {
+        return ERROR;
+    }
+    if (size == 0) {
+        return 0;
+    }
+
+    char* buf = AllocTransferBuffer(size);
+    if (buf == NULL) {
+        return ERROR;
+    }
+
+    int done = 0;
+    while (done < size) {
+        int chunk = TransferChunk(pos + done, size - done);
+        if (CopySegments(pid, iov, count, done, buf, chunk, false) == ERROR) {
+            break;
+        }
+
+        int len = WriteOpenFile(file, buf, chunk, pos + done);
+        if (len == ERROR) {
+            break;
+        }
+
+        done += len;
+        if (len < chunk) {
+            break;
+        }
+    }
+
+    free(buf);
+    return (done > 0) ? done : ERROR;
+}
+
+/*
+ * Read data2 bytes from the handle in data1, at the handle's position or,
+ * for PREAD, at offset data3 without moving the position.
+ */
+static void ReadHandle(Message* msg, int pid, bool positional) {
+    FileHandle* handle = GetFileHandle(msg->data1, pid);
+    int size = msg->data2;
+    if (handle == NULL || size < 0 || (positional && msg->data3 < 0)) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
-    free(buf);
+    struct IoVec iov;
+    iov.base = msg->addr1;
+    iov.len = size;
+    int pos = positional ? msg->data3 : handle->pos;
+    int len = ReadSegments(handle->file, pid, &iov, 1, size, pos);
+    if (len == ERROR) {
+        msg->type = ERROR;
+        YfsReply(msg, pid);
+        return;
+    }
+
+    NoteRequestFile(handle->file->inum, len);
+    if (!positional) {
+        handle->pos += len;
+    }
     msg->type = len;
-    Reply((void*)msg, pid);
+    YfsReply(msg, pid);
 }
 
-void YfsWrite(Message* msg, int pid) {
-    printf("Executing YfsWrite()\n");
-    struct inode* inode = GetInodeByInum(msg->data1);
-    if (inode == NULL) {
+/* Write counterpart of ReadHandle */
+static void WriteHandle(Message* msg, int pid, bool positional) {
+    FileHandle* handle = GetFileHandle(msg->data1, pid);
+    int size = msg->data2;
+    if (handle == NULL || size < 0 || (positional && msg->data3 < 0)) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
     /* Check inode's type */
-    if (inode->type == INODE_DIRECTORY) {
+    if (handle->file->inode->type == INODE_DIRECTORY) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
-    int size = msg->data2;
-    int seek_pos = msg->data3;
-    char* buf = (char*)malloc(size);
-    if (CopyFrom(pid, (void*)buf, msg->addr1, size) == ERROR) {
+    struct IoVec iov;
+    iov.base = msg->addr1;
+    iov.len = size;
+    int pos = positional ? msg->data3 : handle->pos;
+    int len = WriteSegments(handle->file, pid, &iov, 1, size, pos);
+    if (len == ERROR) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
-    int len = 0;
-    while (size > 0) {
-        int bnum = GetBnumBySeekPosition(inode, seek_pos);
-        if (bnum == ERROR) {
-            bnum = AllocateBlockInInode(inode, msg->data1);
-            if (bnum == ERROR) {
-                msg->type = ERROR;
-                Reply((void*)msg, pid);
-                return;
-            }
-        }
+    if (!positional) {
+        handle->pos += len;
+    }
+    msg->type = len;
+    YfsReply(msg, pid);
+}
 
-        char* block = (char*)GetBlockByBnum(bnum);
-        int remaining_len = BLOCKSIZE - (seek_pos % BLOCKSIZE);
-        if (remaining_len < size) {
-            memcpy(block + seek_pos % BLOCKSIZE, buf + len, remaining_len);
-            len += remaining_len;
-            seek_pos += remaining_len;
-            size -= remaining_len;
-            SetDirty(block_cache, bnum);
-            continue;
-        }
+void YfsRead(Message* msg, int pid) {
+    LOG_DEBUG("Executing YfsRead()\n");
+    ReadHandle(msg, pid, false);
+}
+
+void YfsWrite(Message* msg, int pid) {
+    LOG_DEBUG("Executing YfsWrite()\n");
+    WriteHandle(msg, pid, false);
+}
+
+void YfsPRead(Message* msg, int pid) {
+    LOG_DEBUG("Executing YfsPRead()\n");
+    ReadHandle(msg, pid, true);
+}
+
+void YfsPWrite(Message* msg, int pid) {
+    LOG_DEBUG("Executing YfsPWrite()\n");
+    WriteHandle(msg, pid, true);
+}
 
-        memcpy(block + seek_pos % BLOCKSIZE, buf + len, size);
-        len += size;
-        seek_pos += size;
-        size = 0;
-        SetDirty(block_cache, bnum);
+/* Copy in the data2 segments at addr1, return their total length */
+static int CopyIoVec(Message* msg, int pid, struct IoVec* iov) {
+    int count = msg->data2;
+    if (count <= 0 || count > MAX_IOVEC) {
+        return ERROR;
     }
 
-    free(buf);
-    if (seek_pos > inode->size) {
-        inode->size = seek_pos;
-        SetDirty(inode_cache, msg->data1);
+    if (YfsCopyFrom(pid, (void*)iov, msg->addr1, count * sizeof(struct IoVec)) == ERROR) {
+        return ERROR;
+    }
+
+    int total = 0;
+    int i;
+    for (i = 0; i < count; ++i) {
+        if (iov[i].len < 0 || iov[i].len > INT_MAX - total) {
+            return ERROR;
+        }
+
+        total += iov[i].len;
     }
 
+    return total;
+}
+
+/*
+ * Scatter one contiguous read over data2 segments.  data3 is the file
+ * offset, or -1 to read at and advance the handle's position.
+ */
+void YfsReadV(Message* msg, int pid) {
+    LOG_DEBUG("Executing YfsReadV()\n");
+    FileHandle* handle = GetFileHandle(msg->data1, pid);
+    struct IoVec iov[MAX_IOVEC];
+    int size = CopyIoVec(msg, pid, iov);
+    if (handle == NULL || size == ERROR)
+        {ErrorHandler(msg,pid); return;}
+
+    int pos = (msg->data3 < 0) ? handle->pos : msg->data3;
+    int len = ReadSegments(handle->file, pid, iov, msg->data2, size, pos);
+    if (len == ERROR)
+        {ErrorHandler(msg,pid); return;}
+
+    NoteRequestFile(handle->file->inum, len);
+    if (msg->data3 < 0) {
+        handle->pos += len;
+    }
     msg->type = len;
-    Reply((void*)msg, pid);
+    YfsReply(msg, pid);
 }
 
-void YfsSeek(Message* msg, int pid) {
-    printf("Executing YfsSeek()\n");
+/* Gather data2 segments and write them as one contiguous range */
+void YfsWriteV(Message* msg, int pid) {
+    LOG_DEBUG("Executing YfsWriteV()\n");
+    FileHandle* handle = GetFileHandle(msg->data1, pid);
+    struct IoVec iov[MAX_IOVEC];
+    int size = CopyIoVec(msg, pid, iov);
+    if (handle == NULL || size == ERROR)
+        {ErrorHandler(msg,pid); return;}
+    if (handle->file->inode->type == INODE_DIRECTORY)
+        {ErrorHandler(msg,pid); return;}
 
-    /* Get newest file size */
-    struct inode* inode = GetInodeByInum(msg->data1);
-    if (inode == NULL) {
-        msg->type = ERROR;
-        Reply((void*)msg, pid);
-        return;
+    int pos = (msg->data3 < 0) ? handle->pos : msg->data3;
+    int len = WriteSegments(handle->file, pid, iov, msg->data2, size, pos);
+    if (len == ERROR)
+        {ErrorHandler(msg,pid); return;}
+
+    NoteRequestFile(handle->file->inum, len);
+    if (msg->data3 < 0) {
+        handle->pos += len;
     }
-    
-    int* pos_addr = NULL;
-    if (CopyFrom(pid, (void*)(pos_addr), msg->addr1, sizeof(int)) == ERROR) {
+    msg->type = len;
+    YfsReply(msg, pid);
+}
+
+void YfsSeek(Message* msg, int pid) {
+    LOG_DEBUG("Executing YfsSeek()\n");
+    FileHandle* handle = GetFileHandle(msg->data1, pid);
+    if (handle == NULL) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
+    /* The pinned inode always has the newest file size */
     int whence = msg->data3;
     switch (whence) {
         case SEEK_SET:
             whence = 0;
             break;
         case SEEK_CUR:
-            whence = *pos_addr;
+            whence = handle->pos;
             break;
         case SEEK_END:
-            whence = inode->size;
+            whence = handle->file->inode->size;
             break;
+        default:
+            msg->type = ERROR;
+            YfsReply(msg, pid);
+            return;
     }
 
+    /* Past the end is allowed, a write there leaves a hole */
     int seek_pos = whence + msg->data2;
-    if (seek_pos < 0 || seek_pos > inode->size) {
+    if (seek_pos < 0) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
+    handle->pos = seek_pos;
     msg->type = seek_pos;
-    Reply((void*)msg, pid);
+    YfsReply(msg, pid);
+}
+
+void YfsClose(Message* msg, int pid) {
+    LOG_DEBUG("Executing YfsClose()\n");
+    if (CloseFileHandle(msg->data1, pid) == ERROR) {
+        msg->type = ERROR;
+        YfsReply(msg, pid);
+        return;
+    }
+
+    msg->type = 0;
+    YfsReply(msg, pid);
 }
 
 void YfsLink(Message* msg, int pid) {
-    printf("Executing YfsLink()\n");
+    LOG_DEBUG("Executing YfsLink()\n");
     char oldname[MAXPATHNAMELEN];
     char newname[MAXPATHNAMELEN];
 
-    if (CopyFrom(pid, (void*)oldname, msg->addr1, MAXPATHNAMELEN) == ERROR) {
+    if (YfsCopyFrom(pid, (void*)oldname, msg->addr1, MAXPATHNAMELEN) == ERROR) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
     
-    if (CopyFrom(pid, (void*)newname, msg->addr2, MAXPATHNAMELEN) == ERROR) {
+    if (YfsCopyFrom(pid, (void*)newname, msg->addr2, MAXPATHNAMELEN) == ERROR) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
     
@@ -294,7 +496,7 @@ void YfsLink(Message* msg, int pid) {
     int old_dir_inum = ParsePathDir(msg->data1, oldname);
     if (old_dir_inum == ERROR) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
@@ -302,7 +504,7 @@ void YfsLink(Message* msg, int pid) {
     struct inode* dir_inode = GetInodeByInum(old_dir_inum);
     if (dir_inode == NULL) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
@@ -317,45 +519,53 @@ void YfsLink(Message* msg, int pid) {
 
     if (old == NULL || new_inum != ERROR) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
     if (old->type == INODE_DIRECTORY) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
     int new_dir_inum = ParsePathDir(msg->data1, newname);
     if (new_dir_inum == ERROR) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
     struct inode* new_dir_inode = GetInodeByInum(new_dir_inum);
     if (new_dir_inode == NULL) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
+        return;
+    }
+
+    /* The new entry takes the last component of newname */
+    int new_filename_index = GetFileNameIndex(newname);
+    if (new_filename_index == ERROR) {
+        msg->type = ERROR;
+        YfsReply(msg, pid);
         return;
     }
 
-    if (CreateDirEntry(new_dir_inode, new_dir_inum, old_inum, filename) == ERROR) {
+    if (CreateDirEntry(new_dir_inode, new_dir_inum, old_inum, newname + new_filename_index) == ERROR) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
     ++old->nlink;
     SetDirty(inode_cache, old_inum);
-    Reply((void*)msg, pid);
+    YfsReply(msg, pid);
 }
 
 void YfsUnlink(Message* msg, int pid) {
-    printf("Executing YfsUnlink()\n");
+    LOG_DEBUG("Executing YfsUnlink()\n");
     char pathname[MAXPATHNAMELEN];
-    if (CopyFrom(pid, (void*)pathname, msg->addr1, MAXPATHNAMELEN) == ERROR)
+    if (YfsCopyFrom(pid, (void*)pathname, msg->addr1, MAXPATHNAMELEN) == ERROR)
         {ErrorHandler(msg,pid); return;}
 
     /* Get pathname's directory */
@@ -385,24 +595,24 @@ void YfsUnlink(Message* msg, int pid) {
     if (DeleteDirEntry(dir_inode, file_dir_inum, file_inum) == ERROR)
         {ErrorHandler(msg,pid); return;}
 
+    /* A big file is freed in the background, see reclaim.h */
     if (!(--file_inode->nlink)) {
-        RecycleBlocksInInode(file_inum);
-        RecycleFreeInode(file_inum);
+        ReleaseInode(file_inum);
     }
 
     SetDirty(inode_cache, file_inum);
-    Reply((void*)msg, pid);
+    YfsReply(msg, pid);
     return;
 }
 
 void YfsSymLink(Message* msg, int pid) {
-    printf("Executing YfsSymLink()\n");
+    LOG_DEBUG("Executing YfsSymLink()\n");
     char oldname[MAXPATHNAMELEN];
     char newname[MAXPATHNAMELEN];
 
-    if (CopyFrom(pid, (void*)oldname, msg->addr1, MAXPATHNAMELEN) == ERROR)
+    if (YfsCopyFrom(pid, (void*)oldname, msg->addr1, MAXPATHNAMELEN) == ERROR)
         {ErrorHandler(msg,pid); return;} 
-    if (CopyFrom(pid, (void*)newname, msg->addr2, MAXPATHNAMELEN) == ERROR)
+    if (YfsCopyFrom(pid, (void*)newname, msg->addr2, MAXPATHNAMELEN) == ERROR)
         {ErrorHandler(msg,pid); return;}
     /* Null pathname */
     if (oldname[0] == '\0')
@@ -418,12 +628,7 @@ void YfsSymLink(Message* msg, int pid) {
         {ErrorHandler(msg,pid); return;}
 
     /* Get inode of pathname's directory */
-     /* Get pathname's directory */
-    int file_dir_inum = ParsePathDir(msg->data1, pathname);
-    if (file_dir_inum == ERROR)
-       {ErrorHandler(msg,pid); return;}
-   
-    struct inode* dir_inode = GetInodeByInum(file_dir_inum);
+    struct inode* dir_inode = GetInodeByInum(dir_inum);
     if (dir_inode == NULL)
         {ErrorHandler(msg,pid); return;}
 
@@ -435,7 +640,7 @@ void YfsSymLink(Message* msg, int pid) {
     if (strcmp(filename, ".") == 0 || strcmp(filename, "..") == 0)
         {ErrorHandler(msg,pid); return;}
     /* Check if newname exists again */
-    inum = GetInumByComponentName(dir_inode, filename);
+    int inum = GetInumByComponentName(dir_inode, filename);
     if (inum)
         {ErrorHandler(msg,pid); return;}
 
@@ -443,7 +648,7 @@ void YfsSymLink(Message* msg, int pid) {
     if (inum == ERROR)
        {ErrorHandler(msg,pid); return;}
 
-    struct new_inode* inode = GetInodeByInum(inum);
+    struct inode* inode = GetInodeByInum(inum);
     if (inode == NULL)
         {ErrorHandler(msg,pid); return;}
 
@@ -460,35 +665,55 @@ void YfsSymLink(Message* msg, int pid) {
     if (CreateDirEntry(dir_inode, dir_inum, inum, filename) == ERROR)
         {ErrorHandler(msg,pid); return;}
     
-    /* Allocate a new block to store oldname */
-    int bnum = AllocateBlockInInode(inode,inum);
-    if (bnum == ERROR)
-       {ErrorHandler(msg,pid); return;}
-    void* block = GetBlockByBnum(bnum);
-    if (block == NULL)
-       {ErrorHandler(msg,pid); return;}
+    /* A short oldname fits in the inode */
+    int len = strlen(oldname);
+    if (len <= INLINE_SIZE) {
+        memcpy(inode->direct, oldname, len);
+        inode->indirect = INLINE_DATA;
+        inode->size = len;
+        SetDirty(inode_cache,inum);
+        YfsReply(msg, pid);
+        return;
+    }
+
     /* Path name should be stored in one block */
     if (BLOCKSIZE < MAXPATHNAMELEN)
         {ErrorHandler(msg,pid); return;}
-    
-    memcpy(block, oldname, sizeof(oldname));
-    inode->size = sizeof(oldname);
 
+    /* Store oldname in fragments shared with other tails, or a block of its own */
+    int bnum;
+    char* block;
+    if (TAIL_FRAGS(len) < FRAGS_PER_BLOCK) {
+        int ptr = AllocateFragments(TAIL_FRAGS(len));
+        if (ptr == ERROR)
+           {ErrorHandler(msg,pid); return;}
+        if (SetBlockPointer(inode, inum, 0, ptr) == ERROR)
+           {RecycleFragments(ptr, TAIL_FRAGS(len)); ErrorHandler(msg,pid); return;}
+        bnum = TAIL_BLOCK(ptr);
+        block = GetTailData(ptr);
+        memset(block, 0, TAIL_FRAGS(len) * FRAGSIZE);
+    } else {
+        bnum = AllocateBlockInInode(inode,inum);
+        if (bnum == ERROR)
+           {ErrorHandler(msg,pid); return;}
+        block = GetNewBlock(bnum);
+    }
+
+    memcpy(block, oldname, len);
+    inode->size = len;
+
+    SetDirty(inode_cache,inum);
     SetDirty(block_cache,bnum);
+    JournalBlock(bnum);
     
-    Reply((void*)msg, pid);
+    YfsReply(msg, pid);
     return;
-
-    ERR:
-        msg->type = ERROR;
-        Reply((void*)msg, pid);
-        return;
 }
 
 void YfsReadLink(Message* msg, int pid) {
-    printf("Executing YfsReadLink()\n");
+    LOG_DEBUG("Executing YfsReadLink()\n");
     char pathname[MAXPATHNAMELEN];
-    if (CopyFrom(pid, (void*)pathname, msg->addr1, MAXPATHNAMELEN) == ERROR)
+    if (YfsCopyFrom(pid, (void*)pathname, msg->addr1, MAXPATHNAMELEN) == ERROR)
         {ErrorHandler(msg,pid); return;}
 
     int maxLen = msg->data2;
@@ -518,15 +743,12 @@ void YfsReadLink(Message* msg, int pid) {
     if (file_inode->type != INODE_SYMLINK)
         {ErrorHandler(msg,pid); return;}
 
-    /* Oldname should be stored in first block */
-    int bnum = file_inode->direct[0];
-    if (bnum == 0)
-        {ErrorHandler(msg,pid); return;}
-    void* block = GetBlockByBnum(bnum);
+    /* Oldname is stored in the inode or its first block */
+    char* block = GetLinkTarget(file_inode);
     if (block == NULL)
         {ErrorHandler(msg,pid); return;}
 
-    int actualLen = strlen((char *)block);
+    int actualLen = file_inode->size;
     /* Oldname length == MAXPATHNAMELEN */
     if (actualLen > MAXPATHNAMELEN)
         actualLen = MAXPATHNAMELEN;
@@ -534,21 +756,22 @@ void YfsReadLink(Message* msg, int pid) {
     if (actualLen < maxLen)
         maxLen = actualLen;
 
-    if (CopyTo(pid, msg->addr2, block, maxLen) == ERROR)
+    if (YfsCopyTo(pid, msg->addr2, block, maxLen) == ERROR)
         {ErrorHandler(msg,pid); return;}
 
-    Reply((void*)msg, pid);
+    msg->type = maxLen;
+    YfsReply(msg, pid);
     return;
 }
 
 void YfsMkDir(Message* msg, int pid) {
-    printf("Executing YfsMkDir()\n");
+    LOG_DEBUG("Executing YfsMkDir()\n");
     char pathname[MAXPATHNAMELEN];
-    if (CopyFrom(pid, (void*)pathname, msg->addr1, MAXPATHNAMELEN) == ERROR)
+    if (YfsCopyFrom(pid, (void*)pathname, msg->addr1, MAXPATHNAMELEN) == ERROR)
         {ErrorHandler(msg,pid); return;}
     /* new name exists */
     int new_inum = ParsePathName(msg->data1, pathname);
-    if (new_inum != Error)
+    if (new_inum != ERROR)
        {ErrorHandler(msg,pid); return;}
 
     /* Check if all directores is valid */
@@ -569,7 +792,7 @@ void YfsMkDir(Message* msg, int pid) {
     if (strcmp(filename, ".") == 0 || strcmp(filename, "..") == 0)
         {ErrorHandler(msg,pid); return;}
     /* Check if pathname exists again */
-    inum = GetInumByComponentName(dir_inode, filename);
+    int inum = GetInumByComponentName(dir_inode, filename);
     if (inum)
        {ErrorHandler(msg,pid); return;}
 
@@ -577,7 +800,7 @@ void YfsMkDir(Message* msg, int pid) {
     if (inum == ERROR)
         {ErrorHandler(msg,pid); return;}
 
-    struct new_inode* inode = GetInodeByInum(inum);
+    struct inode* inode = GetInodeByInum(inum);
     if (inode == NULL)
         {ErrorHandler(msg,pid); return;}
 
@@ -603,14 +826,14 @@ void YfsMkDir(Message* msg, int pid) {
     if (CreateDirEntry(inode, inum, dir_inum, parent) == ERROR)
         {ErrorHandler(msg,pid); return;}
 
-    Reply((void*)msg, pid);
+    YfsReply(msg, pid);
     return;  
 }
 
 void YfsRmDir(Message* msg, int pid) {
-    printf("Executing YfsRmDir()\n");
+    LOG_DEBUG("Executing YfsRmDir()\n");
     char pathname[MAXPATHNAMELEN];
-    if (CopyFrom(pid, (void*)pathname, msg->addr1, MAXPATHNAMELEN) == ERROR)
+    if (YfsCopyFrom(pid, (void*)pathname, msg->addr1, MAXPATHNAMELEN) == ERROR)
         {ErrorHandler(msg,pid); return;} 
 
     /* Get pathname's parent directory */
@@ -648,71 +871,70 @@ void YfsRmDir(Message* msg, int pid) {
 
     /* Recycle Inode if no more link */
     if (!(--inode->nlink)) {
-        RecycleBlocksInInode(inum);
-        RecycleFreeInode(inum);
+        ReleaseInode(inum);
     }
 
     SetDirty(inode_cache, inum);
-    Reply((void*)msg, pid);
+    YfsReply(msg, pid);
     return;        
 }
 
 void YfsChDir(Message* msg, int pid) {
-    printf("Executing YfsChDir()\n");
+    LOG_DEBUG("Executing YfsChDir()\n");
     char pathname[MAXPATHNAMELEN];
-    if (CopyFrom(pid, (void*)pathname, msg->addr1, MAXPATHNAMELEN) == ERROR) {
-        printf("CopyFrom() error\n");
+    if (YfsCopyFrom(pid, (void*)pathname, msg->addr1, MAXPATHNAMELEN) == ERROR) {
+        LOG_INFO("CopyFrom() error\n");
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
     int inum = ParsePathName(msg->data1, pathname);
     if (inum == ERROR) {
-        printf("ParsePathName() error\n");
+        LOG_INFO("ParsePathName() error\n");
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
     struct inode* inode = GetInodeByInum(inum);
     if (inode == NULL) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
     if (inode->type != INODE_DIRECTORY) {
-        printf("The path %s is not a directory\n", pathname);
+        LOG_INFO("The path %s is not a directory\n", pathname);
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
     msg->data1 = inum;
-    Reply((void*)msg, pid);
+    YfsReply(msg, pid);
 }
 
 void YfsStat(Message* msg, int pid) {
-    printf("Executing YfsStat()\n");
+    LOG_DEBUG("Executing YfsStat()\n");
     char pathname[MAXPATHNAMELEN];
-    if (CopyFrom(pid, (void*)pathname, msg->addr1, MAXPATHNAMELEN) == ERROR) {
+    if (YfsCopyFrom(pid, (void*)pathname, msg->addr1, MAXPATHNAMELEN) == ERROR) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
     int dir_inum = ParsePathDir(msg->data1, pathname);
     if (dir_inum == ERROR) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
     struct inode* dir_inode = GetInodeByInum(dir_inum);
     if (dir_inode == NULL) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
@@ -723,42 +945,449 @@ void YfsStat(Message* msg, int pid) {
     int inum = GetInumByComponentName(dir_inode, filename);
     if (inum == ERROR || inum == 0) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
     struct inode* inode = GetInodeByInum(inum);
     if (inode == NULL) {
         msg->type = ERROR;
-        Reply((void*)msg, pid);
+        YfsReply(msg, pid);
         return;
     }
 
+    NoteRequestFile(inum, inode->size);
     msg->type = inum;
     msg->data1 = inode->type;
     msg->data2 = inode->size;
     msg->data3 = inode->nlink;
-    Reply((void*)msg, pid);
+    YfsReply(msg, pid);
 }
 
 void YfsSync(Message* msg, int pid) {
-    printf("Executing YfsSync()\n");
-    SyncInodeCache();
-    SyncBlockCache();
-    Reply(msg, pid);
+    LOG_DEBUG("Executing YfsSync()\n");
+    SyncFileSystem();
+    FLUSH_RECORDS();
+    YfsReply(msg, pid);
 }
 
 void YfsShutDown(Message* msg, int pid) {
-    printf("Executing YfsShutDown()\n");
-    SyncInodeCache();
-    SyncBlockCache();
-    Reply(msg, pid);
-    printf("Yalnix File System is shuting down ...\n");
+    LOG_DEBUG("Executing YfsShutDown()\n");
+    FinishReclaim();
+    SyncFileSystem();
+    YfsReply(msg, pid);
+    DumpLatency();
+    DUMP_TRACE();
+    FLUSH_RECORDS();
+    LOG_INFO("Yalnix File System is shuting down ...\n");
     Exit(0);
 }
 
+/*
+ * Return up to data2 bytes of entries starting at entry index data3 (the
+ * cookie), each with its inode's type, size and nlink.  The next cookie
+ * goes back in data3 and the entry count in type; zero entries means the
+ * end of the directory.
+ */
+void YfsReadDirPlus(Message* msg, int pid) {
+    LOG_DEBUG("Executing YfsReadDirPlus()\n");
+    struct inode* dir_inode = GetInodeByInum(msg->data1);
+    if (dir_inode == NULL || dir_inode->type != INODE_DIRECTORY)
+        {ErrorHandler(msg,pid); return;}
+
+    int max_entries = msg->data2 / (int)sizeof(struct DirEntryPlus);
+    int cookie = msg->data3;
+    if (max_entries <= 0 || cookie < 0)
+        {ErrorHandler(msg,pid); return;}
+    if (max_entries > MAX_READDIR_ENTRIES) {
+        max_entries = MAX_READDIR_ENTRIES;
+    }
+
+    struct DirEntryPlus* entries = (struct DirEntryPlus*)calloc(max_entries, sizeof(struct DirEntryPlus));
+    int total_dir_entry = dir_inode->size / sizeof(struct dir_entry);
+    int count = 0;
+    int bnum = ERROR;
+    int i;
+    for (i = cookie; i < total_dir_entry && count < max_entries; ++i) {
+        /* Walk the block map once per directory block, not per entry */
+        if (bnum == ERROR || i % DIR_ENTRY_PER_BLOCK == 0) {
+            bnum = GetBnumBySeekPosition(dir_inode, i * sizeof(struct dir_entry));
+        }
+
+        /* Inode lookups below may evict it, so look it up every entry */
+        struct dir_entry* block = (bnum == ERROR) ? NULL : (struct dir_entry*)GetBlockByBnum(bnum);
+        if (block == NULL) {
+            free(entries);
+            ErrorHandler(msg, pid);
+            return;
+        }
+
+        struct dir_entry entry = block[i % DIR_ENTRY_PER_BLOCK];
+        if (entry.inum <= 0) {
+            continue;
+        }
+
+        struct inode* inode = GetInodeByInum(entry.inum);
+        if (inode == NULL) {
+            continue;
+        }
+
+        struct DirEntryPlus* plus = entries + count;
+        plus->inum = entry.inum;
+        plus->type = inode->type;
+        plus->size = inode->size;
+        plus->nlink = inode->nlink;
+        memcpy(plus->name, entry.name, DIRNAMELEN);
+        ++count;
+    }
+
+    if (count > 0 && YfsCopyTo(pid, msg->addr1, (void*)entries, count * sizeof(struct DirEntryPlus)) == ERROR) {
+        free(entries);
+        ErrorHandler(msg, pid);
+        return;
+    }
+
+    free(entries);
+    msg->type = count;
+    msg->data3 = i;
+    YfsReply(msg, pid);
+}
+
+/*
+ * Copy up to data2 bytes of struct YfsStats to addr1, then reset every
+ * counter if data1 is nonzero.  Reply with the number of bytes copied.
+ */
+void YfsStats(Message* msg, int pid) {
+    LOG_DEBUG("Executing YfsStats()\n");
+    struct YfsStats stats;
+    FillStats(&stats);
+
+    int len = msg->data2;
+    if (len < 0)
+        {ErrorHandler(msg,pid); return;}
+    if (len > (int)sizeof(struct YfsStats)) {
+        len = sizeof(struct YfsStats);
+    }
+
+    if (YfsCopyTo(pid, msg->addr1, (void*)&stats, len) == ERROR)
+        {ErrorHandler(msg,pid); return;}
+
+    if (msg->data1) {
+        ResetStats();
+    }
+
+    msg->type = len;
+    YfsReply(msg, pid);
+}
+
+/* Print the latency histograms, then reset them if data1 is nonzero */
+void YfsLatency(Message* msg, int pid) {
+    LOG_DEBUG("Executing YfsLatency()\n");
+    DumpLatency();
+    DUMP_TRACE();
+
+    if (msg->data1) {
+        ResetLatency();
+    }
+
+    msg->type = 0;
+    YfsReply(msg, pid);
+}
+
+/* Cut or grow the file open on handle data1 to data2 bytes */
+void YfsFTruncate(Message* msg, int pid) {
+    LOG_DEBUG("Executing YfsFTruncate()\n");
+    FileHandle* handle = GetFileHandle(msg->data1, pid);
+    if (handle == NULL)
+        {ErrorHandler(msg,pid); return;}
+    if (TruncateOpenFile(handle->file, msg->data2) == ERROR)
+        {ErrorHandler(msg,pid); return;}
+
+    NoteRequestFile(handle->file->inum, msg->data2);
+    msg->type = 0;
+    YfsReply(msg, pid);
+}
+
+/* YfsFTruncate for the file at pathname addr1, relative to directory data1 */
+void YfsTruncate(Message* msg, int pid) {
+    LOG_DEBUG("Executing YfsTruncate()\n");
+    char pathname[MAXPATHNAMELEN];
+    if (YfsCopyFrom(pid, (void*)pathname, msg->addr1, MAXPATHNAMELEN) == ERROR)
+        {ErrorHandler(msg,pid); return;}
+
+    int inum = ParsePathName(msg->data1, pathname);
+    if (inum == ERROR)
+        {ErrorHandler(msg,pid); return;}
+
+    /* Through a handle of its own, so the file's block map is used and kept current */
+    int handle = OpenFileHandle(inum, pid);
+    if (handle == ERROR)
+        {ErrorHandler(msg,pid); return;}
+
+    int ret = TruncateOpenFile(GetFileHandle(handle, pid)->file, msg->data2);
+    CloseFileHandle(handle, pid);
+    if (ret == ERROR)
+        {ErrorHandler(msg,pid); return;}
+
+    NoteRequestFile(inum, msg->data2);
+    msg->type = 0;
+    YfsReply(msg, pid);
+}
+
+static bool IsDotName(char* name) {
+    return strcmp(name, ".") == 0 || strcmp(name, "..") == 0;
+}
+
+/* True if directory inum is ancestor or below it, or its ".." chain is broken */
+static bool IsWithinDirectory(int inum, int ancestor) {
+    int depth;
+    for (depth = 0; depth < header.num_inodes; ++depth) {
+        if (inum == ancestor) {
+            return true;
+        }
+
+        if (inum == ROOTINODE) {
+            return false;
+        }
+
+        struct inode* inode = GetInodeByInum(inum);
+        if (inode == NULL) {
+            return true;
+        }
+
+        inum = GetInumByComponentName(inode, "..");
+        if (inum <= 0) {
+            return true;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Move the entry oldname to newname in one transaction, replacing what
+ * newname named: a file or symbolic link by anything but a directory,
+ * an empty directory by a directory.  Only directory blocks change.
+ */
+void YfsRename(Message* msg, int pid) {
+    LOG_DEBUG("Executing YfsRename()\n");
+    char oldname[MAXPATHNAMELEN];
+    char newname[MAXPATHNAMELEN];
+
+    if (YfsCopyFrom(pid, (void*)oldname, msg->addr1, MAXPATHNAMELEN) == ERROR)
+        {ErrorHandler(msg,pid); return;}
+    if (YfsCopyFrom(pid, (void*)newname, msg->addr2, MAXPATHNAMELEN) == ERROR)
+        {ErrorHandler(msg,pid); return;}
+    if (oldname[0] == '\0' || newname[0] == '\0')
+        {ErrorHandler(msg,pid); return;}
+
+    int old_dir_inum = ParsePathDir(msg->data1, oldname);
+    int new_dir_inum = ParsePathDir(msg->data1, newname);
+    if (old_dir_inum == ERROR || new_dir_inum == ERROR)
+        {ErrorHandler(msg,pid); return;}
+
+    struct inode* old_dir = GetInodeByInum(old_dir_inum);
+    struct inode* new_dir = GetInodeByInum(new_dir_inum);
+    if (old_dir == NULL || new_dir == NULL)
+        {ErrorHandler(msg,pid); return;}
+
+    char* old_filename = oldname + GetFileNameIndex(oldname);
+    char* new_filename = newname + GetFileNameIndex(newname);
+    if (IsDotName(old_filename) || IsDotName(new_filename) || strlen(new_filename) > DIRNAMELEN)
+        {ErrorHandler(msg,pid); return;}
+
+    int inum = GetInumByComponentName(old_dir, old_filename);
+    struct inode* inode = GetInodeByInum(inum);
+    if (inode == NULL)
+        {ErrorHandler(msg,pid); return;}
+
+    int target_inum = GetInumByComponentName(new_dir, new_filename);
+    if (target_inum == ERROR)
+        {ErrorHandler(msg,pid); return;}
+
+    /* Both names already lead to the same inode */
+    if (target_inum == inum) {
+        msg->type = 0;
+        YfsReply(msg, pid);
+        return;
+    }
+
+    struct inode* target = NULL;
+    if (target_inum > 0) {
+        target = GetInodeByInum(target_inum);
+        if (target == NULL)
+            {ErrorHandler(msg,pid); return;}
+        if ((inode->type == INODE_DIRECTORY) != (target->type == INODE_DIRECTORY))
+            {ErrorHandler(msg,pid); return;}
+        if (target->type == INODE_DIRECTORY && CountDirEntry(target, target_inum) != 2)
+            {ErrorHandler(msg,pid); return;}
+    }
+
+    /* A directory can't move into itself or below */
+    bool moves_dir = inode->type == INODE_DIRECTORY && old_dir_inum != new_dir_inum;
+    if (moves_dir && IsWithinDirectory(new_dir_inum, inum))
+        {ErrorHandler(msg,pid); return;}
+
+    /* The new name first, so a failure leaves the old one in place */
+    int ret = (target != NULL) ? SetDirEntry(new_dir, new_dir_inum, new_filename, inum) :
+        CreateDirEntry(new_dir, new_dir_inum, inum, new_filename);
+    if (ret == ERROR)
+        {ErrorHandler(msg,pid); return;}
+
+    if (SetDirEntry(old_dir, old_dir_inum, old_filename, 0) == ERROR)
+        {ErrorHandler(msg,pid); return;}
+    if (moves_dir && SetDirEntry(inode, inum, "..", new_dir_inum) == ERROR)
+        {ErrorHandler(msg,pid); return;}
+
+    /* The replaced inode goes as in YfsUnlink */
+    if (target != NULL) {
+        if (!(--target->nlink)) {
+            ReleaseInode(target_inum);
+        }
+        SetDirty(inode_cache, target_inum);
+    }
+
+    msg->type = 0;
+    YfsReply(msg, pid);
+}
+
+static bool IsBatchable(int type) {
+    switch (type) {
+        case OPEN:
+        case CREATE:
+        case READ:
+        case WRITE:
+        case LINK:
+        case UNLINK:
+        case SYMLINK:
+        case MKDIR:
+        case RMDIR:
+        case STAT:
+        case RENAME:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void YfsBatch(Message* msg, int pid) {
+    LOG_DEBUG("Executing YfsBatch()\n");
+    int len = msg->data2;
+    int count = msg->data3;
+    if (current_batch != NULL || len <= 0 || len > MAX_BATCH_SIZE)
+        {ErrorHandler(msg,pid); return;}
+    if (count < 0 || count > len / (int)sizeof(struct BatchOp))
+        {ErrorHandler(msg,pid); return;}
+
+    char* buf = (char*)malloc(len);
+    if (buf == NULL || CopyFrom(pid, (void*)buf, msg->addr1, len) == ERROR) {
+        free(buf);
+        ErrorHandler(msg, pid);
+        return;
+    }
+
+    BatchContext batch;
+    batch.client_buf = (char*)msg->addr1;
+    batch.buf = buf;
+    batch.len = len;
+    current_batch = &batch;
+
+    /* Inode returned by the last OPEN, CREATE or STAT, for chaining */
+    int last_inum = ERROR;
+    struct BatchOp* ops = (struct BatchOp*)buf;
+    int i;
+    for (i = 0; i < count; ++i) {
+        struct BatchOp* op = ops + i;
+        Message sub;
+        memset(&sub, 0, sizeof(Message));
+        sub.type = op->type;
+
+        /* A chained op resolves against the previous op's inode */
+        int inum = (op->flags & BATCH_CHAIN) ? last_inum : op->inum;
+        if (!IsBatchable(op->type) || inum == ERROR) {
+            op->result = ERROR;
+            last_inum = ERROR;
+            continue;
+        }
+
+        /* Batched reads and writes go through a handle of their own */
+        int handle = ERROR;
+        if (op->type == READ || op->type == WRITE) {
+            handle = OpenFileHandle(inum, pid);
+            if (handle == ERROR) {
+                op->result = ERROR;
+                last_inum = ERROR;
+                continue;
+            }
+
+            GetFileHandle(handle, pid)->pos = op->offset;
+            sub.data1 = handle;
+            sub.data2 = op->size;
+            sub.addr1 = (void*)(batch.client_buf + op->data);
+        } else {
+            /* Path operations resolve relative to the client's directory */
+            sub.data1 = (op->flags & BATCH_CHAIN) ? inum : msg->data1;
+            sub.addr1 = (void*)(batch.client_buf + op->name);
+            sub.addr2 = (void*)(batch.client_buf + op->name2);
+        }
+
+        DispatchMessage(&sub, pid);
+
+        if (handle != ERROR) {
+            CloseFileHandle(handle, pid);
+        }
+
+        /* Batches return inode numbers, not handles */
+        if ((op->type == OPEN || op->type == CREATE) && sub.type != ERROR) {
+            CloseFileHandle(sub.data2, pid);
+        }
+
+        if (sub.type == ERROR) {
+            op->result = ERROR;
+            last_inum = ERROR;
+            continue;
+        }
+
+        switch (op->type) {
+            case OPEN:
+            case CREATE:
+                op->result = sub.data1;
+                last_inum = sub.data1;
+                break;
+            case READ:
+            case WRITE:
+                op->result = sub.type;
+                break;
+            case STAT:
+                op->result = 0;
+                op->stat.inum = sub.type;
+                op->stat.type = sub.data1;
+                op->stat.size = sub.data2;
+                op->stat.nlink = sub.data3;
+                last_inum = sub.type;
+                break;
+            default:
+                op->result = 0;
+                break;
+        }
+    }
+
+    current_batch = NULL;
+
+    /* Results and read data go back in one copy */
+    if (CopyTo(pid, msg->addr1, (void*)buf, len) == ERROR) {
+        free(buf);
+        ErrorHandler(msg, pid);
+        return;
+    }
+
+    free(buf);
+    msg->type = count;
+    YfsReply(msg, pid);
+}
+
 void ErrorHandler(Message* msg, int pid){
     msg->type = ERROR;
-    Reply((void*)msg, pid);
+    YfsReply(msg, pid);
     return;
 }
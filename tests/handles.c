@@ -0,0 +1,141 @@
+/*
+ *  Regression test: server handle numbers (see openfile.h).
+ *
+ *  Usage: handles disk_file
+ *
+ *  disk_file is formatted and one server, sent requests as if from
+ *  several processes, checks that a closed handle's number is refused
+ *  once its slot is reused, that a Close from a forked child that only
+ *  inherited a handle leaves it open for the parent, that a child that
+ *  used an inherited handle keeps it after the parent closes, and that
+ *  the inode cache shrinks back to its capacity once the files that
+ *  pinned it past that are closed.  Exit status is 0 if every check
+ *  passed.
+ *
+ *  RUN THIS COMMAND AS A UNIX PROGRAM, NOT AS A YALNIX PROGRAM.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <comp421/yalnix.h>
+#include <comp421/filesystem.h>
+#include "../include/yfs.h"
+#include "../include/image.h"
+#include "hosttest.h"
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("FAIL line %d: %s\n", __LINE__, #cond); \
+        return 1; \
+    } \
+} while (0)
+
+#define PARENT 100
+#define CHILD 101
+
+/* Files opened at once, more than the inode cache of a 64 inode disk holds */
+#define NUM_PINNED 40
+
+static char* disk_path;
+
+/* Send a request as process pid, return the reply's type */
+static int Request(int pid, int type, int data1, int data2, void* addr1, Message* reply) {
+    Message msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.type = type;
+    msg.data1 = data1;
+    msg.data2 = data2;
+    msg.addr1 = addr1;
+    DispatchMessage(&msg, pid);
+
+    if (reply != NULL) {
+        *reply = msg;
+    }
+    return msg.type;
+}
+
+/* Open or create pathname as pid, return the handle number or ERROR */
+static int OpenAs(int pid, int type, char* pathname) {
+    Message reply;
+    if (Request(pid, type, ROOTINODE, 0, pathname, &reply) == ERROR) {
+        return ERROR;
+    }
+
+    return reply.data2;
+}
+
+/* PRead size bytes from the start of the file */
+static int ReadAs(int pid, int handle, char* buf, int size) {
+    return Request(pid, PREAD, handle, size, buf, NULL);
+}
+
+static int Tester(int journal_blocks) {
+    if (BootTestServer(disk_path, journal_blocks) == ERROR) {
+        return 1;
+    }
+
+    char buf[16];
+    int fd = Create("/a");
+    CHECK(fd != ERROR && Write(fd, "aaaa", 4) == 4 && Close(fd) == 0);
+    fd = Create("/b");
+    CHECK(fd != ERROR && Write(fd, "bbbb", 4) == 4 && Close(fd) == 0);
+
+    /* A stale number doesn't reach the file that reuses its slot */
+    int a = OpenAs(PARENT, OPEN, "/a");
+    CHECK(a != ERROR);
+    CHECK(Request(PARENT, CLOSE, a, 0, NULL, NULL) == 0);
+    int b = OpenAs(PARENT, OPEN, "/b");
+    CHECK(b != ERROR && b != a);
+    CHECK(ReadAs(PARENT, a, buf, 4) == ERROR);
+    CHECK(Request(PARENT, CLOSE, a, 0, NULL, NULL) == ERROR);
+    CHECK(ReadAs(PARENT, b, buf, 4) == 4 && memcmp(buf, "bbbb", 4) == 0);
+
+    /* A child closing an inherited handle it never used leaves the parent's */
+    CHECK(Request(CHILD, CLOSE, b, 0, NULL, NULL) == 0);
+    CHECK(ReadAs(PARENT, b, buf, 4) == 4);
+
+    /* Once the child has used it, the handle lasts until both close */
+    CHECK(ReadAs(CHILD, b, buf, 4) == 4);
+    CHECK(Request(PARENT, CLOSE, b, 0, NULL, NULL) == 0);
+    CHECK(ReadAs(CHILD, b, buf, 4) == 4 && memcmp(buf, "bbbb", 4) == 0);
+    CHECK(Request(CHILD, CLOSE, b, 0, NULL, NULL) == 0);
+    CHECK(ReadAs(CHILD, b, buf, 4) == ERROR);
+
+    /* Open files pin their inodes past the cache's capacity, closing them gives it back */
+    int handles[NUM_PINNED];
+    char path[16];
+    int i;
+    for (i = 0; i < NUM_PINNED; ++i) {
+        sprintf(path, "/f%d", i);
+        handles[i] = OpenAs(PARENT, CREATE, path);
+        CHECK(handles[i] != ERROR);
+    }
+    printf("  %d inodes cached with %d files open, capacity %d\n", inode_cache->len,
+        NUM_PINNED, inode_cache->capacity);
+    CHECK(inode_cache->len > inode_cache->capacity);
+
+    for (i = 0; i < NUM_PINNED; ++i) {
+        CHECK(Request(PARENT, CLOSE, handles[i], 0, NULL, NULL) == 0);
+    }
+    printf("  %d inodes cached after closing them\n", inode_cache->len);
+    CHECK(inode_cache->len <= inode_cache->capacity);
+
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s disk_file\n", argv[0]);
+        return 2;
+    }
+    disk_path = argv[1];
+
+    if (FormatImage(disk_path, 64, 0) == ERROR) {
+        return 2;
+    }
+
+    int failures = RunServer(Tester, 0);
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures != 0;
+}
@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <comp421/yalnix.h>
+#include "../include/config.h"
+#include "../include/journal.h"
+#include "../include/hostshim.h"
+#include "hosttest.h"
+
+int BootTestServer(char* disk_file, int journal_blocks) {
+    CacheConfig config;
+    InitCacheConfig(&config);
+    JournalConfig journal_config;
+    InitJournalConfig(&journal_config);
+    journal_config.blocks = journal_blocks;
+    return BootHostServer(disk_file, &config, &journal_config);
+}
+
+int RunServer(int (*phase)(int), int journal_blocks) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* No Shutdown: the server just goes away */
+        int failed = phase(journal_blocks);
+        fflush(stdout);
+        _exit(failed);
+    }
+
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+        perror("fork");
+        return 1;
+    }
+
+    return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
@@ -0,0 +1,16 @@
+#ifndef __HOSTTEST_H__
+#define __HOSTTEST_H__
+
+/*
+ * Shared by the host regression tests.  Each server a test starts runs
+ * in a child process, so a later one mounts the image fresh, and may
+ * stop without Shutdown as if it had crashed.
+ */
+
+/* Start the server in this process on disk_file with a journal of journal_blocks */
+int BootTestServer(char* disk_file, int journal_blocks);
+
+/* Run phase(journal_blocks) in a child process, return 0 if it returned 0 */
+int RunServer(int (*phase)(int), int journal_blocks);
+
+#endif
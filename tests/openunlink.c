@@ -0,0 +1,147 @@
+/*
+ *  Regression test: a file unlinked while a handle is open on it keeps
+ *  its inode and blocks until the last handle closes (see reclaim.h).
+ *
+ *  Usage: openunlink disk_file
+ *
+ *  disk_file is formatted, then for a disk without and with a journal
+ *  one server unlinks an open file, writes and reads it through the
+ *  handle, checks a new file doesn't get its inode, and closes it.
+ *  It then unlinks a second open file and stops without closing it or
+ *  calling Shutdown.  A second server mounts the image.  The first file
+ *  must be gone after its close, the second after the mount, and the
+ *  free block count, which a disk with a journal reads from its free
+ *  map, must match a scan of the inodes.  Exit status is 0 if every
+ *  check passed.
+ *
+ *  RUN THIS COMMAND AS A UNIX PROGRAM, NOT AS A YALNIX PROGRAM.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <comp421/yalnix.h>
+#include <comp421/filesystem.h>
+#include "../include/yfs.h"
+#include "../include/reclaim.h"
+#include "../include/image.h"
+#include "hosttest.h"
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("FAIL line %d: %s\n", __LINE__, #cond); \
+        return 1; \
+    } \
+} while (0)
+
+/* Past the direct blocks, so the second file is reclaimed in slices */
+#define BIG_BLOCKS (NUM_DIRECT + 40)
+
+/* Stats to wait for the queue to drain, far more than the slices needed */
+#define MAX_STATS 10000
+
+static char* disk_path;
+
+static int Inum(char* pathname) {
+    struct Stat stat;
+    return (Stat(pathname, &stat) == ERROR) ? ERROR : stat.inum;
+}
+
+static void Drain(void) {
+    int i;
+    for (i = 0; i < MAX_STATS && PendingReclaims() > 0; ++i) {
+        Inum("/");
+    }
+}
+
+/* The free count the server keeps must match the inodes on disk */
+static int CheckImage(int files) {
+    Sync();
+    ImageStats image;
+    ScanImage(&image);
+    printf("  %d free blocks, scan %d, %d files\n", num_free_blocks, image.free_blocks,
+        image.files);
+    CHECK(image.free_blocks == num_free_blocks);
+    CHECK(image.files == files);
+    return 0;
+}
+
+static int Unlinker(int journal_blocks) {
+    if (BootTestServer(disk_path, journal_blocks) == ERROR) {
+        return 1;
+    }
+
+    char data[4100];
+    char back[4100];
+    memset(data, 'a', 100);
+    memset(data + 100, 'b', 4000);
+
+    int fd = Create("/a");
+    CHECK(fd != ERROR);
+    CHECK(Write(fd, data, 100) == 100);
+    int inum = Inum("/a");
+    CHECK(Unlink("/a") == 0);
+    CHECK(Inum("/a") == ERROR);
+
+    /* The handle still reaches the file, which can grow */
+    CHECK(Write(fd, data + 100, 4000) == 4000);
+    CHECK(Seek(fd, 0, SEEK_SET) == 0);
+    CHECK(Read(fd, back, sizeof(back)) == (int)sizeof(back));
+    CHECK(memcmp(data, back, sizeof(back)) == 0);
+
+    int fd2 = Create("/b");
+    CHECK(fd2 != ERROR);
+    CHECK(Inum("/b") != inum);
+    CHECK(Close(fd2) == 0);
+
+    CHECK(Close(fd) == 0);
+    Drain();
+    CHECK(GetInodeByInum(inum)->type == INODE_FREE);
+    if (CheckImage(1) != 0) {
+        return 1;
+    }
+
+    /* Left open and unlinked when the server goes away */
+    int size = BIG_BLOCKS * BLOCKSIZE;
+    char* buf = (char*)calloc(1, size);
+    fd = Create("/c");
+    CHECK(fd != ERROR);
+    CHECK(Write(fd, buf, size) == size);
+    CHECK(Unlink("/c") == 0);
+    CHECK(Write(fd, buf, BLOCKSIZE) == BLOCKSIZE);
+    Drain();
+    return CheckImage(2);
+}
+
+static int Remounter(int journal_blocks) {
+    if (BootTestServer(disk_path, journal_blocks) == ERROR) {
+        return 1;
+    }
+
+    Drain();
+    CHECK(PendingReclaims() == 0);
+    return CheckImage(1);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s disk_file\n", argv[0]);
+        return 2;
+    }
+    disk_path = argv[1];
+
+    int journals[] = {0, 64};
+    int failures = 0;
+    int i;
+    for (i = 0; i < 2; ++i) {
+        if (FormatImage(disk_path, 64, 0) == ERROR) {
+            return 2;
+        }
+
+        printf("journal %d:\n", journals[i]);
+        failures += RunServer(Unlinker, journals[i]) || RunServer(Remounter, journals[i]);
+    }
+
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures != 0;
+}
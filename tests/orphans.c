@@ -0,0 +1,112 @@
+/*
+ *  Regression test: files unlinked while their blocks were still being
+ *  reclaimed in the background (see reclaim.h) when the server went
+ *  away are freed after the next mount, without another unlink.
+ *
+ *  Usage: orphans disk_file
+ *
+ *  disk_file is formatted, then for a disk without and with a journal
+ *  one server unlinks a file too big to free at once and stops without
+ *  Shutdown, and a second one mounts the image and only Stats "/" until
+ *  the queue is empty.  The image must then hold no files and the free
+ *  block count must match a scan of the inodes.  Exit status is 0 if
+ *  every check passed.
+ *
+ *  RUN THIS COMMAND AS A UNIX PROGRAM, NOT AS A YALNIX PROGRAM.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <comp421/yalnix.h>
+#include <comp421/filesystem.h>
+#include "../include/yfs.h"
+#include "../include/reclaim.h"
+#include "../include/image.h"
+#include "hosttest.h"
+
+/* Enough blocks for several slices: past the direct ones and one full indirect block */
+#define FILE_BLOCKS(bs) (NUM_DIRECT + 2 * ((bs) / (int)sizeof(int)) + 5)
+
+/* Stats to wait for the queue to drain, far more than the slices needed */
+#define MAX_STATS 10000
+
+static char* disk_path;
+
+/* Write a big file, unlink it, and stop with its blocks only partly freed */
+static int Unlinker(int journal_blocks) {
+    if (BootTestServer(disk_path, journal_blocks) == ERROR) {
+        return 1;
+    }
+
+    int size = FILE_BLOCKS(BLOCKSIZE) * BLOCKSIZE;
+    char* buf = (char*)calloc(1, size);
+    int fd = Create("/big");
+    if (fd == ERROR || Write(fd, buf, size) != size || Close(fd) == ERROR) {
+        printf("FAIL: can't write /big\n");
+        return 1;
+    }
+
+    if (Unlink("/big") == ERROR || Sync() == ERROR) {
+        printf("FAIL: can't unlink /big\n");
+        return 1;
+    }
+
+    if (PendingReclaims() == 0) {
+        printf("FAIL: /big was freed at once, nothing left to test\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+static int Remounter(int journal_blocks) {
+    if (BootTestServer(disk_path, journal_blocks) == ERROR) {
+        return 1;
+    }
+
+    if (PendingReclaims() == 0) {
+        printf("FAIL: mount found nothing to reclaim\n");
+        return 1;
+    }
+
+    struct Stat stat;
+    int i;
+    for (i = 0; i < MAX_STATS && PendingReclaims() > 0; ++i) {
+        Stat("/", &stat);
+    }
+
+    Sync();
+    ImageStats image;
+    ScanImage(&image);
+    printf("journal %d: reclaimed after %d requests, %d free blocks, scan %d, %d files\n",
+        journal_blocks, i, num_free_blocks, image.free_blocks, image.files);
+    if (PendingReclaims() > 0 || image.files != 0 || image.free_blocks != num_free_blocks) {
+        printf("FAIL: orphan not reclaimed\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s disk_file\n", argv[0]);
+        return 2;
+    }
+    disk_path = argv[1];
+
+    int journals[] = {0, 64};
+    int failures = 0;
+    int i;
+    for (i = 0; i < 2; ++i) {
+        if (FormatImage(disk_path, 64, 0) == ERROR) {
+            return 2;
+        }
+
+        failures += RunServer(Unlinker, journals[i]) || RunServer(Remounter, journals[i]);
+    }
+
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures != 0;
+}
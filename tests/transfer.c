@@ -0,0 +1,109 @@
+/*
+ *  Regression test: moving request data in pieces (see yfscall.c).
+ *
+ *  Usage: transfer disk_file
+ *
+ *  disk_file is formatted and one server checks that a WriteV whose
+ *  segment lengths add up past INT_MAX is refused, that a write reaching
+ *  past the largest file size is refused, and that writes and reads many
+ *  times the staging buffer, at odd offsets and over several segments,
+ *  round trip every byte.  Exit status is 0 if every check passed.
+ *
+ *  RUN THIS COMMAND AS A UNIX PROGRAM, NOT AS A YALNIX PROGRAM.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <comp421/yalnix.h>
+#include <comp421/filesystem.h>
+#include <comp421/iolib.h>
+#include "../include/image.h"
+#include "hosttest.h"
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("FAIL line %d: %s\n", __LINE__, #cond); \
+        return 1; \
+    } \
+} while (0)
+
+/* Bytes written, many staging buffers long and not a whole number of blocks */
+#define DATA_SIZE (150 * 1024 + 77)
+#define DATA_POS 1000
+
+static char* disk_path;
+static char data[DATA_SIZE];
+static char back[DATA_SIZE];
+
+static int Tester(int journal_blocks) {
+    if (BootTestServer(disk_path, journal_blocks) == ERROR) {
+        return 1;
+    }
+
+    int i;
+    for (i = 0; i < DATA_SIZE; ++i) {
+        data[i] = (char)(i * 7 + i / 251);
+    }
+
+    int fd = Create("/big");
+    CHECK(fd != ERROR);
+
+    /* Lengths whose sum overflows an int, and a write past the largest size */
+    struct IoVec iov[3];
+    iov[0].base = data;
+    iov[0].len = INT_MAX;
+    iov[1].base = data;
+    iov[1].len = INT_MAX;
+    CHECK(WriteV(fd, iov, 2) == ERROR);
+    iov[1].len = 1;
+    CHECK(WriteV(fd, iov, 2) == ERROR);
+    CHECK(PWrite(fd, data, 2, INT_MAX - 1) == ERROR);
+
+    /* One write, then reads in three unequal segments */
+    CHECK(PWrite(fd, data, DATA_SIZE, DATA_POS) == DATA_SIZE);
+    memset(back, 0, DATA_SIZE);
+    iov[0].base = back;
+    iov[0].len = 3;
+    iov[1].base = back + 3;
+    iov[1].len = DATA_SIZE / 2;
+    iov[2].base = back + 3 + DATA_SIZE / 2;
+    iov[2].len = DATA_SIZE - 3 - DATA_SIZE / 2;
+    CHECK(Seek(fd, DATA_POS, SEEK_SET) == DATA_POS);
+    CHECK(ReadV(fd, iov, 3) == DATA_SIZE);
+    CHECK(memcmp(data, back, DATA_SIZE) == 0);
+
+    /* Three segments written, read back in one */
+    iov[0].base = data;
+    iov[1].base = data + 3;
+    iov[2].base = data + 3 + DATA_SIZE / 2;
+    CHECK(Seek(fd, 0, SEEK_SET) == 0);
+    CHECK(WriteV(fd, iov, 3) == DATA_SIZE);
+    memset(back, 0, DATA_SIZE);
+    CHECK(PRead(fd, back, DATA_SIZE, 0) == DATA_SIZE);
+    CHECK(memcmp(data, back, DATA_SIZE) == 0);
+
+    /* A read past the end stops at it */
+    CHECK(PRead(fd, back, DATA_SIZE, DATA_POS + 10) == DATA_SIZE - 10);
+    CHECK(Close(fd) == 0);
+
+    printf("  %d bytes written and read back\n", DATA_SIZE);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s disk_file\n", argv[0]);
+        return 2;
+    }
+    disk_path = argv[1];
+
+    if (FormatImage(disk_path, 64, 0) == ERROR) {
+        return 2;
+    }
+
+    int failures = RunServer(Tester, 0) + RunServer(Tester, 32);
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures != 0;
+}
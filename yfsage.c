@@ -0,0 +1,239 @@
+/*
+ *  Build an aged YFS image: format a DISK in the mkyfs layout, fill it
+ *  with files through the server (run in-process, see hostshim.c), then
+ *  churn it by deleting files and creating new ones so free space ends
+ *  up scattered the way it does on a file system that has been in use.
+ *  Prints a fragmentation summary of the result.
+ *
+ *  Usage: yfsage [-o disk_file] [-i inodes] [-B block_size] [-n files]
+ *		[-s mean_size] [-f fanout] [-c churn] [-r seed]
+ *
+ *	-o	image to write (default "DISK")
+ *	-n	files to create (default 100)
+ *	-s	mean file size in bytes (default 2048); sizes are log-normal
+ *		around it, capped at the largest file the server supports
+ *	-f	mean entries per directory (default 16): a new file starts
+ *		a new subdirectory one time in fanout, and directories
+ *		form a tree of the same fanout
+ *	-c	churn operations, each deleting a random file and creating
+ *		a new one of fresh size (default 2 * files)
+ *	-i	inodes (default enough for the files and directories)
+ *	-B	block size in bytes, a power of two multiple of the sector
+ *		size (default one sector)
+ *	-r	random seed (default 1), the same seed builds the same image
+ *
+ *  Files that don't fit are counted and skipped, so a full disk still
+ *  gives an image.
+ *
+ *  RUN THIS COMMAND AS A UNIX PROGRAM, NOT AS A YALNIX PROGRAM.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <comp421/yalnix.h>
+#include <comp421/filesystem.h>
+#include "include/iolib.h"
+#include "include/config.h"
+#include "include/hostshim.h"
+#include "include/image.h"
+
+#define DEFAULT_OUTPUT "DISK"
+
+/* Largest file with direct blocks and one indirect block */
+#define MAX_FILE_SIZE ((NUM_DIRECT + BLOCKSIZE / (int)sizeof(int)) * BLOCKSIZE)
+
+/* Spread of the log-normal size distribution */
+#define SIZE_SIGMA 1.0
+
+static int num_files = 100;
+static int mean_size = 2048;
+static int fanout = 16;
+static int churn = -1;
+
+/* What every file is written from, MAX_FILE_SIZE bytes once the block size is known */
+static char* data;
+
+/* Directory of every file slot, -1 once deleted */
+static int* file_dir;
+static int num_dirs = 0;
+
+static int failed_creates = 0;
+
+static double Uniform(void) {
+    return (drand48() * 0.999999) + 0.0000005;
+}
+
+static int RandomSize(void) {
+    double mu = log((double)mean_size) - SIZE_SIGMA * SIZE_SIGMA / 2;
+    double normal = sqrt(-2.0 * log(Uniform())) * cos(2 * M_PI * Uniform());
+    double size = exp(mu + SIZE_SIGMA * normal);
+
+    if (size < 1) {
+        return 1;
+    }
+
+    return (size > MAX_FILE_SIZE) ? MAX_FILE_SIZE : (int)size;
+}
+
+/* Directory d hangs off directory (d - 1) / fanout, 0 is the root */
+static int DirPath(int d, char* path) {
+    if (d == 0) {
+        path[0] = '\0';
+        return 0;
+    }
+
+    int len = DirPath((d - 1) / fanout, path);
+    return len + sprintf(path + len, "/d%d", d);
+}
+
+/* Directory for a new file: one with room, or a new one */
+static int PickDir(void) {
+    int d = (num_dirs == 1) ? 0 : (int)(drand48() * num_dirs);
+    if (drand48() * fanout >= 1.0 || num_dirs > num_files / fanout) {
+        return d;
+    }
+
+    char path[MAXPATHNAMELEN];
+    DirPath(num_dirs, path);
+    if (MkDir(path) == ERROR) {
+        return d;
+    }
+
+    return num_dirs++;
+}
+
+static void CreateFile(int k) {
+    char path[MAXPATHNAMELEN];
+    int d = PickDir();
+    int len = DirPath(d, path);
+    sprintf(path + len, "/f%d", k);
+
+    int size = RandomSize();
+    int fd = Create(path);
+    if (fd == ERROR) {
+        ++failed_creates;
+        file_dir[k] = -1;
+        return;
+    }
+
+    int written = Write(fd, data, size);
+    Close(fd);
+    if (written != size) {
+        Unlink(path);
+        ++failed_creates;
+        file_dir[k] = -1;
+        return;
+    }
+
+    file_dir[k] = d;
+}
+
+static void DeleteFile(int k) {
+    char path[MAXPATHNAMELEN];
+    int len = DirPath(file_dir[k], path);
+    sprintf(path + len, "/f%d", k);
+    Unlink(path);
+    file_dir[k] = -1;
+}
+
+static void Usage(void) {
+    fprintf(stderr, "usage: yfsage [-o disk_file] [-i inodes] [-B block_size] [-n files] "
+        "[-s mean_size] [-f fanout] [-c churn] [-r seed]\n");
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    char* output = DEFAULT_OUTPUT;
+    int num_inodes = 0;
+    long seed = 1;
+
+    int i = 1;
+    while (i + 1 < argc && argv[i][0] == '-') {
+        char* option = argv[i];
+        char* value = argv[i + 1];
+        int n = atoi(value);
+        i += 2;
+
+        if (strcmp(option, "-o") == 0) {
+            output = value;
+        } else if (strcmp(option, "-i") == 0 && n > 1) {
+            num_inodes = n;
+        } else if (strcmp(option, "-B") == 0 && BlockShiftFor(n) != ERROR) {
+            block_shift = BlockShiftFor(n);
+        } else if (strcmp(option, "-n") == 0 && n > 0) {
+            num_files = n;
+        } else if (strcmp(option, "-s") == 0 && n > 0) {
+            mean_size = n;
+        } else if (strcmp(option, "-f") == 0 && n > 1) {
+            fanout = n;
+        } else if (strcmp(option, "-c") == 0 && n >= 0) {
+            churn = n;
+        } else if (strcmp(option, "-r") == 0) {
+            seed = atol(value);
+        } else {
+            Usage();
+        }
+    }
+
+    if (i != argc) {
+        Usage();
+    }
+
+    if (churn < 0) {
+        churn = 2 * num_files;
+    }
+
+    /* Files, directories and the root, rounded up to whole inode blocks */
+    if (num_inodes == 0) {
+        num_inodes = num_files + num_files / fanout + 2;
+        num_inodes += IMAGE_INODES_PER_BLOCK - 1 - num_inodes % IMAGE_INODES_PER_BLOCK;
+        if (num_inodes < DEFAULT_IMAGE_INODES) {
+            num_inodes = DEFAULT_IMAGE_INODES;
+        }
+    }
+
+    CacheConfig config;
+    InitCacheConfig(&config);
+    if (FormatImage(output, num_inodes, block_shift) == ERROR || BootHostServer(output, &config, NULL) == ERROR) {
+        exit(1);
+    }
+
+    srand48(seed);
+    data = (char*)malloc(MAX_FILE_SIZE);
+    memset(data, 'a', MAX_FILE_SIZE);
+    file_dir = (int*)malloc(num_files * sizeof(int));
+    num_dirs = 1;
+
+    int k;
+    for (k = 0; k < num_files; ++k) {
+        CreateFile(k);
+    }
+
+    int fill_failures = failed_creates;
+    for (i = 0; i < churn; ++i) {
+        k = (int)(drand48() * num_files);
+        if (file_dir[k] >= 0) {
+            DeleteFile(k);
+        }
+        CreateFile(k);
+    }
+
+    Sync();
+
+    ImageStats stats;
+    if (ScanImage(&stats) == ERROR) {
+        fprintf(stderr, "%s: can't scan the image\n", output);
+        exit(1);
+    }
+    CloseHostDisk();
+
+    printf("%s: %d files of mean size %d, fanout %d, %d churn operations, seed %ld\n",
+        output, num_files, mean_size, fanout, churn, seed);
+    printf("%d files didn't fit while filling, %d while churning\n",
+        fill_failures, failed_creates - fill_failures);
+    PrintImageStats(stdout, &stats);
+
+    return 0;
+}
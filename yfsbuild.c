@@ -0,0 +1,614 @@
+/*
+ *  Build a YFS image straight from a Unix directory tree, without
+ *  going through the server.
+ *
+ *  Usage: yfsbuild [-o disk_file] [-i inodes] [-B block_size] source_dir
+ *
+ *  The tree is walked breadth first, so the inodes of a directory's
+ *  entries are numbered consecutively.  Each directory's blocks are
+ *  placed just before the data of the files in it, and every file is
+ *  laid out contiguously (its indirect blocks, if any, first).  All the
+ *  block numbers are assigned before anything is written, so the image
+ *  is then written in one sequential pass from block 0 up.  Files and
+ *  symbolic links of at most INLINE_SIZE bytes (see yfs.h) are kept in
+ *  their inodes and get no blocks.  The partial last block of any other
+ *  file or symbolic link is packed as a tail into a block shared with
+ *  the tails of the files laid out after it, which is written right
+ *  after the data of the file that opened it.
+ *
+ *  Regular files, directories and symbolic links are copied, anything
+ *  else (and names longer than DIRNAMELEN, or symbolic links longer
+ *  than MAXPATHNAMELEN) is skipped with a warning.
+ *  Files bigger than the largest file YFS supports stop the build.
+ *  -i sets the inode count, by default just enough for the tree, and
+ *  -B the block size in bytes, as for mkyfs.
+ *  Build throughput and the layout of the new image are printed.
+ *
+ *  RUN THIS COMMAND AS A UNIX PROGRAM, NOT AS A YALNIX PROGRAM.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <comp421/yalnix.h>
+#include <comp421/filesystem.h>
+#include "include/hostshim.h"
+#include "include/image.h"
+
+#define DEFAULT_OUTPUT "DISK"
+
+#define PER_INDIRECT (BLOCKSIZE / (int)sizeof(int))
+
+typedef struct Node {
+    /* Unix path */
+    char* path;
+    char name[DIRNAMELEN + 1];
+    int type;
+    int size;
+    int parent;
+    /* Entries of a directory are nodes first_child .. first_child + children - 1 */
+    int first_child;
+    int children;
+    int nlink;
+    int first_block;
+    /* Root of the indirect tree, with its levels, as in the inode */
+    int indirect;
+    /* Tail pointer of a packed last block, 0 if none */
+    int tail;
+} Node;
+
+static Node* nodes = NULL;
+static int num_nodes = 0;
+static int max_nodes = 0;
+
+static int num_skipped = 0;
+
+/* Next block to assign, and to write */
+static int next_block;
+static int write_block;
+static FILE* out;
+
+/* Contents and numbers of the blocks of tails, in block order */
+static char* tail_data = NULL;
+static int* tail_bnums = NULL;
+static int num_tail_blocks = 0;
+static int tails_written = 0;
+/* Next free fragment of the last block of tails */
+static int tail_frag = FRAGS_PER_BLOCK;
+
+/* Largest file, direct blocks and a full triple indirect tree, as far as an int size reaches */
+static int MaxFileSize(void) {
+    int blocks = IndirectSpan(MAX_INDIRECT_LEVELS);
+    return (blocks >= INT_MAX / BLOCKSIZE - NUM_DIRECT) ? INT_MAX : (NUM_DIRECT + blocks) * BLOCKSIZE;
+}
+
+/* Indirect blocks depth levels below the root of a tree listing entries blocks */
+static int TreeBlocks(int levels, int entries, int depth) {
+    int span = IndirectSpan(levels - depth);
+    return entries / span + (entries % span != 0);
+}
+
+static int AddNode(char* path, char* name, int parent) {
+    if (num_nodes == max_nodes) {
+        max_nodes = (max_nodes == 0) ? 64 : max_nodes * 2;
+        nodes = (Node*)realloc(nodes, max_nodes * sizeof(Node));
+    }
+
+    Node* node = &nodes[num_nodes];
+    memset(node, 0, sizeof(Node));
+    node->path = strdup(path);
+    strncpy(node->name, name, DIRNAMELEN);
+    node->parent = parent;
+    return num_nodes++;
+}
+
+static int CompareNames(const void* a, const void* b) {
+    return strcmp(*(char**)a, *(char**)b);
+}
+
+/* Sizes and types of every entry of directory nodes[d], appended in name order */
+static int ReadHostDir(int d) {
+    DIR* dir = opendir(nodes[d].path);
+    if (dir == NULL) {
+        perror(nodes[d].path);
+        return ERROR;
+    }
+
+    char** names = NULL;
+    int count = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        names = (char**)realloc(names, (count + 1) * sizeof(char*));
+        names[count++] = strdup(entry->d_name);
+    }
+    closedir(dir);
+    qsort(names, count, sizeof(char*), CompareNames);
+
+    nodes[d].first_child = num_nodes;
+
+    int i;
+    for (i = 0; i < count; ++i) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", nodes[d].path, names[i]);
+
+        struct stat st;
+        int type = INODE_FREE;
+        if (lstat(path, &st) == 0) {
+            if (S_ISREG(st.st_mode)) {
+                type = INODE_REGULAR;
+            } else if (S_ISDIR(st.st_mode)) {
+                type = INODE_DIRECTORY;
+            } else if (S_ISLNK(st.st_mode)) {
+                type = INODE_SYMLINK;
+            }
+        }
+
+        if (type == INODE_FREE || strlen(names[i]) > DIRNAMELEN ||
+            (type == INODE_SYMLINK && st.st_size >= MAXPATHNAMELEN)) {
+            fprintf(stderr, "%s: skipped\n", path);
+            ++num_skipped;
+            free(names[i]);
+            continue;
+        }
+
+        if (type == INODE_REGULAR && st.st_size > MaxFileSize()) {
+            fprintf(stderr, "%s: %lld bytes, larger than the largest YFS file (%d)\n",
+                path, (long long)st.st_size, MaxFileSize());
+            return ERROR;
+        }
+
+        /* As in the server, a directory's nlink doesn't count "." and ".." */
+        int n = AddNode(path, names[i], d);
+        nodes[n].type = type;
+        nodes[n].nlink = 1;
+        if (type == INODE_REGULAR || type == INODE_SYMLINK) {
+            nodes[n].size = (int)st.st_size;
+        }
+        ++nodes[d].children;
+        free(names[i]);
+    }
+
+    free(names);
+    nodes[d].size = (2 + nodes[d].children) * sizeof(struct dir_entry);
+    if (nodes[d].size > MaxFileSize()) {
+        fprintf(stderr, "%s: too many entries for a YFS directory\n", nodes[d].path);
+        return ERROR;
+    }
+
+    return 0;
+}
+
+/* Small files and symbolic links go in their inodes, as the server keeps them */
+static bool Inline(Node* node) {
+    return node->type != INODE_DIRECTORY && node->size <= INLINE_SIZE;
+}
+
+/* Read the last len bytes of a file or symbolic link into buf */
+static int ReadTail(Node* node, char* buf, int len) {
+    if (node->type == INODE_SYMLINK) {
+        return (readlink(node->path, buf, len) == node->size) ? 0 : ERROR;
+    }
+
+    int fd = open(node->path, O_RDONLY);
+    if (fd < 0) {
+        return ERROR;
+    }
+
+    /* A file that shrank since the walk reads as zeros past its end */
+    int status = (pread(fd, buf, len, node->size - len) < 0) ? ERROR : 0;
+    close(fd);
+    return status;
+}
+
+/* As in the server, only a last block that fits in fewer fragments is packed */
+static bool PacksTail(Node* node) {
+    return node->type != INODE_DIRECTORY && node->size % BLOCKSIZE != 0 &&
+        TAIL_FRAGS(node->size) < FRAGS_PER_BLOCK;
+}
+
+/* The tail goes in the last block of tails, or a new one if it doesn't fit */
+static int PackTail(Node* node) {
+    int count = TAIL_FRAGS(node->size);
+    if (tail_frag + count > FRAGS_PER_BLOCK) {
+        tail_data = (char*)realloc(tail_data, (num_tail_blocks + 1) * BLOCKSIZE);
+        tail_bnums = (int*)realloc(tail_bnums, (num_tail_blocks + 1) * sizeof(int));
+        memset(tail_data + num_tail_blocks * BLOCKSIZE, 0, BLOCKSIZE);
+        tail_bnums[num_tail_blocks++] = next_block++;
+        tail_frag = 0;
+    }
+
+    char* buf = tail_data + (num_tail_blocks - 1) * BLOCKSIZE + tail_frag * FRAGSIZE;
+    if (ReadTail(node, buf, TAIL_LENGTH(node->size)) == ERROR) {
+        perror(node->path);
+        return ERROR;
+    }
+
+    node->tail = TAIL_POINTER(tail_bnums[num_tail_blocks - 1], tail_frag);
+    tail_frag += count;
+    return 0;
+}
+
+static int AssignBlocks(Node* node) {
+    if (Inline(node)) {
+        return 0;
+    }
+
+    int count = (node->size + BLOCKSIZE - 1) / BLOCKSIZE;
+    if (count > NUM_DIRECT) {
+        int levels = 1;
+        while (count - NUM_DIRECT > IndirectSpan(levels)) {
+            ++levels;
+        }
+
+        node->indirect = INDIRECT_POINTER(next_block, levels);
+        int depth;
+        for (depth = 0; depth < levels; ++depth) {
+            next_block += TreeBlocks(levels, count - NUM_DIRECT, depth);
+        }
+    }
+
+    int full = PacksTail(node) ? count - 1 : count;
+    node->first_block = (full > 0) ? next_block : 0;
+    next_block += full;
+    return (full < count) ? PackTail(node) : 0;
+}
+
+/* Directories in breadth first order, each followed by its files */
+static int LayOut(int first_data_block) {
+    next_block = first_data_block;
+
+    int d;
+    for (d = 0; d < num_nodes; ++d) {
+        if (nodes[d].type != INODE_DIRECTORY) {
+            continue;
+        }
+
+        if (AssignBlocks(&nodes[d]) == ERROR) {
+            return ERROR;
+        }
+        int c;
+        for (c = nodes[d].first_child; c < nodes[d].first_child + nodes[d].children; ++c) {
+            if (nodes[c].type != INODE_DIRECTORY && AssignBlocks(&nodes[c]) == ERROR) {
+                return ERROR;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Block i of a file, its tail pointer if that is the packed last block */
+static int BlockPointer(Node* node, int i) {
+    if (node->tail != 0 && i == (node->size - 1) / BLOCKSIZE) {
+        return node->tail;
+    }
+    return node->first_block + i;
+}
+
+static int FillInode(struct inode* inode, Node* node) {
+    inode->type = node->type;
+    inode->nlink = node->nlink;
+    inode->size = node->size;
+
+    if (Inline(node)) {
+        inode->indirect = INLINE_DATA;
+        if (ReadTail(node, (char*)inode->direct, node->size) == ERROR) {
+            perror(node->path);
+            return ERROR;
+        }
+        return 0;
+    }
+
+    int count = (node->size + BLOCKSIZE - 1) / BLOCKSIZE;
+    int i;
+    for (i = 0; i < count && i < NUM_DIRECT; ++i) {
+        inode->direct[i] = BlockPointer(node, i);
+    }
+    inode->indirect = node->indirect;
+    return 0;
+}
+
+static int WriteBlock(void* block) {
+    ++write_block;
+    return (fwrite(block, BLOCKSIZE, 1, out) == 1) ? 0 : ERROR;
+}
+
+/*
+ * The indirect blocks go right before the data they list, a level at a
+ * time from the root, so the children of block k of a level are blocks
+ * k * PER_INDIRECT on of the next.
+ */
+static int WriteIndirect(Node* node) {
+    if (node->indirect == 0) {
+        return 0;
+    }
+
+    int levels = INDIRECT_LEVELS(node->indirect);
+    int entries = (node->size + BLOCKSIZE - 1) / BLOCKSIZE - NUM_DIRECT;
+    int base = INDIRECT_BLOCK(node->indirect);
+    int indirect[PER_INDIRECT];
+    int depth;
+    for (depth = 0; depth < levels; ++depth) {
+        int blocks = TreeBlocks(levels, entries, depth);
+        int below = (depth == levels - 1) ? entries : TreeBlocks(levels, entries, depth + 1);
+        int k;
+        for (k = 0; k < blocks; ++k) {
+            memset(indirect, 0, BLOCKSIZE);
+            int c;
+            for (c = 0; c < PER_INDIRECT && k * PER_INDIRECT + c < below; ++c) {
+                int child = k * PER_INDIRECT + c;
+                indirect[c] = (depth == levels - 1) ? BlockPointer(node, NUM_DIRECT + child) :
+                    base + blocks + child;
+            }
+
+            if (WriteBlock(indirect) == ERROR) {
+                return ERROR;
+            }
+        }
+
+        base += blocks;
+    }
+
+    return 0;
+}
+
+/* A block of tails is written once the file that opened it is */
+static int WriteTails(void) {
+    if (tails_written < num_tail_blocks && tail_bnums[tails_written] == write_block) {
+        return WriteBlock(tail_data + tails_written++ * BLOCKSIZE);
+    }
+    return 0;
+}
+
+static int WriteDirectory(int d) {
+    int count = 2 + nodes[d].children;
+    int blocks = (count * (int)sizeof(struct dir_entry) + BLOCKSIZE - 1) / BLOCKSIZE;
+    struct dir_entry* entries = (struct dir_entry*)calloc(blocks, BLOCKSIZE);
+
+    entries[0].inum = d + 1;
+    entries[0].name[0] = '.';
+    entries[1].inum = nodes[d].parent + 1;
+    memcpy(entries[1].name, "..", 2);
+
+    int i;
+    for (i = 0; i < nodes[d].children; ++i) {
+        Node* child = &nodes[nodes[d].first_child + i];
+        entries[2 + i].inum = nodes[d].first_child + i + 1;
+        memcpy(entries[2 + i].name, child->name, strlen(child->name));
+    }
+
+    int status = WriteIndirect(&nodes[d]);
+    for (i = 0; i < blocks && status == 0; ++i) {
+        status = WriteBlock((char*)entries + i * BLOCKSIZE);
+    }
+
+    free(entries);
+    return status;
+}
+
+static int WriteFile(Node* node) {
+    int count = (node->size + BLOCKSIZE - 1) / BLOCKSIZE;
+    char block[BLOCKSIZE];
+
+    if (Inline(node)) {
+        return 0;
+    }
+
+    if (WriteIndirect(node) == ERROR) {
+        return ERROR;
+    }
+
+    /* The packed last block is already in its block of tails */
+    if (node->tail != 0) {
+        --count;
+    }
+
+    if (node->type == INODE_SYMLINK) {
+        if (count == 0) {
+            return WriteTails();
+        }
+
+        memset(block, 0, BLOCKSIZE);
+        if (readlink(node->path, block, BLOCKSIZE) != node->size) {
+            perror(node->path);
+            return ERROR;
+        }
+
+        return WriteBlock(block);
+    }
+
+    int fd = open(node->path, O_RDONLY);
+    if (fd < 0) {
+        perror(node->path);
+        return ERROR;
+    }
+
+    /* A file that shrank since the walk reads as zeros past its end */
+    int i;
+    for (i = 0; i < count; ++i) {
+        memset(block, 0, BLOCKSIZE);
+        if (read(fd, block, BLOCKSIZE) < 0 || WriteBlock(block) == ERROR) {
+            perror(node->path);
+            close(fd);
+            return ERROR;
+        }
+    }
+
+    close(fd);
+    return WriteTails();
+}
+
+/* Boot block, header and inodes, then the data in block order */
+static int WriteImage(int num_inodes, int first_data_block) {
+    int inode_bytes = (first_data_block - 1) * BLOCKSIZE;
+    char* inodes = (char*)calloc(1, inode_bytes);
+
+    struct fs_header* header = (struct fs_header*)inodes;
+    header->num_blocks = NUMSECTORS >> block_shift;
+    header->num_inodes = num_inodes;
+    BLOCK_SHIFT(header) = block_shift;
+
+    int status = 0;
+    int n;
+    for (n = 0; n < num_nodes && status == 0; ++n) {
+        status = FillInode((struct inode*)inodes + n + 1, &nodes[n]);
+    }
+
+    /* With larger blocks sector 1 is in the boot block and holds a copy of the header */
+    char boot[BLOCKSIZE];
+    memset(boot, 0, BLOCKSIZE);
+    if (block_shift > 0) {
+        memcpy(boot + SECTORSIZE, inodes, SECTORSIZE);
+    }
+    write_block = 0;
+    if (status == 0) {
+        status = WriteBlock(boot);
+    }
+    for (n = 0; n < first_data_block - 1 && status == 0; ++n) {
+        status = WriteBlock(inodes + n * BLOCKSIZE);
+    }
+    free(inodes);
+
+    int d;
+    for (d = 0; d < num_nodes && status == 0; ++d) {
+        if (nodes[d].type != INODE_DIRECTORY) {
+            continue;
+        }
+
+        status = WriteDirectory(d);
+        int c;
+        for (c = nodes[d].first_child; c < nodes[d].first_child + nodes[d].children; ++c) {
+            if (status == 0 && nodes[c].type != INODE_DIRECTORY) {
+                status = WriteFile(&nodes[c]);
+            }
+        }
+    }
+
+    if (status == 0 && write_block != next_block) {
+        status = ERROR;
+    }
+
+    /* The rest of the disk is a hole, which reads as zeros */
+    int num_blocks = NUMSECTORS >> block_shift;
+    if (status == 0 && write_block < num_blocks) {
+        memset(boot, 0, BLOCKSIZE);
+        fseek(out, (long)BLOCKSIZE * (num_blocks - 1), SEEK_SET);
+        write_block = num_blocks - 1;
+        status = WriteBlock(boot);
+    }
+
+    return status;
+}
+
+static double NowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+    char* output = DEFAULT_OUTPUT;
+    int num_inodes = 0;
+
+    int i = 1;
+    while (i + 1 < argc && argv[i][0] == '-') {
+        if (strcmp(argv[i], "-o") == 0) {
+            output = argv[i + 1];
+        } else if (strcmp(argv[i], "-i") == 0 && atoi(argv[i + 1]) > 1) {
+            num_inodes = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-B") == 0 && BlockShiftFor(atoi(argv[i + 1])) != ERROR) {
+            block_shift = BlockShiftFor(atoi(argv[i + 1]));
+        } else {
+            break;
+        }
+        i += 2;
+    }
+
+    if (argc - i != 1) {
+        fprintf(stderr, "usage: yfsbuild [-o disk_file] [-i inodes] [-B block_size] source_dir\n");
+        exit(1);
+    }
+
+    double start = NowSeconds();
+
+    /* Root first, then every directory's entries after it */
+    AddNode(argv[i], "", 0);
+    nodes[0].type = INODE_DIRECTORY;
+    nodes[0].nlink = 2;
+    int d;
+    for (d = 0; d < num_nodes; ++d) {
+        if (nodes[d].type == INODE_DIRECTORY && ReadHostDir(d) == ERROR) {
+            exit(1);
+        }
+    }
+
+    if (num_inodes == 0) {
+        num_inodes = num_nodes + IMAGE_INODES_PER_BLOCK - 1 - num_nodes % IMAGE_INODES_PER_BLOCK;
+        if (num_inodes < DEFAULT_IMAGE_INODES) {
+            num_inodes = DEFAULT_IMAGE_INODES;
+        }
+    }
+
+    if (num_nodes > num_inodes || num_nodes >= 1 << 15) {
+        fprintf(stderr, "%s: %d files and directories, too many for %d inodes\n",
+            argv[i], num_nodes, num_inodes);
+        exit(1);
+    }
+
+    int first_data_block = 1 + (num_inodes + IMAGE_INODES_PER_BLOCK) / IMAGE_INODES_PER_BLOCK;
+    if (LayOut(first_data_block) == ERROR) {
+        exit(1);
+    }
+    if (next_block > NUMSECTORS >> block_shift) {
+        fprintf(stderr, "%s: needs %d blocks, the disk has %d\n", argv[i], next_block,
+            NUMSECTORS >> block_shift);
+        exit(1);
+    }
+
+    out = fopen(output, "wb");
+    if (out == NULL) {
+        perror(output);
+        exit(1);
+    }
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+    if (WriteImage(num_inodes, first_data_block) == ERROR || fclose(out) != 0) {
+        fprintf(stderr, "%s: write failed\n", output);
+        unlink(output);
+        exit(1);
+    }
+
+    double seconds = NowSeconds() - start;
+    long long bytes = 0;
+    int files = 0;
+    int n;
+    for (n = 0; n < num_nodes; ++n) {
+        if (nodes[n].type != INODE_DIRECTORY) {
+            ++files;
+            bytes += nodes[n].size;
+        }
+    }
+
+    printf("%s: %d files and %d directories from %s, %d skipped\n",
+        output, files, num_nodes - files, argv[i], num_skipped);
+    printf("%lld bytes in %.3f s, %.2f MB/s, %.0f files/s\n", bytes, seconds,
+        seconds > 0 ? bytes / seconds / 1e6 : 0.0, seconds > 0 ? files / seconds : 0.0);
+
+    ImageStats stats;
+    if (OpenHostDisk(output) == 0 && ScanImage(&stats) == 0) {
+        PrintImageStats(stdout, &stats);
+    }
+    CloseHostDisk();
+
+    return 0;
+}
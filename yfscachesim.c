@@ -0,0 +1,318 @@
+/*
+ *  Simulate the inode and block caches over an access trace written by
+ *  yfsreplay -a, and print miss-ratio curves for several policies.
+ *
+ *  Usage: yfscachesim [-s sample_rate] [-m max_size] access_file
+ *
+ *  For each cache the output has one CSV line per (policy, size):
+ *
+ *	cache,policy,size,miss_ratio
+ *
+ *  Policies:
+ *	lru	exact simulation of the server's Cache (fscache.c)
+ *	shards	LRU curve from sampled reuse distances (SHARDS), which
+ *		costs one pass however many sizes are asked for
+ *	fifo	first in, first out
+ *	clock	second chance
+ *
+ *  fifo and clock run on the same sample as shards with the cache size
+ *  scaled by the sample rate.  The sample rate defaults to 1 (exact) for
+ *  short traces and keeps about SAMPLE_TARGET accesses of longer ones.
+ *  Miss ratios of the sample are taken over the number of accesses the
+ *  rate should have kept (SHARDS-adj), which corrects for a few hot keys
+ *  falling in or out of the sample.  Sizes below 1 / rate are too small
+ *  for the sample to resolve, use the exact lru lines there.  Sizes are
+ *  powers of two up to max_size (default 4096).  A comment line after
+ *  each cache suggests the smallest size within 1% of the best miss
+ *  ratio seen.
+ *
+ *  RUN THIS COMMAND AS A UNIX PROGRAM, NOT AS A YALNIX PROGRAM.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/fscache.h"
+#include "include/hashtable.h"
+#include "include/cachesim.h"
+
+#define DEFAULT_MAX_SIZE 4096
+
+/* Default sample rate keeps about this many accesses */
+#define SAMPLE_TARGET 200000
+
+/* SHARDS samples a key when its hash modulo SAMPLE_MODULUS is below rate * modulus */
+#define SAMPLE_MODULUS (1 << 24)
+
+#define KEY_TABLE_SIZE 4096
+
+typedef struct Stream {
+    int* keys;
+    int len;
+    int cap;
+} Stream;
+
+static void AppendKey(Stream* stream, int key) {
+    if (stream->len == stream->cap) {
+        stream->cap = (stream->cap == 0) ? 1024 : stream->cap * 2;
+        stream->keys = (int*)realloc(stream->keys, stream->cap * sizeof(int));
+    }
+
+    stream->keys[stream->len++] = key;
+}
+
+static unsigned int HashKey(int key) {
+    unsigned int x = (unsigned int)key;
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+static bool IsSampled(int key, double rate) {
+    return (HashKey(key) % SAMPLE_MODULUS) < (unsigned int)(rate * SAMPLE_MODULUS);
+}
+
+/* Keys of stream kept by the SHARDS sample */
+static Stream SampleStream(Stream* stream, double rate) {
+    Stream sample;
+    memset(&sample, 0, sizeof(Stream));
+
+    int i;
+    for (i = 0; i < stream->len; ++i) {
+        if (rate >= 1.0 || IsSampled(stream->keys[i], rate)) {
+            AppendKey(&sample, stream->keys[i]);
+        }
+    }
+
+    return sample;
+}
+
+/* Fenwick tree over access times, marks the latest access of each key */
+static void FenwickAdd(int* tree, int len, int index, int delta) {
+    for (++index; index <= len; index += index & -index) {
+        tree[index - 1] += delta;
+    }
+}
+
+static int FenwickSum(int* tree, int index) {
+    int sum = 0;
+    for (; index > 0; index -= index & -index) {
+        sum += tree[index - 1];
+    }
+
+    return sum;
+}
+
+/*
+ * Fill misses[size] for size 1..max_size with LRU misses of the sampled
+ * stream, from the number of distinct keys between reuses scaled by
+ * 1 / rate.
+ */
+static void ShardsCurve(Stream* sample, double rate, int len, int max_size, double* misses) {
+    int* tree = (int*)calloc(sample->len, sizeof(int));
+    /* Reuse distances, the last slot counts everything larger */
+    int* distances = (int*)calloc(max_size + 2, sizeof(int));
+    HashTable* last = InitHashTable(KEY_TABLE_SIZE);
+    int cold = 0;
+
+    int t;
+    for (t = 0; t < sample->len; ++t) {
+        int key = sample->keys[t];
+        void* prev = GetItemFromHashTable(last, key);
+
+        if (prev == NULL) {
+            ++cold;
+        } else {
+            int prev_t = (int)(long)prev - 1;
+            int distinct = FenwickSum(tree, t) - FenwickSum(tree, prev_t + 1);
+            int distance = (int)(distinct / rate) + 1;
+            distances[(distance > max_size) ? max_size + 1 : distance]++;
+            FenwickAdd(tree, sample->len, prev_t, -1);
+        }
+
+        FenwickAdd(tree, sample->len, t, 1);
+        PutItemInHashTable(last, key, (void*)(long)(t + 1));
+    }
+
+    /* A cache of size c hits every reuse at distance <= c */
+    double expected = len * rate;
+    int size;
+    int hits = 0;
+    for (size = 1; size <= max_size; ++size) {
+        hits += distances[size];
+        misses[size] = (sample->len == 0) ? 0.0 : (sample->len - hits) / expected;
+        if (misses[size] > 1.0) {
+            misses[size] = 1.0;
+        }
+    }
+
+    DestroyHashTable(last);
+    free(distances);
+    free(tree);
+}
+
+static double SimulateLru(Stream* stream, int size) {
+    Cache* cache = InitCache(size);
+    int misses = 0;
+
+    int i;
+    for (i = 0; i < stream->len; ++i) {
+        int key = stream->keys[i];
+        if (GetItemFromCache(cache, key) == NULL) {
+            ++misses;
+            /* Any non-NULL value, a NULL one would read as a miss */
+            CacheNode* evicted = PutItemInCache(cache, key, (void*)cache);
+            free(evicted);
+        }
+    }
+
+    while (cache->head != NULL) {
+        CacheNode* node = cache->head;
+        cache->head = node->next;
+        free(node);
+    }
+    DestroyHashTable(cache->table);
+    free(cache);
+
+    return (stream->len == 0) ? 0.0 : (double)misses / stream->len;
+}
+
+/* FIFO when clock is false, otherwise CLOCK with one reference bit */
+static double SimulateQueue(Stream* stream, int size, bool clock) {
+    int* slots = (int*)malloc(size * sizeof(int));
+    char* referenced = (char*)calloc(size, 1);
+    HashTable* where = InitHashTable(KEY_TABLE_SIZE);
+    int used = 0;
+    int hand = 0;
+    int misses = 0;
+
+    int i;
+    for (i = 0; i < stream->len; ++i) {
+        int key = stream->keys[i];
+        void* slot = GetItemFromHashTable(where, key);
+        if (slot != NULL) {
+            referenced[(int)(long)slot - 1] = 1;
+            continue;
+        }
+
+        ++misses;
+        if (used < size) {
+            slots[used] = key;
+            referenced[used] = 0;
+            PutItemInHashTable(where, key, (void*)(long)(used + 1));
+            ++used;
+            continue;
+        }
+
+        while (clock && referenced[hand]) {
+            referenced[hand] = 0;
+            hand = (hand + 1) % size;
+        }
+
+        RemoveItemFromHashTable(where, slots[hand]);
+        slots[hand] = key;
+        referenced[hand] = 0;
+        PutItemInHashTable(where, key, (void*)(long)(hand + 1));
+        hand = (hand + 1) % size;
+    }
+
+    DestroyHashTable(where);
+    free(referenced);
+    free(slots);
+
+    return (stream->len == 0) ? 0.0 : (double)misses / stream->len;
+}
+
+static void PrintCurves(char* name, Stream* stream, double rate, int max_size) {
+    if (stream->len == 0) {
+        return;
+    }
+
+    if (rate <= 0.0) {
+        rate = (stream->len > SAMPLE_TARGET) ? (double)SAMPLE_TARGET / stream->len : 1.0;
+    }
+
+    Stream sample = SampleStream(stream, rate);
+    double* shards = (double*)calloc(max_size + 1, sizeof(double));
+    ShardsCurve(&sample, rate, stream->len, max_size, shards);
+
+    printf("# %s: %d accesses, %d sampled at rate %g\n", name, stream->len, sample.len, rate);
+
+    double best = 1.0;
+    int size;
+    for (size = 1; size <= max_size; size *= 2) {
+        int scaled = (int)(size * rate);
+        if (scaled < 1) {
+            scaled = 1;
+        }
+
+        double lru = SimulateLru(stream, size);
+        if (lru < best) {
+            best = lru;
+        }
+
+        printf("%s,lru,%d,%.6f\n", name, size, lru);
+        printf("%s,shards,%d,%.6f\n", name, size, shards[size]);
+        printf("%s,fifo,%d,%.6f\n", name, size, SimulateQueue(&sample, scaled, false));
+        printf("%s,clock,%d,%.6f\n", name, size, SimulateQueue(&sample, scaled, true));
+    }
+
+    for (size = 1; size <= max_size; ++size) {
+        if (shards[size] <= best + 0.01) {
+            printf("# %s: suggested size %d (LRU miss ratio %.4f)\n", name, size, shards[size]);
+            break;
+        }
+    }
+
+    free(shards);
+    free(sample.keys);
+}
+
+int main(int argc, char** argv) {
+    double rate = 0.0;
+    int max_size = DEFAULT_MAX_SIZE;
+
+    int i = 1;
+    while (i + 1 < argc && argv[i][0] == '-') {
+        if (strcmp(argv[i], "-s") == 0 && sscanf(argv[i + 1], "%lf", &rate) == 1 &&
+            rate > 0.0 && rate <= 1.0) {
+            i += 2;
+        } else if (strcmp(argv[i], "-m") == 0 && sscanf(argv[i + 1], "%d", &max_size) == 1 &&
+            max_size > 0) {
+            i += 2;
+        } else {
+            break;
+        }
+    }
+
+    if (argc - i != 1) {
+        fprintf(stderr, "usage: yfscachesim [-s sample_rate] [-m max_size] access_file\n");
+        exit(1);
+    }
+
+    FILE* file = fopen(argv[i], "rb");
+    if (file == NULL) {
+        perror(argv[i]);
+        exit(1);
+    }
+
+    Stream inodes;
+    Stream blocks;
+    memset(&inodes, 0, sizeof(Stream));
+    memset(&blocks, 0, sizeof(Stream));
+
+    CacheAccess access;
+    while (fread(&access, sizeof(CacheAccess), 1, file) == 1) {
+        AppendKey(access.cache == ACCESS_INODE ? &inodes : &blocks, access.key);
+    }
+    fclose(file);
+
+    printf("cache,policy,size,miss_ratio\n");
+    PrintCurves("inode", &inodes, rate, max_size);
+    PrintCurves("block", &blocks, rate, max_size);
+
+    return 0;
+}
@@ -0,0 +1,758 @@
+/*
+ *  Check (and optionally repair) a YFS image offline.
+ *
+ *  Usage: yfsck [-r] [-j threads] disk_file
+ *
+ *  Checks that every block pointer is in the data area and owned by one
+ *  inode only (tails, see yfs.h, may share a block but no fragment),
+ *  that inline data fits in its inode, that directory entries name
+ *  allocated inodes, that "." and ".." are right, that every allocated
+ *  inode is named somewhere, and that nlink matches the names.
+ *  Directories follow the server's convention: nlink counts the names a
+ *  directory has in other directories (always one), not "." or "..".
+ *  An unnamed inode with nlink 0 is waiting for the server to reclaim
+ *  it (see reclaim.h), so it is counted but isn't a problem.
+ *  Without a journal YFS
+ *  has no free map on disk, the server rebuilds it from the inodes, so
+ *  the free counts printed are what the server will see.  With one (see
+ *  journal.h) the journal and free map blocks are off limits to files,
+ *  and the free map must agree with the inodes, since the server trusts
+ *  it.  An image whose journal still holds changes isn't checked: mount
+ *  it once so the server replays them.
+ *
+ *  The image is read in large sequential chunks by -j threads (default
+ *  one per CPU): first the inode table, then the data area once per
+ *  level of indirect blocks, top level first, and once for directory
+ *  blocks.  Chunks holding nothing a pass looks at are skipped.
+ *
+ *  -r repairs what it can: bad and cross-linked block pointers are
+ *  cleared (one owner keeps a cross-linked block), entries naming
+ *  free or invalid inodes are removed, nlink is set to the names found,
+ *  and unnamed files and symbolic links are freed, and the free map is
+ *  rewritten.  Unnamed directories and wrong "." and ".." entries are
+ *  only reported.
+ *
+ *  Exit status is 0 for a clean image, 1 if every problem was repaired
+ *  and 4 if problems remain.
+ *
+ *  RUN THIS COMMAND AS A UNIX PROGRAM, NOT AS A YALNIX PROGRAM.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <comp421/filesystem.h>
+#include "include/journal.h"
+
+#define INODES_PER_BLOCK (BLOCKSIZE / INODESIZE)
+#define ENTRIES_PER_BLOCK (BLOCKSIZE / (int)sizeof(struct dir_entry))
+#define PER_INDIRECT (BLOCKSIZE / (int)sizeof(int))
+
+/* Blocks read at a time */
+#define CHUNK_BLOCKS 2048
+
+#define MAX_THREADS 64
+
+/* Problems printed in full, the rest are only counted */
+#define MAX_MESSAGES 50
+
+/* Owner of a block holding the tails of several files */
+#define TAILS (-1)
+
+/* What a claimed block holds */
+#define KIND_DATA 1
+#define KIND_INDIRECT 2
+#define KIND_DIRECTORY 3
+/* Indirect blocks two and three levels above the data */
+#define KIND_DOUBLE_INDIRECT 4
+#define KIND_TRIPLE_INDIRECT 5
+
+/* Kind of an indirect block by its levels above the data */
+static const char indirect_kinds[MAX_INDIRECT_LEVELS + 1] = {
+    0, KIND_INDIRECT, KIND_DOUBLE_INDIRECT, KIND_TRIPLE_INDIRECT
+};
+
+typedef struct Problems {
+    int bad_inodes;
+    int bad_pointers;
+    int cross_links;
+    int bad_entries;
+    int bad_dots;
+    int unnamed;
+    int dir_links;
+    int wrong_nlink;
+    int bad_map;
+    /* Of the above */
+    int repaired;
+} Problems;
+
+/* Unnamed inodes with nlink 0, left for the server to reclaim */
+static int orphans = 0;
+
+static int disk_fd;
+static bool repair = false;
+static int num_threads = 1;
+
+/* Blocks are 2^block_shift sectors, see yfs.h */
+int block_shift = 0;
+
+static int num_blocks;
+static int num_inodes;
+/* Most blocks a file can have, direct ones and a full triple indirect tree */
+static int max_file_blocks;
+static int first_data_block;
+/* End of the data area, the journal's free map starts there if there is one */
+static int data_end;
+static struct journal_header journal;
+
+/* Inode table, indexed by inum (entry 0 holds the header) */
+static struct inode* inodes;
+static char* dirty_inode_blocks;
+
+/* Per block: owning inum (0 if free, TAILS if shared by tails), kind, and index in its file */
+static int* owner;
+static char* kind;
+static int* file_index;
+/* Per block holding tails: fragments claimed */
+static unsigned int* frags;
+
+/* Per inode: names found, the directory naming it, and its "." and ".." */
+static int* names;
+static int* parent;
+static int* dot;
+static int* dotdot;
+
+static Problems problems;
+static long long bytes_read = 0;
+
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+static int num_messages = 0;
+
+/* Next chunk for the threads of a data pass */
+static int next_chunk;
+
+static void Report(int* counter, bool fixed, char* fmt, ...) {
+    __sync_fetch_and_add(counter, 1);
+    if (fixed) {
+        __sync_fetch_and_add(&problems.repaired, 1);
+    }
+
+    pthread_mutex_lock(&report_lock);
+    if (num_messages++ < MAX_MESSAGES) {
+        va_list args;
+        va_start(args, fmt);
+        vprintf(fmt, args);
+        va_end(args);
+        printf(fixed ? " (fixed)\n" : "\n");
+    }
+    pthread_mutex_unlock(&report_lock);
+}
+
+static void ReadBlocks(int first, int count, char* buf) {
+    ssize_t len = pread(disk_fd, buf, (size_t)count * BLOCKSIZE, (off_t)first * BLOCKSIZE);
+    if (len < 0) {
+        len = 0;
+    }
+
+    /* Past the end of the file is a hole */
+    memset(buf + len, 0, (size_t)count * BLOCKSIZE - len);
+    __sync_fetch_and_add(&bytes_read, (long long)count * BLOCKSIZE);
+}
+
+static void WriteBlock(int bnum, char* block) {
+    if (pwrite(disk_fd, block, BLOCKSIZE, (off_t)bnum * BLOCKSIZE) != BLOCKSIZE) {
+        perror("write");
+    }
+}
+
+static void MarkInodeDirty(int inum) {
+    dirty_inode_blocks[1 + inum / INODES_PER_BLOCK] = 1;
+}
+
+/* Blocks below an indirect block levels above the data, capped at INT_MAX */
+static int Span(int levels) {
+    int span = 1;
+    for (; levels > 0; --levels) {
+        span = (span > INT_MAX / PER_INDIRECT) ? INT_MAX : span * PER_INDIRECT;
+    }
+
+    return span;
+}
+
+static int FileBlocks(struct inode* inode) {
+    int count = (inode->size + BLOCKSIZE - 1) / BLOCKSIZE;
+    return (count > max_file_blocks) ? max_file_blocks : count;
+}
+
+/*
+ * Claim block bnum for inum.  Return false, and report, if the pointer
+ * is bad or the block has an owner already; the caller clears it.
+ */
+static bool Claim(int bnum, int inum, int block_kind, int index) {
+    if (bnum < first_data_block || bnum >= data_end) {
+        Report(&problems.bad_pointers, repair, "inode %d: block %d out of range", inum, bnum);
+        return false;
+    }
+
+    int prev = __sync_val_compare_and_swap(&owner[bnum], 0, inum);
+    if (prev != 0) {
+        Report(&problems.cross_links, repair, "inode %d: block %d already belongs to inode %d",
+            inum, bnum, prev);
+        return false;
+    }
+
+    kind[bnum] = block_kind;
+    file_index[bnum] = index;
+    return true;
+}
+
+/* Claim the fragments tail pointer ptr names for a file of size bytes, as Claim does */
+static bool ClaimTail(int ptr, int inum, int size) {
+    int bnum = TAIL_BLOCK(ptr);
+    int count = TAIL_FRAGS(size);
+    if (bnum < first_data_block || bnum >= data_end || TAIL_FRAG(ptr) + count > FRAGS_PER_BLOCK) {
+        Report(&problems.bad_pointers, repair, "inode %d: tail %d.%d out of range", inum, bnum,
+            TAIL_FRAG(ptr));
+        return false;
+    }
+
+    int prev = __sync_val_compare_and_swap(&owner[bnum], 0, TAILS);
+    if (prev != 0 && prev != TAILS) {
+        Report(&problems.cross_links, repair, "inode %d: tail block %d already belongs to inode %d",
+            inum, bnum, prev);
+        return false;
+    }
+
+    unsigned int mask = FRAG_MASK(TAIL_FRAG(ptr), count);
+    unsigned int claimed = __sync_fetch_and_or(&frags[bnum], mask);
+    if ((claimed & mask) != 0) {
+        /* Keep the fragments of the earlier claim */
+        __sync_fetch_and_and(&frags[bnum], ~(mask & ~claimed));
+        Report(&problems.cross_links, repair, "inode %d: tail %d.%d overlaps another tail",
+            inum, bnum, TAIL_FRAG(ptr));
+        return false;
+    }
+
+    kind[bnum] = KIND_DATA;
+    return true;
+}
+
+/* Claim block pointer i of inum, only the last block of a file may be a tail */
+static bool ClaimPointer(int ptr, int inum, int block_kind, int i) {
+    struct inode* inode = &inodes[inum];
+    if (!IS_TAIL(ptr)) {
+        return Claim(ptr, inum, block_kind, i);
+    }
+
+    if (block_kind == KIND_DIRECTORY || i != FileBlocks(inode) - 1) {
+        Report(&problems.bad_pointers, repair, "inode %d: tail %d.%d as block %d", inum,
+            TAIL_BLOCK(ptr), TAIL_FRAG(ptr), i);
+        return false;
+    }
+
+    return ClaimTail(ptr, inum, inode->size);
+}
+
+/* Run work(thread) on every thread and wait for them */
+static void RunThreads(void* (*work)(void*)) {
+    pthread_t threads[MAX_THREADS];
+    long t;
+    for (t = 0; t < num_threads; ++t) {
+        pthread_create(&threads[t], NULL, work, (void*)t);
+    }
+
+    for (t = 0; t < num_threads; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+}
+
+/* Inode table blocks, a contiguous share per thread */
+static void* ReadInodeTable(void* arg) {
+    long t = (long)arg;
+    int table_blocks = first_data_block - 1;
+    int first = table_blocks * t / num_threads;
+    int last = table_blocks * (t + 1) / num_threads;
+
+    int bnum;
+    for (bnum = first; bnum < last; bnum += CHUNK_BLOCKS) {
+        int count = (last - bnum < CHUNK_BLOCKS) ? last - bnum : CHUNK_BLOCKS;
+        ReadBlocks(1 + bnum, count, (char*)inodes + (long)bnum * BLOCKSIZE);
+    }
+
+    return NULL;
+}
+
+static void CheckInode(int inum) {
+    struct inode* inode = &inodes[inum];
+    if (inode->type == INODE_FREE) {
+        return;
+    }
+
+    if (inode->type != INODE_DIRECTORY && inode->type != INODE_REGULAR &&
+        inode->type != INODE_SYMLINK) {
+        Report(&problems.bad_inodes, repair, "inode %d: bad type %d", inum, inode->type);
+        if (repair) {
+            memset(inode, 0, sizeof(struct inode));
+            MarkInodeDirty(inum);
+        }
+        return;
+    }
+
+    if (inode->size < 0 || (inode->size + BLOCKSIZE - 1) / BLOCKSIZE > max_file_blocks) {
+        Report(&problems.bad_inodes, false, "inode %d: bad size %d", inum, inode->size);
+    }
+
+    /* Inline data has no blocks to claim */
+    if (IS_INLINE(inode)) {
+        if (inode->type == INODE_DIRECTORY || inode->size > INLINE_SIZE) {
+            Report(&problems.bad_inodes, false, "inode %d: bad inline data, type %d size %d",
+                inum, inode->type, inode->size);
+        }
+        return;
+    }
+
+    int block_kind = (inode->type == INODE_DIRECTORY) ? KIND_DIRECTORY : KIND_DATA;
+    int count = FileBlocks(inode);
+    int i;
+    for (i = 0; i < count && i < NUM_DIRECT; ++i) {
+        if (inode->direct[i] != 0 && !ClaimPointer(inode->direct[i], inum, block_kind, i) && repair) {
+            inode->direct[i] = 0;
+            MarkInodeDirty(inum);
+        }
+    }
+
+    if (count > NUM_DIRECT && inode->indirect != 0) {
+        int levels = INDIRECT_LEVELS(inode->indirect);
+        bool claimed;
+        if (inode->indirect < 0 || levels > MAX_INDIRECT_LEVELS) {
+            Report(&problems.bad_pointers, repair, "inode %d: bad indirect pointer %#x", inum,
+                inode->indirect);
+            claimed = false;
+        } else {
+            claimed = Claim(INDIRECT_BLOCK(inode->indirect), inum, indirect_kinds[levels], 0);
+        }
+
+        if (!claimed && repair) {
+            inode->indirect = 0;
+            MarkInodeDirty(inum);
+        }
+    }
+}
+
+static void* CheckInodes(void* arg) {
+    long t = (long)arg;
+    int first = 1 + num_inodes * t / num_threads;
+    int last = 1 + num_inodes * (t + 1) / num_threads;
+
+    int inum;
+    for (inum = first; inum < last; ++inum) {
+        CheckInode(inum);
+    }
+
+    return NULL;
+}
+
+/* Claim what an indirect block lists, file_index holding the first block below it */
+static void CheckIndirect(int bnum, char* block) {
+    int inum = owner[bnum];
+    struct inode* inode = &inodes[inum];
+    int block_kind = (inode->type == INODE_DIRECTORY) ? KIND_DIRECTORY : KIND_DATA;
+    int* entries = (int*)block;
+    bool changed = false;
+
+    int levels = 1;
+    while (indirect_kinds[levels] != kind[bnum]) {
+        ++levels;
+    }
+
+    int span = Span(levels - 1);
+    int first = file_index[bnum];
+    int count = FileBlocks(inode) - NUM_DIRECT;
+    int i;
+    for (i = 0; i < PER_INDIRECT && i < (count - first + span - 1) / span; ++i) {
+        if (entries[i] == 0) {
+            continue;
+        }
+
+        bool claimed = (levels == 1) ?
+            ClaimPointer(entries[i], inum, block_kind, NUM_DIRECT + first + i) :
+            Claim(entries[i], inum, indirect_kinds[levels - 1], first + i * span);
+        if (!claimed && repair) {
+            entries[i] = 0;
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        WriteBlock(bnum, block);
+    }
+}
+
+static bool IsName(struct dir_entry* entry, char* name) {
+    return memcmp(entry->name, name, strlen(name) + 1) == 0;
+}
+
+static void CheckDirectoryBlock(int bnum, char* block) {
+    int dir = owner[bnum];
+    struct dir_entry* entries = (struct dir_entry*)block;
+    int first = file_index[bnum] * ENTRIES_PER_BLOCK;
+    bool changed = false;
+
+    int i;
+    for (i = 0; i < ENTRIES_PER_BLOCK && (first + i) * (int)sizeof(struct dir_entry) <
+        inodes[dir].size; ++i) {
+        int inum = entries[i].inum;
+        if (inum == 0) {
+            continue;
+        }
+
+        if (inum < 0 || inum > num_inodes || inodes[inum].type == INODE_FREE) {
+            Report(&problems.bad_entries, repair, "directory %d: entry %.*s names %s inode %d",
+                dir, DIRNAMELEN, entries[i].name, inum < 0 || inum > num_inodes ? "invalid" : "free",
+                inum);
+            if (repair) {
+                memset(&entries[i], 0, sizeof(struct dir_entry));
+                changed = true;
+            }
+            continue;
+        }
+
+        if (IsName(&entries[i], ".")) {
+            dot[dir] = inum;
+        } else if (IsName(&entries[i], "..")) {
+            dotdot[dir] = inum;
+        } else {
+            __sync_fetch_and_add(&names[inum], 1);
+            if (inodes[inum].type == INODE_DIRECTORY &&
+                __sync_val_compare_and_swap(&parent[inum], 0, dir) != 0) {
+                Report(&problems.dir_links, false, "directory %d: named more than once", inum);
+            }
+        }
+    }
+
+    if (changed) {
+        WriteBlock(bnum, block);
+    }
+}
+
+/* Threads take chunks of the data area in turn, skipping ones without block_kind */
+static void PassData(int block_kind, void (*check)(int, char*)) {
+    char* chunk = (char*)malloc((size_t)CHUNK_BLOCKS * BLOCKSIZE);
+    int chunks = (num_blocks - first_data_block + CHUNK_BLOCKS - 1) / CHUNK_BLOCKS;
+
+    int c;
+    while ((c = __sync_fetch_and_add(&next_chunk, 1)) < chunks) {
+        int first = first_data_block + c * CHUNK_BLOCKS;
+        int count = (num_blocks - first < CHUNK_BLOCKS) ? num_blocks - first : CHUNK_BLOCKS;
+
+        int i;
+        for (i = 0; i < count && kind[first + i] != block_kind; ++i) {
+            continue;
+        }
+        if (i == count) {
+            continue;
+        }
+
+        ReadBlocks(first, count, chunk);
+        for (; i < count; ++i) {
+            if (kind[first + i] == block_kind) {
+                check(first + i, chunk + (long)i * BLOCKSIZE);
+            }
+        }
+    }
+
+    free(chunk);
+}
+
+/* Kind of indirect block the current pass checks */
+static int indirect_pass_kind;
+
+static void* PassIndirect(void* arg) {
+    PassData(indirect_pass_kind, CheckIndirect);
+    return NULL;
+}
+
+static void* PassDirectories(void* arg) {
+    PassData(KIND_DIRECTORY, CheckDirectoryBlock);
+    return NULL;
+}
+
+static void CheckNames(int inum) {
+    struct inode* inode = &inodes[inum];
+    if (inode->type == INODE_FREE) {
+        return;
+    }
+
+    if (inode->type == INODE_DIRECTORY) {
+        int expected_parent = (inum == ROOTINODE) ? ROOTINODE : parent[inum];
+        if (dot[inum] != inum || (expected_parent != 0 && dotdot[inum] != expected_parent)) {
+            Report(&problems.bad_dots, false, "directory %d: \".\" is %d and \"..\" is %d",
+                inum, dot[inum], dotdot[inum]);
+        }
+    }
+
+    if (inum == ROOTINODE) {
+        return;
+    }
+
+    if (names[inum] == 0 && inode->nlink == 0) {
+        __sync_fetch_and_add(&orphans, 1);
+        return;
+    }
+
+    if (names[inum] == 0) {
+        bool fix = repair && inode->type != INODE_DIRECTORY;
+        Report(&problems.unnamed, fix, "inode %d: allocated but not in any directory", inum);
+        if (fix) {
+            memset(inode, 0, sizeof(struct inode));
+            MarkInodeDirty(inum);
+        }
+        return;
+    }
+
+    if (inode->nlink != names[inum]) {
+        Report(&problems.wrong_nlink, repair, "inode %d: nlink %d, named %d times", inum,
+            inode->nlink, names[inum]);
+        if (repair) {
+            inode->nlink = names[inum];
+            MarkInodeDirty(inum);
+        }
+    }
+}
+
+static void* CheckAllNames(void* arg) {
+    long t = (long)arg;
+    int first = 1 + num_inodes * t / num_threads;
+    int last = 1 + num_inodes * (t + 1) / num_threads;
+
+    int inum;
+    for (inum = first; inum < last; ++inum) {
+        CheckNames(inum);
+    }
+
+    return NULL;
+}
+
+/* The free map bit of every block, inode and fragment must match what owns it */
+static void CheckFreeMap(void) {
+    unsigned char* map = (unsigned char*)malloc((size_t)journal.map_blocks * BLOCKSIZE);
+    ReadBlocks(journal.map_start, journal.map_blocks, (char*)map);
+
+    bool changed = false;
+    int frag_base = num_blocks + num_inodes + 1;
+    int bit;
+    for (bit = 0; bit < frag_base + num_blocks * FRAGS_PER_BLOCK; ++bit) {
+        bool used;
+        if (bit < num_blocks) {
+            used = bit < first_data_block || bit >= data_end || owner[bit] != 0;
+        } else if (bit < frag_base) {
+            used = bit == num_blocks || inodes[bit - num_blocks].type != INODE_FREE;
+        } else {
+            used = (frags[(bit - frag_base) / FRAGS_PER_BLOCK] >> ((bit - frag_base) % FRAGS_PER_BLOCK)) & 1;
+        }
+
+        bool marked = (map[bit / 8] >> (bit % 8)) & 1;
+        if (marked == used) {
+            continue;
+        }
+
+        if (bit < frag_base) {
+            Report(&problems.bad_map, repair, "free map: %s %d marked %s",
+                bit < num_blocks ? "block" : "inode", bit < num_blocks ? bit : bit - num_blocks,
+                marked ? "used" : "free");
+        } else {
+            Report(&problems.bad_map, repair, "free map: fragment %d.%d marked %s",
+                (bit - frag_base) / FRAGS_PER_BLOCK, (bit - frag_base) % FRAGS_PER_BLOCK,
+                marked ? "used" : "free");
+        }
+        map[bit / 8] ^= 1 << (bit % 8);
+        changed = true;
+    }
+
+    if (changed && repair) {
+        int i;
+        for (i = 0; i < journal.map_blocks; ++i) {
+            WriteBlock(journal.map_start + i, (char*)map + (long)i * BLOCKSIZE);
+        }
+    }
+
+    free(map);
+}
+
+static double NowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+    num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    int i = 1;
+    while (i < argc && argv[i][0] == '-') {
+        if (strcmp(argv[i], "-r") == 0) {
+            repair = true;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            num_threads = atoi(argv[++i]);
+        } else {
+            break;
+        }
+        ++i;
+    }
+
+    if (argc - i != 1) {
+        fprintf(stderr, "usage: yfsck [-r] [-j threads] disk_file\n");
+        exit(8);
+    }
+
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+    if (num_threads > MAX_THREADS) {
+        num_threads = MAX_THREADS;
+    }
+
+    char* path = argv[i];
+    disk_fd = open(path, repair ? O_RDWR : O_RDONLY);
+    if (disk_fd < 0) {
+        perror(path);
+        exit(8);
+    }
+
+    double start = NowSeconds();
+
+    /* Sector 1 gives the block size, then block 1 holds the live header */
+    struct fs_header header;
+    char* block = (char*)malloc(MAX_BLOCKSIZE);
+    ReadBlocks(1, 1, block);
+    block_shift = BLOCK_SHIFT((struct fs_header*)block);
+    if (block_shift < 0 || block_shift > MAX_BLOCK_SHIFT) {
+        fprintf(stderr, "%s: not a YFS image\n", path);
+        exit(8);
+    }
+    ReadBlocks(1, 1, block);
+    memcpy(&header, block, sizeof(header));
+    num_blocks = header.num_blocks;
+    num_inodes = header.num_inodes;
+    first_data_block = 1 + (num_inodes + INODES_PER_BLOCK) / INODES_PER_BLOCK;
+    max_file_blocks = (Span(MAX_INDIRECT_LEVELS) > INT_MAX - NUM_DIRECT) ? INT_MAX :
+        NUM_DIRECT + Span(MAX_INDIRECT_LEVELS);
+    if (num_blocks <= 0 || num_inodes <= 0 || first_data_block >= num_blocks) {
+        fprintf(stderr, "%s: not a YFS image\n", path);
+        exit(8);
+    }
+
+    data_end = num_blocks;
+    memcpy(&journal, header.padding, sizeof(journal));
+    if (journal.magic == JOURNAL_MAGIC) {
+        if (journal.start + journal.blocks != num_blocks ||
+            journal.map_start + journal.map_blocks != journal.start ||
+            journal.map_start <= first_data_block || journal.map_blocks <= 0 ||
+            journal.map_blocks * BLOCKSIZE * 8 < num_blocks + num_inodes + 1 + num_blocks * FRAGS_PER_BLOCK) {
+            fprintf(stderr, "%s: bad journal header\n", path);
+            exit(8);
+        }
+
+        /* A group at the start of the journal with the header's seq isn't home yet */
+        struct journal_record* record = (struct journal_record*)block;
+        ReadBlocks(journal.start, 1, block);
+        if (record->seq == journal.seq &&
+            (record->magic == JOURNAL_DESC_MAGIC || record->magic == JOURNAL_COMMIT_MAGIC)) {
+            printf("%s: the journal holds changes not written home, mount the image to replay them\n",
+                path);
+            exit(4);
+        }
+
+        data_end = journal.map_start;
+    }
+
+    inodes = (struct inode*)malloc((size_t)(first_data_block - 1) * BLOCKSIZE);
+    dirty_inode_blocks = (char*)calloc(first_data_block, 1);
+    owner = (int*)calloc(num_blocks, sizeof(int));
+    kind = (char*)calloc(num_blocks, 1);
+    file_index = (int*)calloc(num_blocks, sizeof(int));
+    frags = (unsigned int*)calloc(num_blocks, sizeof(unsigned int));
+    names = (int*)calloc(num_inodes + 1, sizeof(int));
+    parent = (int*)calloc(num_inodes + 1, sizeof(int));
+    dot = (int*)calloc(num_inodes + 1, sizeof(int));
+    dotdot = (int*)calloc(num_inodes + 1, sizeof(int));
+
+    RunThreads(ReadInodeTable);
+    if (inodes[ROOTINODE].type != INODE_DIRECTORY) {
+        printf("%s: root inode is not a directory\n", path);
+        exit(4);
+    }
+
+    RunThreads(CheckInodes);
+
+    /* Each level of indirect blocks claims the level below for the next pass */
+    int levels;
+    for (levels = MAX_INDIRECT_LEVELS; levels > 0; --levels) {
+        next_chunk = 0;
+        indirect_pass_kind = indirect_kinds[levels];
+        RunThreads(PassIndirect);
+    }
+
+    next_chunk = 0;
+    RunThreads(PassDirectories);
+    RunThreads(CheckAllNames);
+    if (data_end < num_blocks) {
+        CheckFreeMap();
+    }
+
+    int bnum;
+    for (bnum = 1; bnum < first_data_block; ++bnum) {
+        if (dirty_inode_blocks[bnum]) {
+            WriteBlock(bnum, (char*)inodes + (long)(bnum - 1) * BLOCKSIZE);
+        }
+    }
+    close(disk_fd);
+
+    double seconds = NowSeconds() - start;
+
+    int free_blocks = 0;
+    for (bnum = first_data_block; bnum < data_end; ++bnum) {
+        if (owner[bnum] == 0) {
+            ++free_blocks;
+        }
+    }
+
+    int free_inodes = 0;
+    int inum;
+    for (inum = 1; inum <= num_inodes; ++inum) {
+        if (inodes[inum].type == INODE_FREE) {
+            ++free_inodes;
+        }
+    }
+
+    if (num_messages > MAX_MESSAGES) {
+        printf("... %d more\n", num_messages - MAX_MESSAGES);
+    }
+
+    int total = problems.bad_inodes + problems.bad_pointers + problems.cross_links +
+        problems.bad_entries + problems.bad_dots + problems.unnamed + problems.dir_links +
+        problems.wrong_nlink + problems.bad_map;
+    printf("%s: %d blocks of %d bytes, %d inodes, %d free blocks, %d free inodes, "
+        "%d awaiting reclamation\n", path, num_blocks, BLOCKSIZE, num_inodes, free_blocks,
+        free_inodes, orphans);
+    printf("%d problems, %d repaired: %d bad inodes, %d bad pointers, %d cross-linked blocks, "
+        "%d bad entries, %d bad \".\" or \"..\", %d unnamed inodes, %d directory hard links, "
+        "%d wrong nlink, %d free map bits\n", total, problems.repaired, problems.bad_inodes,
+        problems.bad_pointers, problems.cross_links, problems.bad_entries, problems.bad_dots,
+        problems.unnamed, problems.dir_links, problems.wrong_nlink, problems.bad_map);
+    printf("read %lld bytes in %.3f s with %d threads, %.1f MB/s\n", bytes_read, seconds,
+        num_threads, seconds > 0 ? bytes_read / seconds / 1e6 : 0.0);
+
+    if (total == 0) {
+        return 0;
+    }
+
+    return (problems.repaired == total) ? 1 : 4;
+}
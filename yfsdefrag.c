@@ -0,0 +1,490 @@
+/*
+ *  Repack a YFS image offline: every file and directory is rewritten as
+ *  one contiguous run of blocks, directories lose their empty slots, and
+ *  the free space ends up in one extent at the end of the disk.
+ *
+ *  Usage: yfsdefrag [-o output_disk] disk_file
+ *
+ *  The repacked image goes to output_disk (default "DISK.defrag"), the
+ *  input is left alone.  Directories are placed breadth first from the
+ *  root, each directory's blocks followed by the files in it, in the
+ *  order of its entries.  Inodes allocated but not reachable from the
+ *  root go last.  Holes stay holes, inline data stays in its inode, and
+ *  the partial last block of every file is packed as a tail (see yfs.h)
+ *  into shared blocks filled in placement order.
+ *
+ *  Inode numbers never change, so handles and inode numbers held by
+ *  clients stay valid.  That also means an inode can't move to another
+ *  inode block: only data blocks are regrouped.
+ *
+ *  An image whose journal still holds changes is refused: mount it first
+ *  so they are replayed.  The repacked image has no journal, its space is
+ *  free; mount it with yfs -J to make a new one.
+ *
+ *  Both images are then measured with the server in-process, each from a
+ *  cold start: reading every file front to back in tree order, and a
+ *  Stat of every path.  Sector reads and seeks (reads that don't
+ *  continue where the previous access ended) are what a real disk pays
+ *  for; the MB/s is host time.
+ *
+ *  RUN THIS COMMAND AS A UNIX PROGRAM, NOT AS A YALNIX PROGRAM.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <comp421/yalnix.h>
+#include <comp421/filesystem.h>
+#include "include/iolib.h"
+#include "include/hostshim.h"
+#include "include/image.h"
+#include "include/journal.h"
+
+#define DEFAULT_OUTPUT "DISK.defrag"
+
+/* Read buffer for the sequential read measurement */
+#define READ_CHUNK (16 * BLOCKSIZE)
+
+static char* old_disk;
+static char* new_disk;
+static int num_blocks;
+static int num_inodes;
+
+/* Next free block of the new image */
+static int next_block;
+
+/* Block the tails placed so far are packed into, and its next free fragment */
+static int tail_block = 0;
+static int tail_frag = 0;
+
+/* First path found to every inode, NULL if not reachable */
+static char** paths;
+static bool* placed;
+/* Inode numbers in the order they were placed */
+static int* order;
+static int num_placed = 0;
+
+static int dropped_slots = 0;
+
+static char* Block(char* disk, int bnum) {
+    return disk + (long)bnum * BLOCKSIZE;
+}
+
+static struct inode* Inode(char* disk, int inum) {
+    return (struct inode*)Block(disk, 1 + inum / IMAGE_INODES_PER_BLOCK) +
+        inum % IMAGE_INODES_PER_BLOCK;
+}
+
+static bool ValidBlock(int bnum) {
+    return bnum > 0 && bnum < num_blocks;
+}
+
+/* Old pointer of block i past the direct ones, down the indirect tree, 0 for a hole */
+static int OldIndirect(struct inode* inode, int i) {
+    int levels = INDIRECT_LEVELS(inode->indirect);
+    if (inode->indirect <= 0 || levels > MAX_INDIRECT_LEVELS || i >= IndirectSpan(levels)) {
+        return 0;
+    }
+
+    int ptr = INDIRECT_BLOCK(inode->indirect);
+    for (; levels > 0; --levels) {
+        if (!ValidBlock(ptr)) {
+            return 0;
+        }
+
+        int span = IndirectSpan(levels - 1);
+        ptr = ((int*)Block(old_disk, ptr))[i / span];
+        i %= span;
+    }
+
+    return ptr;
+}
+
+/* Old data of file block i, in its block or its tail's fragments, NULL for a hole */
+static char* OldData(struct inode* inode, int i) {
+    int ptr = (i < NUM_DIRECT) ? inode->direct[i] : OldIndirect(inode, i - NUM_DIRECT);
+
+    if (IS_TAIL(ptr)) {
+        return ValidBlock(TAIL_BLOCK(ptr)) ? Block(old_disk, TAIL_BLOCK(ptr)) + TAIL_FRAG(ptr) * FRAGSIZE : NULL;
+    }
+
+    return ValidBlock(ptr) ? Block(old_disk, ptr) : NULL;
+}
+
+/* Pack len bytes of a tail into the block of tails being filled, return its tail pointer */
+static int PlaceTail(char* src, int len) {
+    int count = (len + FRAGSIZE - 1) / FRAGSIZE;
+    if (tail_block == 0 || tail_frag + count > FRAGS_PER_BLOCK) {
+        tail_block = next_block++;
+        tail_frag = 0;
+    }
+
+    memcpy(Block(new_disk, tail_block) + tail_frag * FRAGSIZE, src, len);
+    int ptr = TAIL_POINTER(tail_block, tail_frag);
+    tail_frag += count;
+    return ptr;
+}
+
+/*
+ * Slot for the pointer of new block i past the direct ones, placing the
+ * indirect blocks on the way that aren't there yet, so each goes right
+ * before the first data it leads to.
+ */
+static int* NewIndirectSlot(struct inode* inode, int i) {
+    int levels = INDIRECT_LEVELS(inode->indirect);
+    int* block = (int*)Block(new_disk, INDIRECT_BLOCK(inode->indirect));
+    for (; levels > 1; --levels) {
+        int span = IndirectSpan(levels - 1);
+        if (block[i / span] == 0) {
+            block[i / span] = next_block++;
+        }
+
+        block = (int*)Block(new_disk, block[i / span]);
+        i %= span;
+    }
+
+    return &block[i];
+}
+
+/*
+ * Give inum new contiguous blocks, copying its data from the old image,
+ * or from data when it isn't NULL (a compacted directory).
+ */
+static void Place(int inum, char* data) {
+    struct inode* old = Inode(old_disk, inum);
+    struct inode* new = Inode(new_disk, inum);
+    /* Inline data came over with the inode table */
+    if (IS_INLINE(old)) {
+        placed[inum] = true;
+        order[num_placed++] = inum;
+        return;
+    }
+
+    int count = (new->size + BLOCKSIZE - 1) / BLOCKSIZE;
+    if (count - NUM_DIRECT > IndirectSpan(MAX_INDIRECT_LEVELS)) {
+        count = NUM_DIRECT + IndirectSpan(MAX_INDIRECT_LEVELS);
+    }
+
+    /* The root of the indirect tree, only as deep as the size needs, goes first */
+    memset(new->direct, 0, sizeof(new->direct));
+    new->indirect = 0;
+    if (count > NUM_DIRECT) {
+        int levels = 1;
+        while (count - NUM_DIRECT > IndirectSpan(levels)) {
+            ++levels;
+        }
+        new->indirect = INDIRECT_POINTER(next_block++, levels);
+    }
+
+    int i;
+    for (i = 0; i < count; ++i) {
+        char* src = (data != NULL) ? data + (long)i * BLOCKSIZE : OldData(old, i);
+        if (src == NULL) {
+            continue;
+        }
+
+        int* slot = (i < NUM_DIRECT) ? &new->direct[i] : NewIndirectSlot(new, i - NUM_DIRECT);
+
+        /* The partial last block of a file becomes a tail, whatever it was */
+        int len = (i == count - 1) ? TAIL_LENGTH(new->size) : BLOCKSIZE;
+        int bnum;
+        if (i == count - 1 && new->type != INODE_DIRECTORY && len < BLOCKSIZE &&
+            TAIL_FRAGS(new->size) < FRAGS_PER_BLOCK) {
+            bnum = PlaceTail(src, len);
+        } else {
+            bnum = next_block++;
+            memcpy(Block(new_disk, bnum), src, len);
+        }
+
+        *slot = bnum;
+    }
+
+    placed[inum] = true;
+    order[num_placed++] = inum;
+}
+
+/* Live entries of directory inum, "." and ".." first, into a new buffer */
+static char* CompactDirectory(int inum, int* count) {
+    struct inode* old = Inode(old_disk, inum);
+    int slots = old->size / sizeof(struct dir_entry);
+    struct dir_entry* entries = (struct dir_entry*)calloc(slots + 1, sizeof(struct dir_entry));
+    int per_block = BLOCKSIZE / sizeof(struct dir_entry);
+
+    *count = 0;
+    int i;
+    for (i = 0; i < slots; ++i) {
+        char* block = OldData(old, i / per_block);
+        struct dir_entry* entry = (block == NULL) ? NULL : (struct dir_entry*)block + i % per_block;
+
+        if (entry == NULL || entry->inum <= 0 || entry->inum > num_inodes) {
+            ++dropped_slots;
+            continue;
+        }
+
+        entries[(*count)++] = *entry;
+    }
+
+    return (char*)entries;
+}
+
+static void SetPath(int inum, char* dir_path, struct dir_entry* entry) {
+    if (paths[inum] != NULL) {
+        return;
+    }
+
+    char name[DIRNAMELEN + 1];
+    memset(name, 0, sizeof(name));
+    memcpy(name, entry->name, DIRNAMELEN);
+
+    paths[inum] = (char*)malloc(strlen(dir_path) + strlen(name) + 2);
+    sprintf(paths[inum], "%s/%s", dir_path, name);
+}
+
+static void Repack(void) {
+    int* queue = (int*)malloc((num_inodes + 1) * sizeof(int));
+    int head = 0;
+    int tail = 0;
+    queue[tail++] = ROOTINODE;
+    paths[ROOTINODE] = strdup("");
+
+    while (head < tail) {
+        int dir = queue[head++];
+        int count;
+        char* entries = CompactDirectory(dir, &count);
+        Inode(new_disk, dir)->size = count * sizeof(struct dir_entry);
+        Place(dir, entries);
+
+        /* Subdirectories are placed when their turn in the queue comes */
+        int i;
+        for (i = 0; i < count; ++i) {
+            struct dir_entry* entry = (struct dir_entry*)entries + i;
+            int inum = entry->inum;
+            if (memcmp(entry->name, ".", 2) == 0 || memcmp(entry->name, "..", 3) == 0 ||
+                placed[inum]) {
+                continue;
+            }
+
+            SetPath(inum, paths[dir], entry);
+            if (Inode(old_disk, inum)->type == INODE_DIRECTORY) {
+                placed[inum] = true;
+                queue[tail++] = inum;
+            } else if (Inode(old_disk, inum)->type != INODE_FREE) {
+                Place(inum, NULL);
+            }
+        }
+
+        free(entries);
+    }
+
+    /* Unreachable inodes keep their data */
+    int inum;
+    for (inum = 1; inum <= num_inodes; ++inum) {
+        if (!placed[inum] && Inode(old_disk, inum)->type != INODE_FREE) {
+            Place(inum, NULL);
+        }
+    }
+
+    free(queue);
+}
+
+static int ReadImage(char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return ERROR;
+    }
+
+    old_disk = (char*)calloc(NUMSECTORS, SECTORSIZE);
+    fread(old_disk, SECTORSIZE, NUMSECTORS, file);
+    fclose(file);
+
+    /* Sector 1 gives the block size, see yfs.h */
+    block_shift = BLOCK_SHIFT((struct fs_header*)(old_disk + SECTORSIZE));
+    if (block_shift < 0 || block_shift > MAX_BLOCK_SHIFT) {
+        fprintf(stderr, "%s: not a YFS image\n", path);
+        return ERROR;
+    }
+
+    struct fs_header* header = (struct fs_header*)Block(old_disk, 1);
+    num_blocks = header->num_blocks;
+    num_inodes = header->num_inodes;
+    if (num_blocks <= 0 || num_blocks > NUMSECTORS >> block_shift || num_inodes <= 0 ||
+        1 + (num_inodes + IMAGE_INODES_PER_BLOCK) / IMAGE_INODES_PER_BLOCK >= num_blocks ||
+        Inode(old_disk, ROOTINODE)->type != INODE_DIRECTORY) {
+        fprintf(stderr, "%s: not a YFS image\n", path);
+        return ERROR;
+    }
+
+    struct journal_header* journal = (struct journal_header*)header->padding;
+    if (journal->magic == JOURNAL_MAGIC && journal->start > 0 && journal->start < num_blocks) {
+        struct journal_record* record = (struct journal_record*)Block(old_disk, journal->start);
+        if (record->seq == journal->seq &&
+            (record->magic == JOURNAL_DESC_MAGIC || record->magic == JOURNAL_COMMIT_MAGIC)) {
+            fprintf(stderr, "%s: the journal holds changes not written home, mount it first\n", path);
+            return ERROR;
+        }
+    }
+
+    return 0;
+}
+
+static int WriteImage(char* path) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        perror(path);
+        return ERROR;
+    }
+
+    if (fwrite(new_disk, SECTORSIZE, NUMSECTORS, file) != NUMSECTORS) {
+        perror(path);
+        fclose(file);
+        return ERROR;
+    }
+
+    return fclose(file);
+}
+
+static double NowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void SequentialRead(void) {
+    HostDiskStats disk;
+    GetHostDiskStats(&disk, true);
+
+    char* buf = (char*)malloc(READ_CHUNK);
+    long long bytes = 0;
+    int files = 0;
+    double start = NowSeconds();
+    int i;
+    for (i = 0; i < num_placed; ++i) {
+        int inum = order[i];
+        if (paths[inum] == NULL || Inode(old_disk, inum)->type != INODE_REGULAR) {
+            continue;
+        }
+
+        int fd = Open(paths[inum]);
+        if (fd == ERROR) {
+            continue;
+        }
+
+        int len;
+        while ((len = Read(fd, buf, READ_CHUNK)) > 0) {
+            bytes += len;
+        }
+        Close(fd);
+        ++files;
+    }
+    double seconds = NowSeconds() - start;
+
+    GetHostDiskStats(&disk, true);
+    printf("sequential read: %d files, %lld bytes, %d sector reads, %d seeks, %.2f MB/s\n",
+        files, bytes, disk.reads, disk.seeks, seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+}
+
+static void PathWalk(void) {
+    HostDiskStats disk;
+    GetHostDiskStats(&disk, true);
+
+    int walked = 0;
+    struct Stat st;
+    int inum;
+    for (inum = 1; inum <= num_inodes; ++inum) {
+        if (paths[inum] != NULL && inum != ROOTINODE && Stat(paths[inum], &st) == 0) {
+            ++walked;
+        }
+    }
+
+    GetHostDiskStats(&disk, true);
+    printf("path walk: %d paths, %d sector reads, %d seeks\n", walked, disk.reads, disk.seeks);
+}
+
+/* Run test against the server booted on path in a child process, so it starts cold */
+static void RunCold(char* path, void (*test)(void)) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid != 0) {
+        int status;
+        waitpid(pid, &status, 0);
+        return;
+    }
+
+    CacheConfig config;
+    InitCacheConfig(&config);
+    if (BootHostServer(path, &config, NULL) == ERROR) {
+        exit(1);
+    }
+
+    test();
+    fflush(stdout);
+    _exit(0);
+}
+
+static void Measure(char* label, char* path) {
+    ImageStats stats;
+    if (OpenHostDisk(path) == ERROR || ScanImage(&stats) == ERROR) {
+        return;
+    }
+    CloseHostDisk();
+
+    printf("%s (%s):\n", label, path);
+    PrintImageStats(stdout, &stats);
+    RunCold(path, SequentialRead);
+    RunCold(path, PathWalk);
+}
+
+int main(int argc, char** argv) {
+    char* output = DEFAULT_OUTPUT;
+
+    int i = 1;
+    if (i + 1 < argc && strcmp(argv[i], "-o") == 0) {
+        output = argv[i + 1];
+        i += 2;
+    }
+
+    if (argc - i != 1) {
+        fprintf(stderr, "usage: yfsdefrag [-o output_disk] disk_file\n");
+        exit(1);
+    }
+
+    char* input = argv[i];
+    if (ReadImage(input) == ERROR) {
+        exit(1);
+    }
+
+    /* Boot block and inode table carry over, block numbers are redone */
+    int first_data_block = 1 + (num_inodes + IMAGE_INODES_PER_BLOCK) / IMAGE_INODES_PER_BLOCK;
+    new_disk = (char*)calloc(NUMSECTORS, SECTORSIZE);
+    memcpy(new_disk, old_disk, (long)first_data_block * BLOCKSIZE);
+    /* The journal and its free map aren't carried over, the block size is */
+    struct fs_header* header = (struct fs_header*)Block(new_disk, 1);
+    memset(header->padding, 0, sizeof(header->padding));
+    BLOCK_SHIFT(header) = block_shift;
+
+    paths = (char**)calloc(num_inodes + 1, sizeof(char*));
+    placed = (bool*)calloc(num_inodes + 1, sizeof(bool));
+    order = (int*)malloc((num_inodes + 1) * sizeof(int));
+    next_block = first_data_block;
+
+    Repack();
+    if (next_block > num_blocks) {
+        fprintf(stderr, "%s: repacked image needs %d blocks\n", input, next_block);
+        exit(1);
+    }
+
+    if (WriteImage(output) == ERROR) {
+        exit(1);
+    }
+
+    printf("%s -> %s: %d inodes repacked into blocks %d-%d, %d empty directory slots dropped\n",
+        input, output, num_placed, first_data_block, next_block - 1, dropped_slots);
+
+    Measure("before", input);
+    Measure("after", output);
+    return 0;
+}
@@ -0,0 +1,349 @@
+/*
+ *  Replay a request stream recorded by a yfs built with RECORD=1
+ *  against a copy of a DISK image, and report throughput and latency.
+ *
+ *  Usage: yfsreplay [-r] [-o output_disk] [-a access_file] [cache options]
+ *		trace_file disk_file
+ *
+ *  trace_file is the simulator's TRACE output (or any file whose lines
+ *  start with "yfsrec ").  disk_file is copied to output_disk (default
+ *  "DISK.replay") and the copy is replayed on, so the same image can be
+ *  reused for every run.  Requests run as fast as possible unless -r is
+ *  given, which spaces them by their recorded arrival times in cycles.
+ *  -a writes every inode and block cache lookup to access_file, the
+ *  input of yfscachesim.  The cache options are those of yfs: -b and -i
+ *  set the block and inode cache entries, -m a memory budget in KB and
+ *  -s the inode cache's percent of it.
+ *
+ *  The disk must hold the image the trace was recorded on: inode numbers
+ *  and handles are replayed as recorded.  Requests that diverge (fail in
+ *  one run and succeed in the other) are counted.
+ *
+ *  RUN THIS COMMAND AS A UNIX PROGRAM, NOT AS A YALNIX PROGRAM.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <comp421/filesystem.h>
+#include <comp421/yalnix.h>
+#include "include/yfs.h"
+#include "include/coroutine.h"
+#include "include/record.h"
+#include "include/latency.h"
+#include "include/histogram.h"
+#include "include/yfstime.h"
+#include "include/hostshim.h"
+#include "include/cachesim.h"
+#include "include/journal.h"
+#include "include/reclaim.h"
+
+#define DEFAULT_OUTPUT "DISK.replay"
+
+/* Longest trace line: tag, space, hex record, newline */
+#define MAX_LINE (2 * (sizeof(RecordHeader) + 2 * MAXPATHNAMELEN) + 16)
+
+/* Recorded handle -> handle in this run */
+static HashTable* handle_map;
+
+/* Read and write buffers, grown to the largest request */
+static char* scratch = NULL;
+static int scratch_size = 0;
+
+static Histogram latency[YFS_STATS_OPS];
+
+static FILE* access_file = NULL;
+
+static int num_replayed = 0;
+static int num_skipped = 0;
+static int num_diverged = 0;
+
+static int CopyFile(char* from, char* to) {
+    FILE* in = fopen(from, "rb");
+    if (in == NULL) {
+        perror(from);
+        return -1;
+    }
+
+    FILE* out = fopen(to, "wb");
+    if (out == NULL) {
+        perror(to);
+        fclose(in);
+        return -1;
+    }
+
+    char buf[BLOCKSIZE];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), in)) > 0) {
+        fwrite(buf, 1, len, out);
+    }
+
+    fclose(in);
+    return fclose(out);
+}
+
+static int HexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+/* Decode one "yfsrec <hex>" line into record, return its length or -1 */
+static int DecodeRecord(char* line, char* record) {
+    char* hex = strstr(line, RECORD_TAG " ");
+    if (hex == NULL) {
+        return -1;
+    }
+    hex += strlen(RECORD_TAG) + 1;
+
+    int len = 0;
+    while (HexValue(hex[0]) >= 0 && HexValue(hex[1]) >= 0) {
+        record[len++] = (char)((HexValue(hex[0]) << 4) | HexValue(hex[1]));
+        hex += 2;
+    }
+
+    RecordHeader* header = (RecordHeader*)record;
+    if (len < (int)sizeof(RecordHeader) ||
+        len != (int)sizeof(RecordHeader) + header->path_len + header->path2_len) {
+        return -1;
+    }
+
+    return len;
+}
+
+static char* GetScratch(int size) {
+    if (size > scratch_size) {
+        scratch = (char*)realloc(scratch, size);
+        memset(scratch + scratch_size, 'y', size - scratch_size);
+        scratch_size = size;
+    }
+
+    return scratch;
+}
+
+/* Recorded handle to the one open in this run, or ERROR */
+static int MapHandle(int handle) {
+    void* mapped = GetItemFromHashTable(handle_map, handle);
+    return (mapped == NULL) ? ERROR : (int)(long)mapped - 1;
+}
+
+/*
+ * Rebuild the message the client sent.  Return false for requests that
+ * can't or shouldn't be replayed.
+ */
+static bool BuildMessage(RecordHeader* header, char* path, char* path2, Message* msg,
+    struct IoVec* iov) {
+    memset(msg, 0, sizeof(Message));
+    msg->type = header->type;
+    msg->data1 = header->data1;
+    msg->data2 = header->data2;
+    msg->data3 = header->data3;
+    msg->addr1 = (void*)path;
+    msg->addr2 = (void*)path2;
+
+    switch (header->type) {
+        case OPEN:
+        case CREATE:
+        case LINK:
+        case UNLINK:
+        case SYMLINK:
+        case MKDIR:
+        case RMDIR:
+        case CHDIR:
+        case SYNC:
+        case TRUNCATE:
+        case RENAME:
+            return true;
+        case READLINK:
+            msg->addr2 = (void*)GetScratch(header->data2);
+            return true;
+        case STAT:
+            msg->addr2 = (void*)GetScratch(sizeof(struct Stat));
+            return true;
+        case READDIRPLUS:
+        case STATS:
+            msg->addr1 = (void*)GetScratch(header->data2);
+            return true;
+        case SEEK:
+        case CLOSE:
+        case FTRUNCATE:
+            msg->data1 = MapHandle(header->data1);
+            return msg->data1 != ERROR;
+        case READ:
+        case WRITE:
+        case PREAD:
+        case PWRITE:
+            msg->data1 = MapHandle(header->data1);
+            msg->addr1 = (void*)GetScratch(header->data2);
+            return msg->data1 != ERROR;
+        case READV:
+        case WRITEV:
+            /* Segment lengths aren't recorded, so move the bytes in one */
+            msg->data1 = MapHandle(header->data1);
+            msg->data2 = 1;
+            iov->base = (void*)GetScratch(header->size);
+            iov->len = header->size;
+            msg->addr1 = (void*)iov;
+            return msg->data1 != ERROR;
+        default:
+            /* BATCH ops are recorded one by one, SHUTDOWN would exit */
+            return false;
+    }
+}
+
+static void TraceAccess(Cache* cache, int key) {
+    CacheAccess access;
+    access.cache = (cache == inode_cache) ? ACCESS_INODE : ACCESS_BLOCK;
+    access.key = key;
+    fwrite(&access, sizeof(CacheAccess), 1, access_file);
+}
+
+static unsigned long long NowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void ReplayRecord(char* record, bool real_time, unsigned long long* first_time,
+    unsigned long long start_tsc) {
+    RecordHeader* header = (RecordHeader*)record;
+    char path[MAXPATHNAMELEN + 1];
+    char path2[MAXPATHNAMELEN + 1];
+    memset(path, 0, sizeof(path));
+    memset(path2, 0, sizeof(path2));
+    memcpy(path, record + sizeof(RecordHeader), header->path_len);
+    memcpy(path2, record + sizeof(RecordHeader) + header->path_len, header->path2_len);
+
+    Message msg;
+    struct IoVec iov;
+    if (!BuildMessage(header, path, path2, &msg, &iov)) {
+        ++num_skipped;
+        return;
+    }
+
+    unsigned long long arrival = ((unsigned long long)header->time_hi << 32) | header->time_lo;
+    if (*first_time == 0) {
+        *first_time = arrival;
+    }
+
+    if (real_time && arrival > *first_time) {
+        while (ReadTimeStamp() - start_tsc < arrival - *first_time) {
+            continue;
+        }
+    }
+
+    unsigned long long start = NowNs();
+    DispatchMessage(&msg, 0);
+    ReclaimDeferred();
+    ReclaimBetweenRequests();
+    RecordValue(&latency[header->type], NowNs() - start);
+    ++num_replayed;
+
+    if ((msg.type == ERROR) != (header->reply_type == ERROR)) {
+        ++num_diverged;
+    }
+
+    if ((header->type == OPEN || header->type == CREATE) &&
+        header->reply_type != ERROR && msg.type != ERROR) {
+        PutItemInHashTable(handle_map, header->reply_data2, (void*)(long)(msg.data2 + 1));
+    }
+
+    if (header->type == CLOSE) {
+        RemoveItemFromHashTable(handle_map, header->data1);
+    }
+}
+
+static void Report(double seconds) {
+    printf("%d requests replayed, %d skipped, %d diverged\n",
+        num_replayed, num_skipped, num_diverged);
+    printf("%.3f s, %.0f requests/s\n", seconds,
+        seconds > 0 ? num_replayed / seconds : 0.0);
+    printf("block cache: %d entries, %u hits, %u misses; inode cache: %d entries, %u hits, %u misses\n",
+        block_cache->capacity, block_cache->hits, block_cache->misses,
+        inode_cache->capacity, inode_cache->hits, inode_cache->misses);
+
+    printf("%-12s %8s %10s %10s %10s  (us)\n", "request", "count", "p50", "p99", "max");
+    int i;
+    for (i = 0; i < YFS_STATS_OPS; ++i) {
+        if (latency[i].total == 0) {
+            continue;
+        }
+
+        printf("%-12s %8u %10.1f %10.1f %10.1f\n", OpName(i), latency[i].total,
+            GetPercentile(&latency[i], 50.0) / 1000.0,
+            GetPercentile(&latency[i], 99.0) / 1000.0,
+            latency[i].max / 1000.0);
+    }
+}
+
+int main(int argc, char** argv) {
+    bool real_time = false;
+    char* output = DEFAULT_OUTPUT;
+    CacheConfig config;
+    InitCacheConfig(&config);
+
+    int i = 1;
+    while (i < argc && argv[i][0] == '-') {
+        if (strcmp(argv[i], "-r") == 0) {
+            real_time = true;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            access_file = fopen(argv[++i], "wb");
+            if (access_file == NULL) {
+                perror(argv[i]);
+                exit(1);
+            }
+        } else if (i + 1 < argc && ParseCacheOption(&config, argv[i], argv[i + 1])) {
+            ++i;
+        } else {
+            break;
+        }
+        ++i;
+    }
+
+    if (argc - i != 2) {
+        fprintf(stderr, "usage: yfsreplay [-r] [-o output_disk] [-a access_file] "
+            "[-b blocks] [-i inodes] [-m kb] [-s inode_percent] trace_file disk_file\n");
+        exit(1);
+    }
+
+    FILE* trace = fopen(argv[i], "r");
+    if (trace == NULL) {
+        perror(argv[i]);
+        exit(1);
+    }
+
+    if (CopyFile(argv[i + 1], output) != 0 || BootHostServer(output, &config, NULL) == ERROR) {
+        exit(1);
+    }
+    if (access_file != NULL) {
+        inode_cache->on_access = TraceAccess;
+        block_cache->on_access = TraceAccess;
+    }
+    handle_map = InitHashTable(MAX_OPEN_FILES * 16);
+
+    char* line = (char*)malloc(MAX_LINE);
+    char* record = (char*)malloc(MAX_LINE / 2);
+    unsigned long long first_time = 0;
+    unsigned long long start_tsc = ReadTimeStamp();
+    unsigned long long start = NowNs();
+
+    while (fgets(line, MAX_LINE, trace) != NULL) {
+        if (DecodeRecord(line, record) > 0) {
+            ReplayRecord(record, real_time, &first_time, start_tsc);
+        }
+    }
+
+    SyncFileSystem();
+    double seconds = (NowNs() - start) / 1e9;
+    CloseHostDisk();
+    fclose(trace);
+    if (access_file != NULL) {
+        fclose(access_file);
+    }
+
+    Report(seconds);
+    return 0;
+}